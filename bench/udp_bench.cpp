@@ -0,0 +1,154 @@
+// Loopback UDP benchmark: one sender and one receiver thread move
+// file-sized datagrams with one syscall each, with sendmmsg/recvmmsg
+// batches, and with GSO/GRO. Prints datagrams per second and CPU time per
+// datagram on each side.
+#include "datagram_batch.hpp"
+#include "message.hpp"
+#include "socket.hpp"
+#include "typedef.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+constexpr uint32_t DEFAULT_DATAGRAMS = 200000;
+constexpr uint32_t PORT = 47123;
+constexpr int SOCKET_BUFFER_BYTES = 8 << 20;
+
+enum class Mode { SINGLE, BATCH, OFFLOAD };
+
+struct Result {
+  uint64_t datagrams = 0;
+  double seconds = 0;
+  double cpu_seconds = 0;
+};
+
+double thread_cpu_seconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int open_socket(uint32_t port) {
+  int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+  int bytes = SOCKET_BUFFER_BYTES;
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+  setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+  struct sockaddr_in addr = SCK::make_address("127.0.0.1", port);
+  bind(sockfd, (struct sockaddr *)&addr, sizeof(addr));
+  return sockfd;
+}
+
+// Counts datagrams until the sender has been quiet for a moment.
+Result receive(int sockfd, Mode mode) {
+  struct timeval timeout = {0, 200000};
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  SCK::ReceiveBatch batch(MESG::FILE_HEADER_SIZE + BUFFER_MESSAGE_SIZE);
+  if (mode == Mode::OFFLOAD && !batch.enable_coalescing(sockfd))
+    std::printf("UDP GRO is not available.\n");
+  std::vector<uint8_t> buffer(MESG::FILE_HEADER_SIZE + BUFFER_MESSAGE_SIZE);
+  Result result;
+  double cpu_start = thread_cpu_seconds();
+  auto start = std::chrono::steady_clock::now();
+  auto last = start;
+  while (true) {
+    uint64_t received = 0;
+    if (mode == Mode::SINGLE) {
+      received = recv(sockfd, buffer.data(), buffer.size(), 0) > 0 ? 1 : 0;
+    } else if (batch.receive(sockfd) > 0) {
+      batch.for_each([&](std::span<const uint8_t>, const sockaddr_in &) {
+        received++;
+      });
+    }
+    if (received == 0)
+      break;
+    if (result.datagrams == 0)
+      start = std::chrono::steady_clock::now();
+    result.datagrams += received;
+    last = std::chrono::steady_clock::now();
+  }
+  result.seconds = std::chrono::duration<double>(last - start).count();
+  result.cpu_seconds = thread_cpu_seconds() - cpu_start;
+  return result;
+}
+
+Result send_all(int sockfd, Mode mode, uint32_t datagrams) {
+  struct sockaddr_in addr = SCK::make_address("127.0.0.1", PORT);
+  std::vector<uint8_t> payload(BUFFER_MESSAGE_SIZE, 0x5a);
+  std::vector<std::array<uint8_t, MESG::FILE_HEADER_SIZE>> headers(
+      SCK::BATCH_SIZE);
+  SCK::SendBatch batch;
+  batch.set_segmentation(mode == Mode::OFFLOAD);
+  Result result;
+  double cpu_start = thread_cpu_seconds();
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < datagrams; ++i) {
+    MESG::FileMessage message;
+    message.packet_number = i;
+    message.data = payload;
+    auto &header = headers[batch.size()];
+    uint32_t header_size = MESG::encode_file_header(header, message);
+    if (mode == Mode::SINGLE) {
+      SCK::send_gather(sockfd, addr, std::span(header.data(), header_size),
+                       payload);
+      continue;
+    }
+    batch.add(std::span(header.data(), header_size), payload);
+    if (batch.is_full())
+      batch.flush(sockfd, addr);
+  }
+  batch.flush(sockfd, addr);
+  if (mode == Mode::OFFLOAD && !batch.uses_segmentation())
+    std::printf("UDP GSO is not available.\n");
+  result.datagrams = datagrams;
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  result.cpu_seconds = thread_cpu_seconds() - cpu_start;
+  return result;
+}
+
+void print(const char *name, const Result &result) {
+  double rate = result.seconds > 0 ? result.datagrams / result.seconds : 0;
+  double cpu = result.datagrams > 0
+                   ? result.cpu_seconds * 1e9 / result.datagrams
+                   : 0;
+  std::printf("  %-8s %10.0f datagrams/s %8.0f ns CPU/datagram "
+              "%9.0f datagrams/s per core\n",
+              name, rate, cpu, cpu > 0 ? 1e9 / cpu : 0);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  uint32_t datagrams = argc > 1 ? std::stoul(argv[1]) : DEFAULT_DATAGRAMS;
+  SCK::init();
+  const std::pair<Mode, const char *> modes[] = {
+      {Mode::SINGLE, "sendto / recv"},
+      {Mode::BATCH, "sendmmsg / recvmmsg"},
+      {Mode::OFFLOAD, "GSO / GRO"},
+  };
+  for (const auto &[mode, name] : modes) {
+    int receiver = open_socket(PORT);
+    int sender = open_socket(0);
+    Result received;
+    std::thread worker([&] { received = receive(receiver, mode); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    Result sent = send_all(sender, mode, datagrams);
+    worker.join();
+    std::printf("%s, %u datagrams of %u bytes, %.1f%% lost:\n", name,
+                datagrams, MESG::FILE_HEADER_SIZE + BUFFER_MESSAGE_SIZE,
+                100.0 * (sent.datagrams - received.datagrams) / datagrams);
+    print("send", sent);
+    print("receive", received);
+    close(sender);
+    close(receiver);
+  }
+}
\ No newline at end of file
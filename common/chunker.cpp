@@ -0,0 +1,86 @@
+#include "chunker.hpp"
+#include "delta.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+constexpr uint32_t READ_SIZE = 4 << 20; // Bytes read at a time.
+// Harder to match before the average size, easier after it, which keeps
+// most chunks close to it. Top bits, they depend on all 64 bytes.
+constexpr uint64_t MASK_SMALL = ((uint64_t(1) << 18) - 1) << 46;
+constexpr uint64_t MASK_LARGE = ((uint64_t(1) << 14) - 1) << 50;
+
+// Random values for every byte, from splitmix64.
+constexpr std::array<uint64_t, 256> make_gear() {
+  std::array<uint64_t, 256> gear = {};
+  uint64_t state = 0;
+  for (uint64_t &value : gear) {
+    state += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    value = z ^ (z >> 31);
+  }
+  return gear;
+}
+constexpr std::array<uint64_t, 256> gear = make_gear();
+} // namespace
+
+namespace CDC {
+
+uint32_t find_cut(const uint8_t *data, uint32_t size) {
+  if (size <= MIN_CHUNK_SIZE)
+    return size;
+  size = std::min(size, MAX_CHUNK_SIZE);
+  uint32_t normal = std::min(size, AVERAGE_CHUNK_SIZE);
+  uint64_t hash = 0;
+  uint32_t i = MIN_CHUNK_SIZE;
+  for (; i < normal; ++i) {
+    hash = (hash << 1) + gear[data[i]];
+    if ((hash & MASK_SMALL) == 0)
+      return i + 1;
+  }
+  for (; i < size; ++i) {
+    hash = (hash << 1) + gear[data[i]];
+    if ((hash & MASK_LARGE) == 0)
+      return i + 1;
+  }
+  return size;
+}
+
+// A chunk is only cut with a whole maximal chunk, or the end of the
+// stream, in the buffer.
+bool split(const FIO::FileSet &stream, std::vector<MESG::ChunkHash> &chunks,
+           CRC::ChunkSums *sums) {
+  chunks.clear();
+  uint64_t size = stream.size();
+  std::vector<uint8_t> buffer;
+  uint64_t buffer_offset = 0; // Stream offset of buffer[0].
+  size_t start = 0;           // Of the next chunk, in the buffer.
+  while (buffer_offset + start < size) {
+    uint64_t buffer_end = buffer_offset + buffer.size();
+    if (buffer.size() - start < MAX_CHUNK_SIZE && buffer_end < size) {
+      buffer.erase(buffer.begin(), buffer.begin() + start);
+      buffer_offset += start;
+      start = 0;
+      size_t loaded = buffer.size();
+      uint32_t wanted = static_cast<uint32_t>(
+          std::min<uint64_t>(READ_SIZE, size - buffer_end));
+      buffer.resize(loaded + wanted);
+      if (stream.read_at(buffer_end, buffer.data() + loaded, wanted) != wanted)
+        return false;
+      if (sums != nullptr)
+        sums->add(buffer_end, buffer.data() + loaded, wanted);
+      continue;
+    }
+    const uint8_t *data = buffer.data() + start;
+    uint32_t length = find_cut(
+        data, static_cast<uint32_t>(std::min<uint64_t>(
+                  buffer.size() - start, MAX_CHUNK_SIZE)));
+    chunks.push_back({length, DLT::get_strong_checksum(data, length)});
+    start += length;
+  }
+  return true;
+}
+} // namespace CDC
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "crc.hpp"
+#include "file_set.hpp"
+#include "message.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Content-defined chunking of dedup uploads, see MESG::ChunkMessage, in
+// the manner of FastCDC: a cut falls where a gear hash of the last 64
+// bytes has enough zero bits, so an insert only changes the chunks
+// around it.
+namespace CDC {
+constexpr uint32_t MIN_CHUNK_SIZE = 16 << 10;
+constexpr uint32_t AVERAGE_CHUNK_SIZE = 64 << 10;
+constexpr uint32_t MAX_CHUNK_SIZE = 256 << 10;
+
+// Length of the chunk data starts with, size if it ends there.
+uint32_t find_cut(const uint8_t *data, uint32_t size);
+// Every chunk of stream with its strong checksum. False on a read error.
+// Feeds sums, if given, the whole stream.
+bool split(const FIO::FileSet &stream, std::vector<MESG::ChunkHash> &chunks,
+           CRC::ChunkSums *sums = nullptr);
+} // namespace CDC
\ No newline at end of file
@@ -0,0 +1,71 @@
+#include "control_stream.hpp"
+#include "socket.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace {
+constexpr uint32_t RING_SIZE = std::bit_ceil(
+    2 * (MESG::FRAME_HEADER_SIZE + MESG::MAX_CONTROL_MESSAGE_SIZE));
+} // namespace
+
+namespace MESG {
+FrameReader::FrameReader() : ring(RING_SIZE) {}
+
+int FrameReader::receive(int sockfd) {
+  size_t start = tail & (ring.size() - 1);
+  size_t free = ring.size() - (tail - head);
+  size_t length = std::min(free, ring.size() - start);
+  if (length == 0) // Never with the frames handed out, they fit twice.
+    return -1;
+  int result = recv(sockfd, reinterpret_cast<char *>(ring.data() + start),
+                    length, 0);
+  if (result > 0)
+    tail += result;
+  return result;
+}
+
+bool FrameReader::next(std::span<const uint8_t> &message) {
+  const size_t mask = ring.size() - 1;
+  if (broken || tail - head < FRAME_HEADER_SIZE)
+    return false;
+  uint8_t header[FRAME_HEADER_SIZE];
+  for (uint32_t i = 0; i < FRAME_HEADER_SIZE; ++i)
+    header[i] = ring[(head + i) & mask];
+  uint32_t offset = 0;
+  uint32_t size = get_uint32(header, offset);
+  if (size == 0 || size > MAX_CONTROL_MESSAGE_SIZE) {
+    broken = true;
+    return false;
+  }
+  if (tail - head < FRAME_HEADER_SIZE + size)
+    return false;
+  size_t start = (head + FRAME_HEADER_SIZE) & mask;
+  if (start + size <= ring.size()) {
+    message = std::span(ring.data() + start, size);
+  } else {
+    size_t first = ring.size() - start;
+    scratch.resize(size);
+    std::memcpy(scratch.data(), ring.data() + start, first);
+    std::memcpy(scratch.data() + first, ring.data(), size - first);
+    message = scratch;
+  }
+  head += FRAME_HEADER_SIZE + size;
+  return true;
+}
+
+bool FrameWriter::flush(int sockfd) {
+  while (sent < pending.size()) {
+    int result = send(sockfd,
+                      reinterpret_cast<const char *>(pending.data() + sent),
+                      pending.size() - sent, 0);
+    if (result < 0)
+      return SCK::would_block(SCK::last_error());
+    sent += result;
+  }
+  pending.clear();
+  sent = 0;
+  return true;
+}
+} // namespace MESG
\ No newline at end of file
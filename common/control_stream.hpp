@@ -0,0 +1,56 @@
+#pragma once
+
+#include "message.hpp"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// The TCP control channel as a stream of frames: every message goes with
+// its length in front, so the receiver splits the stream without knowing
+// the message types.
+namespace MESG {
+constexpr uint32_t FRAME_HEADER_SIZE = 4;
+
+// Reads the stream into a ring buffer that holds two frames of the
+// largest size and hands out every complete frame where it lies; only a
+// frame that wraps around the end is copied, into a scratch buffer.
+class FrameReader {
+  std::vector<uint8_t> ring; // Power of two.
+  uint64_t head = 0;         // Bytes handed out so far.
+  uint64_t tail = 0;         // Bytes received so far.
+  std::vector<uint8_t> scratch;
+  bool broken = false; // A frame was larger than any message.
+
+public:
+  FrameReader();
+  // One recv into the free space: bytes read, 0 once the peer closed, -1
+  // on error, see SCK::last_error().
+  int receive(int sockfd);
+  // The next complete message, valid until the next call. False if there
+  // is none yet, or the stream is broken.
+  bool next(std::span<const uint8_t> &message);
+  bool is_broken() const noexcept { return broken; }
+};
+
+// Frames queued by add() leave together on flush(), one send for all
+// messages an event produced. What the socket does not take stays queued.
+class FrameWriter {
+  std::vector<uint8_t> pending;
+  size_t sent = 0; // Of pending.
+
+public:
+  template <typename Message> void add(const Message &message) {
+    size_t offset = pending.size();
+    uint32_t size = message.encoded_size();
+    pending.resize(offset + FRAME_HEADER_SIZE + size);
+    std::span<uint8_t> frame = std::span(pending).subspan(offset);
+    uint32_t header = 0;
+    put_uint32(frame, header, size);
+    message.encode(frame.subspan(FRAME_HEADER_SIZE));
+  }
+  bool is_empty() const noexcept { return sent == pending.size(); }
+  // Sends until done or the socket would block, false on error.
+  bool flush(int sockfd);
+};
+} // namespace MESG
\ No newline at end of file
@@ -1,67 +1,215 @@
 #include "crc.hpp"
-#include "log.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
-#include <fstream>
-#include <iostream>
-#include <string>
-#include <vector>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC_HAS_SSE42
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE42
+#define TARGET_PCLMUL
+#else
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_PCLMUL __attribute__((target("sse4.2,pclmul")))
+#endif
+#endif
 
 namespace {
-constexpr uint32_t BUFFER_SIZE = 4096;
-uint32_t crc8(unsigned crc, unsigned char const *data, size_t len);
-
-uint8_t const crc8_table[] = {
-    0xea, 0xd4, 0x96, 0xa8, 0x12, 0x2c, 0x6e, 0x50, 0x7f, 0x41, 0x03, 0x3d,
-    0x87, 0xb9, 0xfb, 0xc5, 0xa5, 0x9b, 0xd9, 0xe7, 0x5d, 0x63, 0x21, 0x1f,
-    0x30, 0x0e, 0x4c, 0x72, 0xc8, 0xf6, 0xb4, 0x8a, 0x74, 0x4a, 0x08, 0x36,
-    0x8c, 0xb2, 0xf0, 0xce, 0xe1, 0xdf, 0x9d, 0xa3, 0x19, 0x27, 0x65, 0x5b,
-    0x3b, 0x05, 0x47, 0x79, 0xc3, 0xfd, 0xbf, 0x81, 0xae, 0x90, 0xd2, 0xec,
-    0x56, 0x68, 0x2a, 0x14, 0xb3, 0x8d, 0xcf, 0xf1, 0x4b, 0x75, 0x37, 0x09,
-    0x26, 0x18, 0x5a, 0x64, 0xde, 0xe0, 0xa2, 0x9c, 0xfc, 0xc2, 0x80, 0xbe,
-    0x04, 0x3a, 0x78, 0x46, 0x69, 0x57, 0x15, 0x2b, 0x91, 0xaf, 0xed, 0xd3,
-    0x2d, 0x13, 0x51, 0x6f, 0xd5, 0xeb, 0xa9, 0x97, 0xb8, 0x86, 0xc4, 0xfa,
-    0x40, 0x7e, 0x3c, 0x02, 0x62, 0x5c, 0x1e, 0x20, 0x9a, 0xa4, 0xe6, 0xd8,
-    0xf7, 0xc9, 0x8b, 0xb5, 0x0f, 0x31, 0x73, 0x4d, 0x58, 0x66, 0x24, 0x1a,
-    0xa0, 0x9e, 0xdc, 0xe2, 0xcd, 0xf3, 0xb1, 0x8f, 0x35, 0x0b, 0x49, 0x77,
-    0x17, 0x29, 0x6b, 0x55, 0xef, 0xd1, 0x93, 0xad, 0x82, 0xbc, 0xfe, 0xc0,
-    0x7a, 0x44, 0x06, 0x38, 0xc6, 0xf8, 0xba, 0x84, 0x3e, 0x00, 0x42, 0x7c,
-    0x53, 0x6d, 0x2f, 0x11, 0xab, 0x95, 0xd7, 0xe9, 0x89, 0xb7, 0xf5, 0xcb,
-    0x71, 0x4f, 0x0d, 0x33, 0x1c, 0x22, 0x60, 0x5e, 0xe4, 0xda, 0x98, 0xa6,
-    0x01, 0x3f, 0x7d, 0x43, 0xf9, 0xc7, 0x85, 0xbb, 0x94, 0xaa, 0xe8, 0xd6,
-    0x6c, 0x52, 0x10, 0x2e, 0x4e, 0x70, 0x32, 0x0c, 0xb6, 0x88, 0xca, 0xf4,
-    0xdb, 0xe5, 0xa7, 0x99, 0x23, 0x1d, 0x5f, 0x61, 0x9f, 0xa1, 0xe3, 0xdd,
-    0x67, 0x59, 0x1b, 0x25, 0x0a, 0x34, 0x76, 0x48, 0xf2, 0xcc, 0x8e, 0xb0,
-    0xd0, 0xee, 0xac, 0x92, 0x28, 0x16, 0x54, 0x6a, 0x45, 0x7b, 0x39, 0x07,
-    0xbd, 0x83, 0xc1, 0xff};
-
-uint32_t crc8(uint32_t crc, unsigned char const *data, size_t len) {
-  if (data == NULL)
-    return 0;
-  crc &= 0xff;
-  unsigned char const *end = data + len;
-  while (data < end)
-    crc = crc8_table[crc ^ *data++];
+constexpr uint32_t POLYNOMIAL = 0x82F63B78; // Reflected.
+
+using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+// tables[k][b]: byte b followed by k zero bytes.
+constexpr Tables make_tables() {
+  Tables tables = {};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit)
+      crc = (crc >> 1) ^ (crc & 1 ? POLYNOMIAL : 0);
+    tables[0][i] = crc;
+  }
+  for (size_t k = 1; k < tables.size(); ++k)
+    for (uint32_t i = 0; i < 256; ++i)
+      tables[k][i] = (tables[k - 1][i] >> 8) ^
+                     tables[0][tables[k - 1][i] & 0xFF];
+  return tables;
+}
+constexpr Tables crc_tables = make_tables();
+
+// Polynomials modulo POLYNOMIAL, reflected: bit 31 is x^0.
+constexpr uint32_t multiply(uint32_t a, uint32_t b) {
+  uint32_t product = 0;
+  for (uint32_t bit = 1u << 31; bit != 0; bit >>= 1) {
+    if (a & bit)
+      product ^= b;
+    b = (b >> 1) ^ (b & 1 ? POLYNOMIAL : 0);
+  }
+  return product;
+}
+
+// x^(2^k) for every k.
+constexpr std::array<uint32_t, 64> make_powers() {
+  std::array<uint32_t, 64> powers = {};
+  powers[0] = 1u << 30;
+  for (size_t k = 1; k < powers.size(); ++k)
+    powers[k] = multiply(powers[k - 1], powers[k - 1]);
+  return powers;
+}
+constexpr std::array<uint32_t, 64> x_powers = make_powers();
+
+constexpr uint32_t x_power(uint64_t n) {
+  uint32_t result = 1u << 31;
+  for (size_t k = 0; n != 0; n >>= 1, ++k)
+    if (n & 1)
+      result = multiply(result, x_powers[k]);
+  return result;
+}
+
+// Inverted state in and out, as all kernels.
+uint32_t extend_slicing(uint32_t crc, const uint8_t *data, size_t size) {
+  for (; size >= 8; data += 8, size -= 8) {
+    uint32_t low = crc ^ (uint32_t(data[0]) | uint32_t(data[1]) << 8 |
+                          uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24);
+    crc = crc_tables[7][low & 0xFF] ^ crc_tables[6][(low >> 8) & 0xFF] ^
+          crc_tables[5][(low >> 16) & 0xFF] ^ crc_tables[4][low >> 24] ^
+          crc_tables[3][data[4]] ^ crc_tables[2][data[5]] ^
+          crc_tables[1][data[6]] ^ crc_tables[0][data[7]];
+  }
+  for (; size > 0; ++data, --size)
+    crc = crc_tables[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+#ifdef CRC_HAS_SSE42
+uint64_t load(const uint8_t *data) {
+  uint64_t word;
+  std::memcpy(&word, data, sizeof(word));
+  return word;
+}
+
+TARGET_SSE42 uint32_t extend_sse42(uint32_t crc, const uint8_t *data,
+                                   size_t size) {
+  uint64_t crc64 = crc;
+  for (; size >= 8; data += 8, size -= 8)
+    crc64 = _mm_crc32_u64(crc64, load(data));
+  crc = static_cast<uint32_t>(crc64);
+  for (; size > 0; ++data, --size)
+    crc = _mm_crc32_u8(crc, *data);
   return crc;
 }
+
+// crc * x^(8 * bytes): the carry-less product with x^(8 * bytes - 33),
+// reduced by the crc32 instruction, which multiplies by x^32 on the way.
+constexpr uint32_t get_shift(size_t bytes) { return x_power(8 * bytes - 33); }
+struct Lane {
+  size_t size;
+  uint32_t shift_one; // Over one lane.
+  uint32_t shift_two;
+};
+constexpr Lane LONG_LANE = {2048, get_shift(2048), get_shift(2 * 2048)};
+constexpr Lane SHORT_LANE = {256, get_shift(256), get_shift(2 * 256)};
+
+TARGET_PCLMUL uint64_t shift(uint64_t crc, uint32_t constant) {
+  __m128i product =
+      _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(crc)),
+                           _mm_cvtsi32_si128(static_cast<int>(constant)), 0);
+  return _mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product)));
+}
+
+// The crc32 instruction takes three cycles but can start every cycle, so
+// three independent streams keep it busy; they are then joined into one.
+// Long blocks first, then short ones for the rest.
+TARGET_PCLMUL uint64_t extend_lanes(uint64_t crc, const uint8_t *&data,
+                                    size_t &size, const Lane &lane) {
+  size_t block = 3 * lane.size;
+  for (; size >= block; data += block, size -= block) {
+    uint64_t crc_b = 0;
+    uint64_t crc_c = 0;
+    for (size_t i = 0; i < lane.size; i += 8) {
+      crc = _mm_crc32_u64(crc, load(data + i));
+      crc_b = _mm_crc32_u64(crc_b, load(data + lane.size + i));
+      crc_c = _mm_crc32_u64(crc_c, load(data + 2 * lane.size + i));
+    }
+    crc = shift(crc, lane.shift_two) ^ shift(crc_b, lane.shift_one) ^ crc_c;
+  }
+  return crc;
+}
+
+TARGET_PCLMUL uint32_t extend_pclmul(uint32_t crc, const uint8_t *data,
+                                     size_t size) {
+  uint64_t crc64 = extend_lanes(crc, data, size, LONG_LANE);
+  crc64 = extend_lanes(crc64, data, size, SHORT_LANE);
+  return extend_sse42(static_cast<uint32_t>(crc64), data, size);
+}
+
+void get_cpu_features(bool &sse42, bool &pclmul) {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  sse42 = (info[2] >> 20) & 1;
+  pclmul = (info[2] >> 1) & 1;
+#else
+  sse42 = __builtin_cpu_supports("sse4.2");
+  pclmul = __builtin_cpu_supports("pclmul");
+#endif
+}
+#endif
+
+using Kernel = uint32_t (*)(uint32_t crc, const uint8_t *data, size_t size);
+
+Kernel select_kernel() {
+#ifdef CRC_HAS_SSE42
+  bool sse42 = false;
+  bool pclmul = false;
+  get_cpu_features(sse42, pclmul);
+  if (sse42 && pclmul)
+    return extend_pclmul;
+  if (sse42)
+    return extend_sse42;
+#endif
+  return extend_slicing;
+}
 } // namespace
 
 namespace CRC {
-uint8_t get_crc(const std::string &path_to_file) {
-  std::ifstream file(path_to_file, std::ios::binary);
-  if (!file.is_open()) {
-    LOG::safe_print("Failed to open file to get CRC: " + path_to_file);
-    return 0;
+uint32_t extend(uint32_t crc, const uint8_t *data, size_t size) {
+  static const Kernel kernel = select_kernel();
+  return ~kernel(~crc, data, size);
+}
+
+// The inversions at both ends cancel out, as in zlib's crc32_combine.
+uint32_t combine(uint32_t first, uint32_t second, uint64_t second_size) {
+  return multiply(first, x_power(8 * second_size)) ^ second;
+}
+
+void ChunkSums::add(uint64_t at, const uint8_t *data, size_t size) {
+  if (broken || at != offset) {
+    broken = true;
+    return;
   }
-  uint32_t crc = 0;
-  std::vector<uint8_t> buffer(BUFFER_SIZE);
-  while (file) {
-    file.read(reinterpret_cast<char *>(buffer.data()), buffer.size());
-    std::streamsize bytes_read = file.gcount();
-    if (bytes_read <= 0)
-      break;
-    crc = crc8(crc, buffer.data(), static_cast<size_t>(bytes_read));
+  while (size > 0) {
+    size_t piece = std::min<uint64_t>(size, chunk_size - offset % chunk_size);
+    crc = extend(crc, data, piece);
+    data += piece;
+    size -= piece;
+    offset += piece;
+    if (offset % chunk_size == 0) {
+      sums.push_back(crc);
+      crc = 0;
+    }
   }
-  return static_cast<uint8_t>(crc & 0xFF);
+}
+
+std::vector<uint32_t> ChunkSums::finish(uint64_t size) {
+  if (broken || offset != size)
+    return {};
+  if (offset % chunk_size != 0)
+    sums.push_back(crc);
+  return std::move(sums);
 }
 } // namespace CRC
\ No newline at end of file
@@ -1,8 +1,38 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
-#include <string>
+#include <vector>
 
+// CRC-32C (Castagnoli), as in iSCSI and ext4. Computed as the data goes
+// by: every packet on its own, the results combined, so no file is read
+// twice just for its checksum.
 namespace CRC {
-uint8_t get_crc(const std::string &path_to_file);
-}
\ No newline at end of file
+// Continues crc, the result over the data before, with more data. Uses
+// three crc32 streams joined by carry-less multiplies (SSE4.2 and
+// PCLMUL), one stream (SSE4.2) or slicing-by-8 tables, whichever the CPU
+// allows.
+uint32_t extend(uint32_t crc, const uint8_t *data, size_t size);
+inline uint32_t get_crc32c(const uint8_t *data, size_t size) {
+  return extend(0, data, size);
+}
+// CRC of two pieces of data one after the other, from the CRC of each.
+uint32_t combine(uint32_t first, uint32_t second, uint64_t second_size);
+
+// CRC of every chunk_size bytes of a stream, fed as another pass reads it
+// front to back in pieces of any size.
+class ChunkSums {
+  uint32_t chunk_size;
+  uint64_t offset = 0; // Fed up to here.
+  uint32_t crc = 0;    // Of the chunk being fed.
+  bool broken = false; // A piece did not follow on.
+  std::vector<uint32_t> sums;
+
+public:
+  explicit ChunkSums(uint32_t chunk_size) : chunk_size(chunk_size) {}
+  void add(uint64_t at, const uint8_t *data, size_t size);
+  // Of every chunk, the last one may be short; empty unless all size
+  // bytes came by in order.
+  std::vector<uint32_t> finish(uint64_t size);
+};
+} // namespace CRC
\ No newline at end of file
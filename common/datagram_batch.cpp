@@ -0,0 +1,203 @@
+#include "datagram_batch.hpp"
+
+#include <cstring>
+
+#ifdef __linux__
+#include <cerrno>
+#include <netinet/udp.h>
+#include <sys/uio.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+namespace {
+#ifdef __linux__
+constexpr uint32_t MAX_UDP_PAYLOAD = 65507;
+constexpr uint32_t MAX_SEGMENTS = 64; // UDP_MAX_SEGMENTS in the kernel.
+constexpr uint32_t COALESCED_BUFFER_SIZE = 65535;
+#endif
+} // namespace
+
+namespace SCK {
+void SendBatch::add(std::span<const uint8_t> header,
+                    std::span<const uint8_t> payload) {
+  parts[count * 2] = header;
+  parts[count * 2 + 1] = payload;
+  count++;
+}
+
+#ifdef __linux__
+int SendBatch::flush(int sockfd, const struct sockaddr_in &addr) {
+  int total = 0;
+  while (sent < count) {
+    struct mmsghdr messages[BATCH_SIZE];
+    struct iovec buffers[BATCH_SIZE * 2];
+    alignas(struct cmsghdr) char
+        controls[BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t))];
+    uint32_t first[BATCH_SIZE + 1]; // First datagram of each message.
+    uint32_t message_count = 0;
+    uint32_t datagram = sent;
+    std::memset(messages, 0, sizeof(messages));
+    while (datagram < count) {
+      struct msghdr &message = messages[message_count].msg_hdr;
+      message.msg_name = const_cast<struct sockaddr_in *>(&addr);
+      message.msg_namelen = sizeof(addr);
+      message.msg_iov = &buffers[datagram * 2];
+      first[message_count] = datagram;
+      // With GSO, same-size datagrams share one message; only the last
+      // one of a group may be shorter.
+      uint32_t segment_size =
+          parts[datagram * 2].size() + parts[datagram * 2 + 1].size();
+      uint32_t group_bytes = 0;
+      uint32_t segments = 0;
+      do {
+        uint32_t size =
+            parts[datagram * 2].size() + parts[datagram * 2 + 1].size();
+        if (segments > 0 &&
+            (!segmentation || size > segment_size ||
+             group_bytes + size > MAX_UDP_PAYLOAD || segments == MAX_SEGMENTS))
+          break;
+        for (uint32_t part = datagram * 2; part < datagram * 2 + 2; ++part) {
+          buffers[part].iov_base = const_cast<uint8_t *>(parts[part].data());
+          buffers[part].iov_len = parts[part].size();
+        }
+        group_bytes += size;
+        segments++;
+        datagram++;
+        if (size < segment_size)
+          break;
+      } while (datagram < count);
+      message.msg_iovlen = segments * 2;
+      if (segments > 1) {
+        message.msg_control = controls[message_count];
+        message.msg_controllen = sizeof(controls[message_count]);
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_UDP;
+        header->cmsg_type = UDP_SEGMENT;
+        header->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t gso_size = static_cast<uint16_t>(segment_size);
+        std::memcpy(CMSG_DATA(header), &gso_size, sizeof(gso_size));
+      }
+      message_count++;
+    }
+    first[message_count] = datagram;
+    int result = sendmmsg(sockfd, messages, message_count, 0);
+    if (result < 0) {
+      int error = errno;
+      if (would_block(error))
+        return total;
+      if (segmentation && (error == EINVAL || error == EIO ||
+                           error == EMSGSIZE || error == ENOPROTOOPT)) {
+        segmentation = false; // Unsupported here, retry one by one.
+        continue;
+      }
+      sent = count = 0;
+      return -1;
+    }
+    total += first[result] - sent;
+    sent = first[result];
+  }
+  sent = count = 0;
+  return total;
+}
+
+ReceiveBatch::ReceiveBatch(uint32_t datagram_size)
+    : buffer_size(datagram_size),
+      memory(static_cast<size_t>(BATCH_SIZE) * datagram_size) {}
+
+bool ReceiveBatch::enable_coalescing(int sockfd) {
+  int enabled = 1;
+  if (setsockopt(sockfd, SOL_UDP, UDP_GRO, &enabled, sizeof(enabled)) < 0)
+    return false;
+  coalescing = true;
+  buffer_size = COALESCED_BUFFER_SIZE;
+  memory.resize(static_cast<size_t>(BATCH_SIZE) * buffer_size);
+  return true;
+}
+
+int ReceiveBatch::receive(int sockfd) {
+  struct mmsghdr messages[BATCH_SIZE];
+  struct iovec buffers[BATCH_SIZE];
+  alignas(struct cmsghdr) char controls[BATCH_SIZE][CMSG_SPACE(sizeof(int))];
+  std::memset(messages, 0, sizeof(messages));
+  for (uint32_t i = 0; i < BATCH_SIZE; ++i) {
+    buffers[i].iov_base = memory.data() + i * buffer_size;
+    buffers[i].iov_len = buffer_size;
+    messages[i].msg_hdr.msg_name = &addresses[i];
+    messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+    messages[i].msg_hdr.msg_iov = &buffers[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+    if (coalescing) {
+      messages[i].msg_hdr.msg_control = controls[i];
+      messages[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+    }
+  }
+  count = 0;
+  int result = recvmmsg(sockfd, messages, BATCH_SIZE, MSG_WAITFORONE, nullptr);
+  if (result < 0)
+    return would_block(errno) ? 0 : -1;
+  for (int i = 0; i < result; ++i) {
+    const struct msghdr &message = messages[i].msg_hdr;
+    if (message.msg_flags & MSG_TRUNC)
+      continue; // Too large to be ours.
+    lengths[count] = messages[i].msg_len;
+    segment_sizes[count] = 0;
+    for (struct cmsghdr *header =
+             CMSG_FIRSTHDR(const_cast<struct msghdr *>(&message));
+         header != nullptr;
+         header = CMSG_NXTHDR(const_cast<struct msghdr *>(&message), header))
+      if (header->cmsg_level == SOL_UDP && header->cmsg_type == UDP_GRO) {
+        int segment_size = 0;
+        std::memcpy(&segment_size, CMSG_DATA(header), sizeof(segment_size));
+        segment_sizes[count] = segment_size;
+      }
+    if (count != static_cast<uint32_t>(i)) {
+      std::memmove(memory.data() + count * buffer_size,
+                   memory.data() + i * buffer_size, lengths[count]);
+      addresses[count] = addresses[i];
+    }
+    count++;
+  }
+  return result;
+}
+#else
+int SendBatch::flush(int sockfd, const struct sockaddr_in &addr) {
+  int total = 0;
+  for (; sent < count; ++sent, ++total) {
+    if (send_gather(sockfd, addr, parts[sent * 2], parts[sent * 2 + 1]) < 0) {
+      if (would_block(last_error()))
+        return total;
+      sent = count = 0;
+      return -1;
+    }
+  }
+  sent = count = 0;
+  return total;
+}
+
+ReceiveBatch::ReceiveBatch(uint32_t datagram_size)
+    : buffer_size(datagram_size),
+      memory(datagram_size) {}
+
+bool ReceiveBatch::enable_coalescing(int) { return false; }
+
+int ReceiveBatch::receive(int sockfd) {
+  addr_length_t addr_length = sizeof(addresses[0]);
+  count = 0;
+  int result = recvfrom(sockfd, reinterpret_cast<char *>(memory.data()),
+                        buffer_size, 0, (struct sockaddr *)&addresses[0],
+                        &addr_length);
+  if (result < 0)
+    return would_block(last_error()) ? 0 : -1;
+  lengths[0] = result;
+  segment_sizes[0] = 0;
+  count = 1;
+  return 1;
+}
+#endif
+} // namespace SCK
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "socket.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace SCK {
+constexpr uint32_t BATCH_SIZE = 32; // Datagrams per sendmmsg/recvmmsg.
+
+// Datagrams queued as header + payload views and sent with as few system
+// calls as the platform allows: sendmmsg on Linux, optionally grouped
+// into UDP GSO buffers the kernel splits again; one send each elsewhere.
+// The views must stay valid until their datagram was flushed.
+class SendBatch {
+  std::array<std::span<const uint8_t>, BATCH_SIZE * 2> parts;
+  uint32_t count = 0; // Datagrams queued since the batch was empty.
+  uint32_t sent = 0;
+  bool segmentation = false;
+
+public:
+  bool is_full() const noexcept { return count == BATCH_SIZE; }
+  bool is_empty() const noexcept { return sent == count; }
+  uint32_t size() const noexcept { return count; }
+  // GSO needs a path MTU above the datagram size, it turns itself off
+  // after the first send the kernel rejects.
+  void set_segmentation(bool enabled) noexcept { segmentation = enabled; }
+  bool uses_segmentation() const noexcept { return segmentation; }
+  void add(std::span<const uint8_t> header, std::span<const uint8_t> payload);
+  // Returns datagrams sent, -1 on error (the batch is dropped). If the
+  // socket would block the rest stays queued, see is_empty().
+  int flush(int sockfd, const struct sockaddr_in &addr);
+};
+
+// Receives up to BATCH_SIZE datagrams per recvmmsg on Linux, one per
+// recvfrom elsewhere. With coalescing (UDP GRO) one buffer may hold a run
+// of same-size datagrams, for_each() splits them again.
+class ReceiveBatch {
+  uint32_t buffer_size;
+  bool coalescing = false;
+  std::vector<uint8_t> memory;
+  std::array<uint32_t, BATCH_SIZE> lengths = {};
+  std::array<uint32_t, BATCH_SIZE> segment_sizes = {}; // 0 if single.
+  std::array<struct sockaddr_in, BATCH_SIZE> addresses = {};
+  uint32_t count = 0;
+
+public:
+  explicit ReceiveBatch(uint32_t datagram_size);
+  bool enable_coalescing(int sockfd); // False if unsupported.
+  // Messages received, 0 if the socket would block, -1 on error.
+  int receive(int sockfd);
+  template <typename Handler> void for_each(Handler &&handler) const {
+    for (uint32_t i = 0; i < count; ++i) {
+      std::span<const uint8_t> buffer(memory.data() + i * buffer_size,
+                                      lengths[i]);
+      uint32_t step = segment_sizes[i] > 0 ? segment_sizes[i] : lengths[i];
+      while (!buffer.empty()) {
+        uint32_t length = std::min<uint32_t>(step, buffer.size());
+        handler(buffer.first(length), addresses[i]);
+        buffer = buffer.subspan(length);
+      }
+    }
+  }
+};
+} // namespace SCK
\ No newline at end of file
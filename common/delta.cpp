@@ -0,0 +1,184 @@
+#include "delta.hpp"
+#include "crc.hpp"
+#include "sha256.hpp"
+#include "typedef.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+namespace {
+constexpr uint32_t MAX_BLOCK_SIZE = 128 * BUFFER_MESSAGE_SIZE;
+constexpr uint32_t READ_SIZE = 4 << 20; // Bytes read at a time.
+constexpr uint32_t TAG_BITS = 16;       // First-level filter of weak sums.
+
+uint32_t get_tag(uint32_t weak) {
+  return (weak ^ (weak >> TAG_BITS)) & ((1u << TAG_BITS) - 1);
+}
+
+// Sliding view of a stream: holds [from, end) after load(from, end).
+class StreamWindow {
+  const FIO::FileSet &stream;
+  CRC::ChunkSums *sums; // Fed what is read, if any.
+  std::vector<uint8_t> buffer;
+  uint64_t start = 0; // Stream offset of buffer[0].
+
+public:
+  explicit StreamWindow(const FIO::FileSet &stream,
+                        CRC::ChunkSums *sums = nullptr)
+      : stream(stream), sums(sums) {}
+  bool load(uint64_t from, uint64_t end) {
+    if (end <= start + buffer.size())
+      return true;
+    if (from - start > buffer.size())
+      buffer.clear();
+    else
+      buffer.erase(buffer.begin(), buffer.begin() + (from - start));
+    start = from;
+    uint64_t loaded = start + buffer.size();
+    uint64_t wanted =
+        std::min<uint64_t>(std::max<uint64_t>(end, loaded + READ_SIZE),
+                           stream.size()) -
+        loaded;
+    buffer.resize(buffer.size() + wanted);
+    int64_t bytes = stream.read_at(loaded, buffer.data() + (loaded - start),
+                                   static_cast<uint32_t>(wanted));
+    if (bytes != static_cast<int64_t>(wanted))
+      return false;
+    if (sums != nullptr)
+      sums->add(loaded, buffer.data() + (loaded - start), wanted);
+    return end <= start + buffer.size();
+  }
+  const uint8_t *at(uint64_t offset) const {
+    return buffer.data() + (offset - start);
+  }
+};
+} // namespace
+
+namespace DLT {
+
+void RollingChecksum::reset(const uint8_t *data, uint32_t size) {
+  a = 0;
+  b = 0;
+  length = size;
+  for (uint32_t i = 0; i < size; ++i) {
+    a += data[i];
+    b += (size - i) * data[i];
+  }
+}
+
+void RollingChecksum::roll(uint8_t out, uint8_t in) {
+  a += in - uint32_t(out);
+  b += a - length * out;
+}
+
+StrongChecksum get_strong_checksum(const uint8_t *data, size_t size) {
+  SHA::Digest digest = SHA::get_digest(data, size);
+  StrongChecksum checksum;
+  std::memcpy(checksum.data(), digest.data(), checksum.size());
+  return checksum;
+}
+
+uint32_t get_block_size(uint64_t base_size, uint32_t chunk_size) {
+  uint64_t root = static_cast<uint64_t>(std::sqrt(double(base_size)));
+  uint64_t packets = (root + chunk_size - 1) / chunk_size;
+  packets = std::clamp<uint64_t>(packets, 1, MAX_BLOCK_SIZE / chunk_size);
+  return static_cast<uint32_t>(packets * chunk_size);
+}
+
+bool is_valid_block_size(uint32_t block_size) {
+  return block_size != 0 && block_size <= MAX_BLOCK_SIZE;
+}
+
+bool sign(const FIO::FileSet &base, uint32_t block_size,
+          std::vector<MESG::BlockSignature> &signatures,
+          const std::atomic<bool> &cancel) {
+  uint64_t block_count = base.size() / block_size;
+  signatures.clear();
+  signatures.reserve(block_count);
+  StreamWindow window(base);
+  for (uint64_t i = 0; i < block_count; ++i) {
+    uint64_t offset = i * block_size;
+    if (cancel || !window.load(offset, offset + block_size))
+      return false;
+    const uint8_t *block = window.at(offset);
+    RollingChecksum weak;
+    weak.reset(block, block_size);
+    signatures.push_back({weak.get(), get_strong_checksum(block, block_size)});
+  }
+  return true;
+}
+
+// Rolls a block-sized window over the stream. A weak hit is checked with
+// the strong checksum; a match jumps a whole block, a miss slides by one
+// byte. Among equal blocks the one following the last match wins, which
+// keeps runs of zeros and the like in one copy.
+bool match(const FIO::FileSet &stream, uint32_t block_size,
+           const std::vector<MESG::BlockSignature> &signatures,
+           std::vector<MESG::DeltaCopy> &copies, CRC::ChunkSums *sums) {
+  copies.clear();
+  uint64_t size = stream.size();
+  if (signatures.empty() || size < block_size)
+    return true;
+  std::vector<std::pair<uint32_t, uint32_t>> blocks; // Weak sum, index.
+  std::vector<bool> tags(1u << TAG_BITS);
+  blocks.reserve(signatures.size());
+  for (uint32_t i = 0; i < signatures.size(); ++i) {
+    blocks.emplace_back(signatures[i].weak, i);
+    tags[get_tag(signatures[i].weak)] = true;
+  }
+  std::sort(blocks.begin(), blocks.end());
+  StreamWindow window(stream, sums);
+  RollingChecksum weak;
+  bool fresh = true;
+  uint64_t expected = signatures.size(); // Block after the last match.
+  uint64_t offset = 0;
+  while (offset + block_size <= size) {
+    bool has_next = offset + block_size < size;
+    if (!window.load(offset, offset + block_size + has_next))
+      return false;
+    const uint8_t *data = window.at(offset);
+    if (fresh)
+      weak.reset(data, block_size);
+    fresh = false;
+    uint64_t found = signatures.size();
+    if (tags[get_tag(weak.get())]) {
+      auto candidates = std::equal_range(
+          blocks.begin(), blocks.end(), std::make_pair(weak.get(), 0u),
+          [](const auto &left, const auto &right) {
+            return left.first < right.first;
+          });
+      if (candidates.first != candidates.second) {
+        StrongChecksum strong = get_strong_checksum(data, block_size);
+        for (auto block = candidates.first; block != candidates.second;
+             ++block) {
+          if (signatures[block->second].strong != strong)
+            continue;
+          if (found == signatures.size() || block->second == expected)
+            found = block->second;
+        }
+      }
+    }
+    if (found != signatures.size()) {
+      uint64_t base_offset = found * block_size;
+      if (!copies.empty() &&
+          copies.back().offset + copies.back().length == offset &&
+          copies.back().base_offset + copies.back().length == base_offset)
+        copies.back().length += block_size;
+      else
+        copies.push_back({offset, base_offset, block_size});
+      expected = found + 1;
+      offset += block_size;
+      fresh = true;
+      continue;
+    }
+    if (!has_next)
+      break;
+    weak.roll(data[0], data[block_size]);
+    offset++;
+  }
+  // The sums need the tail after the last block too.
+  return sums == nullptr || offset >= size || window.load(offset, size);
+}
+} // namespace DLT
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "crc.hpp"
+#include "file_set.hpp"
+#include "message.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Block matching of delta uploads, see MESG::SignatureMessage: the server
+// signs its old version, the client looks for those blocks at any offset
+// of the new one.
+namespace DLT {
+using StrongChecksum = std::array<uint8_t, MESG::STRONG_CHECKSUM_SIZE>;
+
+// rsync's weak checksum of a block: the sum of its bytes and the sum of
+// those sums, 16 bits each. Slides along by one byte in constant time.
+class RollingChecksum {
+  uint32_t a = 0;
+  uint32_t b = 0;
+  uint32_t length = 0;
+
+public:
+  void reset(const uint8_t *data, uint32_t size);
+  void roll(uint8_t out, uint8_t in); // Drops out, appends in.
+  uint32_t get() const noexcept { return (a & 0xFFFF) | (b << 16); }
+};
+
+StrongChecksum get_strong_checksum(const uint8_t *data, size_t size);
+// About the square root of the size, in whole chunks: fewer signatures
+// for large files, and a matched block covers at least one packet.
+uint32_t get_block_size(uint64_t base_size, uint32_t chunk_size);
+bool is_valid_block_size(uint32_t block_size);
+
+// Signs every full block of base. False on a read error or once cancel
+// is set.
+bool sign(const FIO::FileSet &base, uint32_t block_size,
+          std::vector<MESG::BlockSignature> &signatures,
+          const std::atomic<bool> &cancel);
+// Copies of signed blocks found in stream, in stream order, neighbours
+// merged. False on a read error. Feeds sums, if given, what it reads.
+bool match(const FIO::FileSet &stream, uint32_t block_size,
+           const std::vector<MESG::BlockSignature> &signatures,
+           std::vector<MESG::DeltaCopy> &copies,
+           CRC::ChunkSums *sums = nullptr);
+} // namespace DLT
\ No newline at end of file
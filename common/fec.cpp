@@ -0,0 +1,251 @@
+#include "fec.hpp"
+
+#include <array>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FEC_HAS_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#else
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+constexpr uint32_t POLYNOMIAL = 0x11D; // x^8 + x^4 + x^3 + x^2 + 1.
+
+struct Field {
+  std::array<uint8_t, 512> exp; // Twice over, so logs add without modulo.
+  std::array<uint8_t, 256> log;
+};
+constexpr Field make_field() {
+  Field field = {};
+  uint32_t value = 1;
+  for (uint32_t i = 0; i < 255; ++i) {
+    field.exp[i] = field.exp[i + 255] = static_cast<uint8_t>(value);
+    field.log[value] = static_cast<uint8_t>(i);
+    value <<= 1;
+    if (value & 0x100)
+      value ^= POLYNOMIAL;
+  }
+  return field;
+}
+constexpr Field field = make_field();
+
+constexpr uint8_t multiply(uint8_t a, uint8_t b) {
+  if (a == 0 || b == 0)
+    return 0;
+  return field.exp[field.log[a] + field.log[b]];
+}
+constexpr uint8_t inverse(uint8_t a) { return field.exp[255 - field.log[a]]; }
+
+// Cauchy matrix 1 / (x_j + y_i) with x_j = MAX_GROUP_SIZE + j, y_i = i;
+// every square submatrix of it is invertible, which stays so when each
+// column is scaled to make the first row all ones.
+using Coefficients =
+    std::array<std::array<uint8_t, FEC::MAX_GROUP_SIZE>, FEC::MAX_PARITY>;
+constexpr Coefficients make_coefficients() {
+  Coefficients coefficients = {};
+  for (uint32_t j = 0; j < FEC::MAX_PARITY; ++j)
+    for (uint32_t i = 0; i < FEC::MAX_GROUP_SIZE; ++i) {
+      uint8_t x = static_cast<uint8_t>(FEC::MAX_GROUP_SIZE + j);
+      uint8_t x_first = static_cast<uint8_t>(FEC::MAX_GROUP_SIZE);
+      uint8_t y = static_cast<uint8_t>(i);
+      coefficients[j][i] = multiply(inverse(x ^ y), x_first ^ y);
+    }
+  return coefficients;
+}
+constexpr Coefficients coefficients = make_coefficients();
+
+// c * n and c * (n << 4) for every nibble n, first 16 bytes and last.
+using NibbleTables = std::array<std::array<uint8_t, 32>, 256>;
+constexpr NibbleTables make_nibble_tables() {
+  NibbleTables tables = {};
+  for (uint32_t c = 0; c < 256; ++c)
+    for (uint32_t n = 0; n < 16; ++n) {
+      tables[c][n] = multiply(static_cast<uint8_t>(c), static_cast<uint8_t>(n));
+      tables[c][16 + n] =
+          multiply(static_cast<uint8_t>(c), static_cast<uint8_t>(n << 4));
+    }
+  return tables;
+}
+constexpr NibbleTables nibble_tables = make_nibble_tables();
+
+void multiply_add_plain(uint8_t *target, const uint8_t *source,
+                        const uint8_t *table, size_t size) {
+  for (size_t i = 0; i < size; ++i)
+    target[i] ^= table[source[i] & 0x0F] ^ table[16 + (source[i] >> 4)];
+}
+
+#ifdef FEC_HAS_SIMD
+// Sixteen table lookups at once: pshufb picks bytes of a register by the
+// low nibbles of another.
+TARGET_SSSE3 void multiply_add_ssse3(uint8_t *target, const uint8_t *source,
+                                     const uint8_t *table, size_t size) {
+  const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table));
+  const __m128i high =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(table + 16));
+  const __m128i mask = _mm_set1_epi8(0x0F);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i input =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i));
+    __m128i product = _mm_xor_si128(
+        _mm_shuffle_epi8(low, _mm_and_si128(input, mask)),
+        _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(input, 4), mask)));
+    __m128i *output = reinterpret_cast<__m128i *>(target + i);
+    _mm_storeu_si128(output, _mm_xor_si128(_mm_loadu_si128(output), product));
+  }
+  multiply_add_plain(target + i, source + i, table, size - i);
+}
+
+TARGET_AVX2 void multiply_add_avx2(uint8_t *target, const uint8_t *source,
+                                   const uint8_t *table, size_t size) {
+  const __m256i low = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(table)));
+  const __m256i high = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(table + 16)));
+  const __m256i mask = _mm256_set1_epi8(0x0F);
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + i));
+    __m256i shifted = _mm256_srli_epi64(input, 4);
+    __m256i product = _mm256_xor_si256(
+        _mm256_shuffle_epi8(low, _mm256_and_si256(input, mask)),
+        _mm256_shuffle_epi8(high, _mm256_and_si256(shifted, mask)));
+    __m256i *output = reinterpret_cast<__m256i *>(target + i);
+    _mm256_storeu_si256(output,
+                        _mm256_xor_si256(_mm256_loadu_si256(output), product));
+  }
+  multiply_add_plain(target + i, source + i, table, size - i);
+}
+#endif
+
+using Kernel = void (*)(uint8_t *target, const uint8_t *source,
+                        const uint8_t *table, size_t size);
+
+Kernel select_kernel() {
+#ifdef FEC_HAS_SIMD
+#ifdef _MSC_VER
+  int info[4];
+  __cpuidex(info, 7, 0);
+  if ((info[1] >> 5) & 1)
+    return multiply_add_avx2;
+  __cpuid(info, 1);
+  if ((info[2] >> 9) & 1)
+    return multiply_add_ssse3;
+#else
+  if (__builtin_cpu_supports("avx2"))
+    return multiply_add_avx2;
+  if (__builtin_cpu_supports("ssse3"))
+    return multiply_add_ssse3;
+#endif
+#endif
+  return multiply_add_plain;
+}
+
+using Matrix =
+    std::array<std::array<uint8_t, FEC::MAX_PARITY>, FEC::MAX_PARITY>;
+
+// Gauss-Jordan elimination of the first size rows and columns.
+bool invert(Matrix &matrix, Matrix &result, size_t size) {
+  result = {};
+  for (size_t i = 0; i < size; ++i)
+    result[i][i] = 1;
+  for (size_t column = 0; column < size; ++column) {
+    size_t pivot = column;
+    while (pivot < size && matrix[pivot][column] == 0)
+      pivot++;
+    if (pivot == size)
+      return false;
+    std::swap(matrix[pivot], matrix[column]);
+    std::swap(result[pivot], result[column]);
+    uint8_t scale = inverse(matrix[column][column]);
+    for (size_t i = 0; i < size; ++i) {
+      matrix[column][i] = multiply(matrix[column][i], scale);
+      result[column][i] = multiply(result[column][i], scale);
+    }
+    for (size_t row = 0; row < size; ++row) {
+      uint8_t factor = matrix[row][column];
+      if (row == column || factor == 0)
+        continue;
+      for (size_t i = 0; i < size; ++i) {
+        matrix[row][i] ^= multiply(factor, matrix[column][i]);
+        result[row][i] ^= multiply(factor, result[column][i]);
+      }
+    }
+  }
+  return true;
+}
+} // namespace
+
+namespace FEC {
+void multiply_add(uint8_t *target, const uint8_t *source, uint8_t coefficient,
+                  size_t size) {
+  static const Kernel kernel = select_kernel();
+  if (coefficient != 0)
+    kernel(target, source, nibble_tables[coefficient].data(), size);
+}
+
+uint8_t get_coefficient(uint32_t parity_index, uint32_t data_index) {
+  return coefficients[parity_index][data_index];
+}
+
+void encode(std::span<uint8_t> parity, uint32_t parity_count,
+            uint32_t data_index, std::span<const uint8_t> data, size_t size) {
+  for (uint32_t j = 0; j < parity_count; ++j)
+    multiply_add(parity.data() + j * size, data.data(),
+                 coefficients[j][data_index], data.size());
+}
+
+// The parity chunks minus the data that arrived leave the missing data
+// times a square Cauchy submatrix, which is then inverted.
+bool decode(std::span<uint8_t *const> data, std::span<const uint32_t> missing,
+            std::span<const uint8_t *const> parity,
+            std::span<const uint32_t> parity_indices, size_t size) {
+  size_t count = missing.size();
+  if (count > MAX_PARITY || data.size() > MAX_GROUP_SIZE ||
+      parity.size() != count || parity_indices.size() != count)
+    return false;
+  std::array<bool, MAX_GROUP_SIZE> lost = {};
+  std::array<bool, MAX_PARITY> used = {};
+  for (size_t k = 0; k < count; ++k) {
+    if (missing[k] >= data.size() || lost[missing[k]] ||
+        parity_indices[k] >= MAX_PARITY || used[parity_indices[k]])
+      return false;
+    lost[missing[k]] = true;
+    used[parity_indices[k]] = true;
+  }
+  Matrix matrix = {};
+  for (size_t k = 0; k < count; ++k)
+    for (size_t m = 0; m < count; ++m)
+      matrix[k][m] = coefficients[parity_indices[k]][missing[m]];
+  Matrix inverted;
+  if (!invert(matrix, inverted, count))
+    return false;
+  std::vector<uint8_t> syndromes(count * size);
+  for (size_t k = 0; k < count; ++k) {
+    uint8_t *syndrome = syndromes.data() + k * size;
+    std::memcpy(syndrome, parity[k], size);
+    for (size_t i = 0; i < data.size(); ++i)
+      if (!lost[i])
+        multiply_add(syndrome, data[i], coefficients[parity_indices[k]][i],
+                     size);
+  }
+  for (size_t m = 0; m < count; ++m) {
+    std::memset(data[missing[m]], 0, size);
+    for (size_t k = 0; k < count; ++k)
+      multiply_add(data[missing[m]], syndromes.data() + k * size,
+                   inverted[m][k], size);
+  }
+  return true;
+}
+} // namespace FEC
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Forward error correction: a group of up to MAX_GROUP_SIZE data chunks
+// gets up to MAX_PARITY parity chunks, and any as many lost data chunks
+// as there are parity chunks can be rebuilt. Reed-Solomon over GF(2^8)
+// with a Cauchy matrix scaled so that the first parity chunk is the plain
+// XOR of the data. Chunks of a group all have the same size; shorter ones
+// count as zero padded.
+namespace FEC {
+constexpr uint32_t MAX_GROUP_SIZE = 128;
+constexpr uint32_t MAX_PARITY = 16;
+
+// target ^= coefficient * source over GF(2^8), byte by byte. Uses
+// nibble tables with AVX2 or SSSE3 shuffles where the CPU has them.
+void multiply_add(uint8_t *target, const uint8_t *source, uint8_t coefficient,
+                  size_t size);
+// Weight of data chunk data_index in parity chunk parity_index.
+uint8_t get_coefficient(uint32_t parity_index, uint32_t data_index);
+
+// Adds data chunk data_index into parity_count parity chunks laid out one
+// after the other, size bytes each; they start zeroed. Data shorter than
+// size counts as zero padded.
+void encode(std::span<uint8_t> parity, uint32_t parity_count,
+            uint32_t data_index, std::span<const uint8_t> data, size_t size);
+// Rebuilds data[missing[i]] for every i from the other data chunks and
+// parity[i], the chunk parity_indices[i]; as many parity chunks as are
+// missing. Every chunk is size bytes. False if the input is invalid.
+bool decode(std::span<uint8_t *const> data, std::span<const uint32_t> missing,
+            std::span<const uint8_t *const> parity,
+            std::span<const uint32_t> parity_indices, size_t size);
+} // namespace FEC
\ No newline at end of file
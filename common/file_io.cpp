@@ -0,0 +1,180 @@
+#include "file_io.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace FIO {
+#ifdef _WIN32
+bool File::open_read(const std::string &path) {
+  close();
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  handle = reinterpret_cast<intptr_t>(file);
+  return true;
+}
+
+bool File::open_write(const std::string &path) {
+  close();
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                            nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  handle = reinterpret_cast<intptr_t>(file);
+  return true;
+}
+
+bool File::open_update(const std::string &path) {
+  close();
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                            nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  handle = reinterpret_cast<intptr_t>(file);
+  return true;
+}
+
+void File::close() {
+  if (handle != -1)
+    CloseHandle(reinterpret_cast<HANDLE>(handle));
+  handle = -1;
+}
+
+uint64_t File::size() const {
+  LARGE_INTEGER result;
+  if (!GetFileSizeEx(reinterpret_cast<HANDLE>(handle), &result))
+    return 0;
+  return result.QuadPart;
+}
+
+void File::advise_sequential() const {} // Set by FILE_FLAG_SEQUENTIAL_SCAN.
+
+bool File::preallocate(uint64_t length) {
+  LARGE_INTEGER position;
+  position.QuadPart = length;
+  HANDLE file = reinterpret_cast<HANDLE>(handle);
+  return SetFilePointerEx(file, position, nullptr, FILE_BEGIN) &&
+         SetEndOfFile(file);
+}
+
+int64_t File::read_at(uint64_t offset, uint8_t *buffer,
+                      uint32_t length) const {
+  OVERLAPPED overlapped = {};
+  overlapped.Offset = static_cast<DWORD>(offset);
+  overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD bytes_read = 0;
+  if (!ReadFile(reinterpret_cast<HANDLE>(handle), buffer, length, &bytes_read,
+                &overlapped))
+    return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+  return bytes_read;
+}
+
+bool File::write_at(uint64_t offset, const uint8_t *buffer, uint32_t length) {
+  OVERLAPPED overlapped = {};
+  overlapped.Offset = static_cast<DWORD>(offset);
+  overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD written = 0;
+  return WriteFile(reinterpret_cast<HANDLE>(handle), buffer, length, &written,
+                   &overlapped) &&
+         written == length;
+}
+
+bool File::sync() {
+  return FlushFileBuffers(reinterpret_cast<HANDLE>(handle));
+}
+
+bool sync_directory(const std::string &) { return true; }
+#else
+bool File::open_read(const std::string &path) {
+  close();
+  handle = ::open(path.c_str(), O_RDONLY);
+  return handle != -1;
+}
+
+bool File::open_write(const std::string &path) {
+  close();
+  handle = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  return handle != -1;
+}
+
+bool File::open_update(const std::string &path) {
+  close();
+  handle = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  return handle != -1;
+}
+
+void File::close() {
+  if (handle != -1)
+    ::close(static_cast<int>(handle));
+  handle = -1;
+}
+
+uint64_t File::size() const {
+  struct stat info;
+  if (fstat(static_cast<int>(handle), &info) < 0)
+    return 0;
+  return info.st_size;
+}
+
+void File::advise_sequential() const {
+  posix_fadvise(static_cast<int>(handle), 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+bool File::preallocate(uint64_t length) {
+  int fd = static_cast<int>(handle);
+  if (ftruncate(fd, length) < 0)
+    return false;
+  // Reserving blocks is only an optimization, not every filesystem can.
+  if (length > 0)
+    posix_fallocate(fd, 0, length);
+  return true;
+}
+
+int64_t File::read_at(uint64_t offset, uint8_t *buffer,
+                      uint32_t length) const {
+  uint32_t total = 0;
+  while (total < length) {
+    ssize_t result = pread(static_cast<int>(handle), buffer + total,
+                           length - total, offset + total);
+    if (result < 0)
+      return -1;
+    if (result == 0)
+      break; // End of file.
+    total += result;
+  }
+  return total;
+}
+
+bool File::write_at(uint64_t offset, const uint8_t *buffer, uint32_t length) {
+  uint32_t total = 0;
+  while (total < length) {
+    ssize_t result = pwrite(static_cast<int>(handle), buffer + total,
+                            length - total, offset + total);
+    if (result <= 0)
+      return false;
+    total += result;
+  }
+  return true;
+}
+
+bool File::sync() { return fdatasync(static_cast<int>(handle)) == 0; }
+
+bool sync_directory(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0)
+    return false;
+  bool synced = fsync(fd) == 0;
+  ::close(fd);
+  return synced;
+}
+#endif
+} // namespace FIO
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace FIO {
+// Positional file access without a shared file pointer, so several
+// threads may read (or write) different regions of one file.
+class File {
+  intptr_t handle = -1;
+
+public:
+  File() = default;
+  ~File() { close(); }
+  File(const File &) = delete;
+  File &operator=(const File &) = delete;
+  File(File &&other) noexcept : handle(other.handle) { other.handle = -1; }
+  File &operator=(File &&other) noexcept {
+    if (this != &other) {
+      close();
+      handle = other.handle;
+      other.handle = -1;
+    }
+    return *this;
+  }
+  bool open_read(const std::string &path);
+  bool open_write(const std::string &path);  // Creates or truncates.
+  bool open_update(const std::string &path); // Creates, keeps the data.
+  void close();
+  bool is_open() const noexcept { return handle != -1; }
+  intptr_t native_handle() const noexcept { return handle; }
+  uint64_t size() const;
+  void advise_sequential() const;
+  bool preallocate(uint64_t length); // Reserves blocks, sets the size.
+  // Returns bytes read, -1 on error.
+  int64_t read_at(uint64_t offset, uint8_t *buffer, uint32_t length) const;
+  bool write_at(uint64_t offset, const uint8_t *buffer, uint32_t length);
+  bool sync(); // Written data reached the disk.
+};
+
+// Makes renames and new files in the directory durable. No-op on Windows.
+bool sync_directory(const std::string &path);
+} // namespace FIO
@@ -0,0 +1,106 @@
+#include "file_set.hpp"
+
+#include <algorithm>
+
+namespace FIO {
+bool FileSet::open_read(const std::vector<std::string> &paths) {
+  close();
+  for (const std::string &path : paths) {
+    Entry entry = {path, total_size, 0, File()};
+    if (!entry.file.open_read(path))
+      return false;
+    entry.size = entry.file.size();
+    if (paths.size() == 1)
+      entry.file.advise_sequential();
+    total_size += entry.size;
+    entries.push_back(std::move(entry));
+  }
+  return true;
+}
+
+bool FileSet::create(const std::vector<std::string> &paths,
+                     const std::vector<uint64_t> &sizes, bool keep_data) {
+  close();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    Entry entry = {paths[i], total_size, sizes[i], File()};
+    bool opened = keep_data ? entry.file.open_update(paths[i])
+                            : entry.file.open_write(paths[i]);
+    if (!opened || !entry.file.preallocate(sizes[i]))
+      return false;
+    total_size += entry.size;
+    entries.push_back(std::move(entry));
+  }
+  return true;
+}
+
+void FileSet::close() {
+  entries.clear();
+  total_size = 0;
+}
+
+// Empty files share their offset with the next one; upper_bound skips
+// them.
+size_t FileSet::find(uint64_t offset) const {
+  auto entry = std::upper_bound(
+      entries.begin(), entries.end(), offset,
+      [](uint64_t value, const Entry &entry) { return value < entry.offset; });
+  return entry - entries.begin() - 1;
+}
+
+int64_t FileSet::read_at(uint64_t offset, uint8_t *buffer,
+                         uint32_t length) const {
+  if (offset >= total_size)
+    return 0;
+  uint32_t total = 0;
+  for (size_t i = find(offset); i < entries.size() && total < length; ++i) {
+    const Entry &entry = entries[i];
+    uint64_t position = offset + total - entry.offset;
+    if (position >= entry.size)
+      continue;
+    uint32_t part = std::min<uint64_t>(length - total, entry.size - position);
+    int64_t result = entry.file.read_at(position, buffer + total, part);
+    if (result < 0)
+      return -1;
+    total += result;
+    if (result < part)
+      break; // The file shrank.
+  }
+  return total;
+}
+
+bool FileSet::write_at(uint64_t offset, const uint8_t *buffer,
+                       uint32_t length) {
+  if (offset + length > total_size)
+    return false;
+  uint32_t total = 0;
+  for (size_t i = find(offset); total < length; ++i) {
+    Entry &entry = entries[i];
+    uint64_t position = offset + total - entry.offset;
+    if (position >= entry.size)
+      continue;
+    uint32_t part = std::min<uint64_t>(length - total, entry.size - position);
+    if (!entry.file.write_at(position, buffer + total, part))
+      return false;
+    total += part;
+  }
+  return true;
+}
+
+bool FileSet::sync() {
+  for (Entry &entry : entries)
+    if (entry.size > 0 && !entry.file.sync())
+      return false;
+  return true;
+}
+
+intptr_t FileSet::find_handle(uint64_t offset, uint32_t length,
+                              uint64_t &file_offset) const {
+  if (entries.empty() || offset + length > total_size)
+    return -1;
+  const Entry &entry = entries[find(offset)];
+  file_offset = offset - entry.offset;
+  if (file_offset + length > entry.size)
+    return -1;
+  return entry.file.native_handle();
+}
+} // namespace FIO
\ No newline at end of file
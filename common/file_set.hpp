@@ -0,0 +1,48 @@
+#pragma once
+
+#include "file_io.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace FIO {
+// Files of a manifest seen as one byte stream: each starts where the one
+// before it ends, so small files share chunks and the transfer machinery
+// only deals with offsets. Positional access like File, thread-safe the
+// same way.
+class FileSet {
+  struct Entry {
+    std::string path;
+    uint64_t offset; // In the stream.
+    uint64_t size;
+    File file;
+  };
+  std::vector<Entry> entries;
+  uint64_t total_size = 0;
+
+  size_t find(uint64_t offset) const; // Entry holding the stream offset.
+
+public:
+  bool open_read(const std::vector<std::string> &paths);
+  // Creates every file and reserves its size. Existing data is kept for
+  // a resumed upload, truncated otherwise.
+  bool create(const std::vector<std::string> &paths,
+              const std::vector<uint64_t> &sizes, bool keep_data = false);
+  void close();
+  uint64_t size() const noexcept { return total_size; }
+  size_t get_count() const noexcept { return entries.size(); }
+  const std::string &get_path(size_t index) const {
+    return entries[index].path;
+  }
+  uint64_t get_size(size_t index) const { return entries[index].size; }
+  // Returns bytes read, -1 on error. May span several files.
+  int64_t read_at(uint64_t offset, uint8_t *buffer, uint32_t length) const;
+  bool write_at(uint64_t offset, const uint8_t *buffer, uint32_t length);
+  bool sync(); // Every file.
+  // Native handle of the file holding [offset, offset + length) and the
+  // offset inside it; -1 if the range spans files.
+  intptr_t find_handle(uint64_t offset, uint32_t length,
+                       uint64_t &file_offset) const;
+};
+} // namespace FIO
\ No newline at end of file
@@ -1,15 +1,316 @@
 #include "log.hpp"
 
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 namespace {
-std::mutex print_mutex;
+constexpr uint32_t RING_SIZE = 1 << 16;        // Per thread.
+constexpr size_t MAX_RECORD_SIZE = 1 << 13;    // Longer text is cut.
+constexpr uint32_t RECORD_ALIGNMENT = 32;      // A header fits anywhere.
+constexpr uint32_t PADDING_LEVEL = UINT32_MAX; // Skips to the ring's start.
+// Backstop for a wakeup lost between the check and the wait.
+constexpr auto WRITE_INTERVAL = std::chrono::milliseconds(100);
+
+// A queued line: the header, count arguments, then their text.
+struct Header {
+  uint32_t size; // Of the record, a multiple of RECORD_ALIGNMENT.
+  uint32_t level;
+  uint64_t sequence;
+  const char *format;
+  uint32_t count;
+};
+static_assert(sizeof(Header) <= RECORD_ALIGNMENT);
+
+// Single producer, the owning thread, and single consumer, the writer.
+struct Ring {
+  std::unique_ptr<uint8_t[]> buffer = std::make_unique<uint8_t[]>(RING_SIZE);
+  alignas(64) std::atomic<uint64_t> head = 0; // Bytes consumed.
+  alignas(64) std::atomic<uint64_t> tail = 0; // Bytes produced.
+  std::atomic<bool> closed = false;           // Owner ended.
+};
+
+struct Line {
+  uint64_t sequence;
+  size_t offset; // Into the formatted text.
+  size_t size;
+};
+
+std::atomic<uint32_t> level = LOG::LEVEL_INFO;
+
+class Logger {
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable written;
+  std::vector<std::shared_ptr<Ring>> rings;
+  std::atomic<bool> signalled = false;
+  std::atomic<uint64_t> sequence = 0;
+  uint64_t flush_requests = 0;
+  uint64_t flushes_done = 0;
+  bool stopping = false;
+  FILE *output = stdout;
+  std::string text;        // Formatted lines of a batch.
+  std::vector<Line> lines; // Of text, sorted before writing.
+  std::string batch;
+  std::thread thread;
+
+  void run();
+  bool drain(Ring &ring); // True once a closed ring is empty.
+  void format(const uint8_t *record);
+
+public:
+  Logger() : thread(&Logger::run, this) {}
+  ~Logger();
+  std::shared_ptr<Ring> add_ring();
+  uint64_t next_sequence() {
+    return sequence.fetch_add(1, std::memory_order_relaxed);
+  }
+  void notify();
+  void flush();
+  bool open(const std::string &path);
+};
+
+Logger::~Logger() {
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  thread.join();
+  if (output != stdout)
+    std::fclose(output);
+}
+
+std::shared_ptr<Ring> Logger::add_ring() {
+  auto ring = std::make_shared<Ring>();
+  const std::lock_guard<std::mutex> lock(mutex);
+  rings.push_back(ring);
+  return ring;
+}
+
+// At most one wakeup per batch, however many lines come meanwhile.
+void Logger::notify() {
+  if (!signalled.load(std::memory_order_relaxed) &&
+      !signalled.exchange(true, std::memory_order_acq_rel))
+    wake.notify_one();
+}
+
+void Logger::flush() {
+  std::unique_lock<std::mutex> lock(mutex);
+  uint64_t request = ++flush_requests;
+  wake.notify_one();
+  written.wait(lock, [&] { return flushes_done >= request; });
+}
+
+bool Logger::open(const std::string &path) {
+  FILE *file = std::fopen(path.c_str(), "a");
+  if (file == nullptr)
+    return false;
+  flush();
+  const std::lock_guard<std::mutex> lock(mutex);
+  if (output != stdout)
+    std::fclose(output);
+  output = file;
+  return true;
+}
+
+// Formats whatever the rings hold, sorted by when it was logged, and writes
+// it in one go.
+void Logger::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait_for(lock, WRITE_INTERVAL, [&] {
+      return stopping || flush_requests > flushes_done ||
+             signalled.load(std::memory_order_acquire);
+    });
+    bool stop = stopping;
+    uint64_t requested = flush_requests;
+    signalled.store(false, std::memory_order_release);
+    std::vector<std::shared_ptr<Ring>> current = rings;
+    FILE *file = output;
+    lock.unlock();
+    std::vector<Ring *> finished;
+    for (const std::shared_ptr<Ring> &ring : current)
+      if (drain(*ring))
+        finished.push_back(ring.get());
+    std::sort(lines.begin(), lines.end(),
+              [](const Line &a, const Line &b) {
+                return a.sequence < b.sequence;
+              });
+    for (const Line &line : lines)
+      batch.append(text, line.offset, line.size);
+    if (!batch.empty()) {
+      std::fwrite(batch.data(), 1, batch.size(), file);
+      std::fflush(file);
+    }
+    text.clear();
+    lines.clear();
+    batch.clear();
+    lock.lock();
+    std::erase_if(rings, [&](const std::shared_ptr<Ring> &ring) {
+      return std::find(finished.begin(), finished.end(), ring.get()) !=
+             finished.end();
+    });
+    flushes_done = requested;
+    written.notify_all();
+    if (stop)
+      break;
+  }
+}
+
+bool Logger::drain(Ring &ring) {
+  bool closed = ring.closed.load(std::memory_order_acquire);
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+  uint64_t tail = ring.tail.load(std::memory_order_acquire);
+  while (head < tail) {
+    const uint8_t *record = ring.buffer.get() + head % RING_SIZE;
+    Header header;
+    std::memcpy(&header, record, sizeof(header));
+    if (header.level != PADDING_LEVEL)
+      format(record);
+    head += header.size;
+  }
+  ring.head.store(head, std::memory_order_release);
+  return closed;
+}
+
+void Logger::format(const uint8_t *record) {
+  Header header;
+  std::memcpy(&header, record, sizeof(header));
+  const uint8_t *arguments = record + sizeof(Header);
+  const char *argument_text = reinterpret_cast<const char *>(
+      arguments + header.count * sizeof(LOG::Argument));
+  size_t offset = text.size();
+  uint32_t next = 0;
+  for (const char *c = header.format; *c != '\0'; ++c) {
+    if (c[0] != '{' || c[1] != '}' || next == header.count) {
+      text.push_back(*c);
+      continue;
+    }
+    c++;
+    LOG::Argument argument;
+    std::memcpy(&argument, arguments + next++ * sizeof(argument),
+                sizeof(argument));
+    char number[32];
+    std::to_chars_result result = {number, std::errc()};
+    switch (argument.type) {
+    case LOG::Argument::SIGNED:
+      result = std::to_chars(number, std::end(number), argument.signed_value);
+      break;
+    case LOG::Argument::UNSIGNED:
+      result =
+          std::to_chars(number, std::end(number), argument.unsigned_value);
+      break;
+    case LOG::Argument::REAL:
+      result = std::to_chars(number, std::end(number), argument.real_value);
+      break;
+    case LOG::Argument::TEXT:
+      text.append(argument_text, argument.size);
+      argument_text += argument.size;
+      break;
+    }
+    text.append(number, result.ptr);
+  }
+  text.push_back('\n');
+  lines.push_back({header.sequence, offset, text.size() - offset});
 }
 
+Logger &get_logger() {
+  static Logger logger;
+  return logger;
+}
+
+// The ring outlives its thread until the writer emptied it.
+struct RingOwner {
+  std::shared_ptr<Ring> ring = get_logger().add_ring();
+  ~RingOwner() { ring->closed.store(true, std::memory_order_release); }
+};
+} // namespace
+
 namespace LOG {
-void safe_print(const std::string &str) {
-  const std::lock_guard<std::mutex> lock(print_mutex);
-  std::cout << str << std::endl;
+LEVEL get_level() {
+  return static_cast<LEVEL>(level.load(std::memory_order_relaxed));
 }
+
+void set_level(LEVEL new_level) {
+  level.store(new_level, std::memory_order_relaxed);
+}
+
+bool parse_level(const char *name, LEVEL &result) {
+  constexpr const char *NAMES[] = {"debug", "info", "warning", "error"};
+  for (uint32_t i = 0; i < std::size(NAMES); ++i)
+    if (std::strcmp(name, NAMES[i]) == 0) {
+      result = static_cast<LEVEL>(i);
+      return true;
+    }
+  return false;
+}
+
+bool open(const std::string &path) { return get_logger().open(path); }
+
+void flush() { get_logger().flush(); }
+
+// A full ring waits for the writer rather than lose the line.
+void push(LEVEL line_level, const char *format, const Argument *arguments,
+          const std::string_view *texts, uint32_t count) {
+  thread_local RingOwner owner;
+  Ring &ring = *owner.ring;
+  Logger &logger = get_logger();
+  size_t fixed_size = sizeof(Header) + count * sizeof(Argument);
+  size_t text_size = 0;
+  for (uint32_t i = 0; i < count; ++i)
+    if (arguments[i].type == Argument::TEXT)
+      text_size += texts[i].size();
+  text_size = std::min(text_size, MAX_RECORD_SIZE - fixed_size);
+  size_t size = (fixed_size + text_size + RECORD_ALIGNMENT - 1) /
+                RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+  uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+  uint64_t position = tail % RING_SIZE;
+  uint64_t padding = position + size > RING_SIZE ? RING_SIZE - position : 0;
+  while (tail + padding + size -
+             ring.head.load(std::memory_order_acquire) >
+         RING_SIZE) {
+    logger.notify();
+    std::this_thread::yield();
+  }
+  uint8_t *buffer = ring.buffer.get();
+  if (padding != 0) {
+    Header header = {static_cast<uint32_t>(padding), PADDING_LEVEL, 0,
+                     nullptr, 0};
+    std::memcpy(buffer + position, &header, sizeof(header));
+    tail += padding;
+    position = 0;
+  }
+  uint8_t *record = buffer + position;
+  Header header = {static_cast<uint32_t>(size), line_level,
+                   logger.next_sequence(), format, count};
+  std::memcpy(record, &header, sizeof(header));
+  uint8_t *argument_data = record + sizeof(Header);
+  uint8_t *text = argument_data + count * sizeof(Argument);
+  for (uint32_t i = 0; i < count; ++i) {
+    Argument argument = arguments[i];
+    if (argument.type == Argument::TEXT) {
+      size_t room = record + fixed_size + text_size - text;
+      argument.size =
+          static_cast<uint32_t>(std::min(texts[i].size(), room));
+      std::memcpy(text, texts[i].data(), argument.size);
+      text += argument.size;
+    }
+    std::memcpy(argument_data + i * sizeof(Argument), &argument,
+                sizeof(argument));
+  }
+  ring.tail.store(tail + size, std::memory_order_release);
+  logger.notify();
+}
+
+void safe_print(const std::string &str) { info("{}", str); }
 } // namespace LOG
\ No newline at end of file
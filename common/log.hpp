@@ -1,7 +1,104 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+// Lines go into a lock-free ring of the calling thread as a format string
+// and a copy of the arguments; a background thread formats them and
+// writes them out in batches, so logging costs a network thread no lock,
+// no formatting and no flush. A thread's lines come out in the order it
+// logged them; those of different threads only within one batch, a line
+// still being queued when a batch is taken comes out with the next.
 namespace LOG {
-void safe_print(const std::string &str);
-}
\ No newline at end of file
+enum LEVEL : uint32_t {
+  LEVEL_DEBUG = 0,
+  LEVEL_INFO = 1,
+  LEVEL_WARNING = 2,
+  LEVEL_ERROR = 3,
+};
+// Calls below this level compile to nothing, set by LOG_MIN_LEVEL.
+constexpr uint32_t MIN_LEVEL = LOG_MIN_LEVEL;
+
+// An argument as queued; text is copied in after the arguments.
+struct Argument {
+  enum TYPE : uint32_t { SIGNED, UNSIGNED, REAL, TEXT } type = TEXT;
+  uint32_t size = 0; // Of the text.
+  union {
+    int64_t signed_value = 0;
+    uint64_t unsigned_value;
+    double real_value;
+  };
+};
+
+template <typename T>
+Argument make_argument(const T &value, std::string_view &text) {
+  Argument argument;
+  if constexpr (std::is_enum_v<T>) {
+    return make_argument(static_cast<std::underlying_type_t<T>>(value), text);
+  } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+    argument.type = Argument::SIGNED;
+    argument.signed_value = value;
+  } else if constexpr (std::is_integral_v<T>) {
+    argument.type = Argument::UNSIGNED;
+    argument.unsigned_value = value;
+  } else if constexpr (std::is_floating_point_v<T>) {
+    argument.type = Argument::REAL;
+    argument.real_value = value;
+  } else {
+    text = std::string_view(value);
+  }
+  return argument;
+}
+
+LEVEL get_level(); // Lines below it are dropped, LEVEL_INFO by default.
+void set_level(LEVEL level);
+bool parse_level(const char *name, LEVEL &level); // debug, info, ...
+// Appends to the file instead of writing to stdout from now on.
+bool open(const std::string &path);
+void flush(); // Returns once every line queued so far is written.
+// Queues a line; format must outlive the program, a string literal.
+void push(LEVEL level, const char *format, const Argument *arguments,
+          const std::string_view *texts, uint32_t count);
+
+// Every {} in format takes the next argument: an integer, a floating
+// point number or a string.
+template <typename... Args>
+void print_at(LEVEL level, const char *format, const Args &...args) {
+  if (level < MIN_LEVEL || level < get_level())
+    return;
+  std::string_view texts[sizeof...(Args) + 1];
+  Argument arguments[sizeof...(Args) + 1];
+  uint32_t i = 0;
+  ((arguments[i] = make_argument(args, texts[i]), i++), ...);
+  push(level, format, arguments, texts, i);
+}
+template <LEVEL level, typename... Args>
+void print(const char *format, const Args &...args) {
+  if constexpr (level >= MIN_LEVEL)
+    print_at(level, format, args...);
+}
+template <typename... Args>
+void debug(const char *format, const Args &...args) {
+  print<LEVEL_DEBUG>(format, args...);
+}
+template <typename... Args>
+void info(const char *format, const Args &...args) {
+  print<LEVEL_INFO>(format, args...);
+}
+template <typename... Args>
+void warning(const char *format, const Args &...args) {
+  print<LEVEL_WARNING>(format, args...);
+}
+template <typename... Args>
+void error(const char *format, const Args &...args) {
+  print<LEVEL_ERROR>(format, args...);
+}
+
+void safe_print(const std::string &str); // An info line built already.
+} // namespace LOG
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "lz.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+namespace {
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t MAX_OFFSET = 65535;
+constexpr uint32_t HASH_BITS = 12;
+// Misses in a row before the search steps over more bytes at a time, so
+// incompressible data is passed over quickly.
+constexpr uint32_t SKIP_TRIGGER = 6;
+constexpr size_t NIBBLE_MAX = 15; // Longer lengths continue in bytes.
+
+uint32_t load32(const uint8_t *data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+uint64_t load64(const uint8_t *data) {
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint32_t hash(uint32_t value) {
+  return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Bytes [position, end) equal to those at candidate, which is before.
+size_t match_length(const uint8_t *data, size_t candidate, size_t position,
+                    size_t end) {
+  size_t start = position;
+  while (position + sizeof(uint64_t) <= end) {
+    uint64_t difference =
+        load64(data + position) ^ load64(data + candidate);
+    if (difference != 0)
+      return position - start + std::countr_zero(difference) / 8;
+    position += sizeof(uint64_t);
+    candidate += sizeof(uint64_t);
+  }
+  while (position < end && data[position] == data[candidate]) {
+    position++;
+    candidate++;
+  }
+  return position - start;
+}
+
+void put_length(uint8_t *&out, size_t length) {
+  for (length -= NIBBLE_MAX; length >= 255; length -= 255)
+    *out++ = 255;
+  *out++ = static_cast<uint8_t>(length);
+}
+
+// A token, the literals and, unless length is 0 for the last sequence,
+// the match. False if it does not fit before out_end.
+bool put_sequence(uint8_t *&out, const uint8_t *out_end,
+                  const uint8_t *literals, size_t literal_count,
+                  size_t offset, size_t length) {
+  size_t needed = 1 + literal_count + literal_count / 255 + 1;
+  if (length != 0)
+    needed += 2 + length / 255 + 1;
+  if (static_cast<size_t>(out_end - out) < needed)
+    return false;
+  size_t match_code = length != 0 ? length - MIN_MATCH : 0;
+  *out++ = static_cast<uint8_t>(std::min(literal_count, NIBBLE_MAX) << 4 |
+                                std::min(match_code, NIBBLE_MAX));
+  if (literal_count >= NIBBLE_MAX)
+    put_length(out, literal_count);
+  std::memcpy(out, literals, literal_count);
+  out += literal_count;
+  if (length == 0)
+    return true;
+  *out++ = static_cast<uint8_t>(offset);
+  *out++ = static_cast<uint8_t>(offset >> 8);
+  if (match_code >= NIBBLE_MAX)
+    put_length(out, match_code);
+  return true;
+}
+
+bool get_length(std::span<const uint8_t> input, size_t &offset,
+                size_t &length) {
+  uint8_t byte;
+  do {
+    if (offset == input.size())
+      return false;
+    byte = input[offset++];
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+} // namespace
+
+namespace LZ {
+size_t compress(std::span<const uint8_t> input, std::span<uint8_t> output) {
+  const uint8_t *data = input.data();
+  size_t size = input.size();
+  uint8_t *out = output.data();
+  const uint8_t *out_end = out + output.size();
+  std::array<uint32_t, 1 << HASH_BITS> table = {}; // Last position seen.
+  size_t anchor = 0; // First byte not written yet.
+  size_t position = 0;
+  uint32_t misses = 0;
+  while (position + MIN_MATCH <= size) {
+    uint32_t value = load32(data + position);
+    uint32_t &slot = table[hash(value)];
+    size_t candidate = slot;
+    slot = static_cast<uint32_t>(position);
+    if (candidate >= position || position - candidate > MAX_OFFSET ||
+        load32(data + candidate) != value) {
+      position += 1 + (misses++ >> SKIP_TRIGGER);
+      continue;
+    }
+    misses = 0;
+    while (position > anchor && candidate > 0 &&
+           data[position - 1] == data[candidate - 1]) {
+      position--;
+      candidate--;
+    }
+    size_t length = match_length(data, candidate, position, size);
+    if (!put_sequence(out, out_end, data + anchor, position - anchor,
+                      position - candidate, length))
+      return 0;
+    position += length;
+    anchor = position;
+    if (position + MIN_MATCH <= size) // Helps the next match start here.
+      table[hash(load32(data + position - 2))] =
+          static_cast<uint32_t>(position - 2);
+  }
+  if (!put_sequence(out, out_end, data + anchor, size - anchor, 0, 0))
+    return 0;
+  return out - output.data();
+}
+
+bool decompress(std::span<const uint8_t> input, std::span<uint8_t> output) {
+  size_t in = 0;
+  size_t out = 0;
+  while (in < input.size()) {
+    uint8_t token = input[in++];
+    size_t literals = token >> 4;
+    if (literals == NIBBLE_MAX && !get_length(input, in, literals))
+      return false;
+    if (literals > input.size() - in || literals > output.size() - out)
+      return false;
+    std::memcpy(output.data() + out, input.data() + in, literals);
+    in += literals;
+    out += literals;
+    if (in == input.size())
+      break; // The last sequence has no match.
+    if (input.size() - in < 2)
+      return false;
+    size_t offset = input[in] | size_t(input[in + 1]) << 8;
+    in += 2;
+    size_t length = token & 0x0F;
+    if (length == NIBBLE_MAX && !get_length(input, in, length))
+      return false;
+    length += MIN_MATCH;
+    if (offset == 0 || offset > out || length > output.size() - out)
+      return false;
+    uint8_t *target = output.data() + out;
+    if (offset >= length) {
+      std::memcpy(target, target - offset, length);
+    } else {
+      for (size_t i = 0; i < length; ++i) // Overlaps, repeats a pattern.
+        target[i] = target[i - offset];
+    }
+    out += length;
+  }
+  return out == output.size();
+}
+} // namespace LZ
\ No newline at end of file
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Byte-oriented LZ77 in the manner of LZ4: sequences of literals and a
+// match of at least four bytes up to 64 KiB back, no entropy coding. Fast
+// enough on both ends to run per packet.
+namespace LZ {
+// Compressed size, or 0 if the input does not fit the output; callers
+// keep the data as it is then.
+size_t compress(std::span<const uint8_t> input, std::span<uint8_t> output);
+// False for malformed input or any size but output's exactly.
+bool decompress(std::span<const uint8_t> input, std::span<uint8_t> output);
+} // namespace LZ
\ No newline at end of file
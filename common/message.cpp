@@ -1,116 +1,409 @@
 #include "message.hpp"
 
 namespace MESG {
-void serialize_uint32(std::vector<uint8_t> &buffer, uint32_t &offset,
-                      uint32_t number) {
-  if (buffer.size() < offset + sizeof(number))
-    buffer.resize(offset + sizeof(number));
+void put_uint32(std::span<uint8_t> buffer, uint32_t &offset, uint32_t number) {
   buffer[offset] = number >> 24;
   buffer[offset + 1] = number >> 16;
   buffer[offset + 2] = number >> 8;
   buffer[offset + 3] = number;
   offset += 4;
 }
-void serialize_str(std::vector<uint8_t> &buffer, uint32_t &offset,
-                   const std::vector<uint8_t> &str) {
-  if (buffer.size() < offset + str.size())
-    buffer.resize(offset + str.size());
-  for (int i = 0; i < str.size(); ++i) {
-    buffer[offset++] = str[i];
-  }
+void put_uint64(std::span<uint8_t> buffer, uint32_t &offset, uint64_t number) {
+  put_uint32(buffer, offset, number >> 32);
+  put_uint32(buffer, offset, number);
 }
-uint32_t deserialize_uint32(const std::vector<uint8_t> &buffer,
-                            uint32_t &offset) {
-  uint32_t result = 0;
-  result |= (uint32_t)buffer[offset] << 24;
-  result |= (uint32_t)buffer[offset + 1] << 16;
-  result |= (uint32_t)buffer[offset + 2] << 8;
-  result |= (uint32_t)buffer[offset + 3];
+uint32_t get_uint32(std::span<const uint8_t> buffer, uint32_t &offset) {
+  uint32_t result = (uint32_t)buffer[offset] << 24 |
+                    (uint32_t)buffer[offset + 1] << 16 |
+                    (uint32_t)buffer[offset + 2] << 8 |
+                    (uint32_t)buffer[offset + 3];
   offset += 4;
   return result;
 }
-std::vector<uint8_t> deserialize_str(const std::vector<uint8_t> &buffer,
-                                     uint32_t &offset, uint32_t length) {
-  std::vector<uint8_t> result(buffer.begin() + offset,
-                              buffer.begin() + offset + length);
-  offset += length;
-  return result;
+uint64_t get_uint64(std::span<const uint8_t> buffer, uint32_t &offset) {
+  uint64_t result = static_cast<uint64_t>(get_uint32(buffer, offset)) << 32;
+  return result | get_uint32(buffer, offset);
+}
+
+uint64_t peek_transfer_id(std::span<const uint8_t> buffer) {
+  if (buffer.size() < MESSAGE_HEADER_SIZE)
+    return 0;
+  uint32_t offset = sizeof(uint32_t);
+  return get_uint64(buffer, offset);
 }
 
-std::vector<uint8_t> FileMessage::serialize_message() const {
-  std::vector<uint8_t> result;
+uint32_t encode_file_header(std::span<uint8_t> buffer,
+                            const FileMessage &message) {
   uint32_t offset = 0;
-  serialize_uint32(result, offset, type);
-  serialize_uint32(result, offset, packet_number);
-  serialize_uint32(result, offset, data.size());
-  serialize_str(result, offset, data);
-  return result;
+  put_uint32(buffer, offset, MESSAGE_TYPE_FILE);
+  put_uint64(buffer, offset, message.transfer_id);
+  put_uint64(buffer, offset, message.packet_number);
+  put_uint32(buffer, offset, message.timestamp);
+  put_uint32(buffer, offset, message.checksum);
+  put_uint32(buffer, offset, message.encoding);
+  put_uint32(buffer, offset, message.data.size());
+  return offset;
+}
+bool FileMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < FILE_HEADER_SIZE)
+    return false;
+  uint32_t offset = sizeof(uint32_t); // Type is checked by the caller.
+  transfer_id = get_uint64(buffer, offset);
+  packet_number = get_uint64(buffer, offset);
+  timestamp = get_uint32(buffer, offset);
+  checksum = get_uint32(buffer, offset);
+  uint32_t encoding_value = get_uint32(buffer, offset);
+  if (encoding_value > FILE_ENCODING_LZ)
+    return false;
+  encoding = static_cast<FILE_ENCODING>(encoding_value);
+  uint32_t data_length = get_uint32(buffer, offset);
+  if (buffer.size() - offset < data_length)
+    return false;
+  data = buffer.subspan(offset, data_length);
+  return true;
 }
-void FileMessage::deserialize_message(const std::vector<uint8_t> &buffer) {
+
+uint32_t encode_parity_header(std::span<uint8_t> buffer,
+                              const ParityMessage &message) {
   uint32_t offset = 0;
-  type = static_cast<MESSAGE_TYPE>(deserialize_uint32(buffer, offset));
-  packet_number = deserialize_uint32(buffer, offset);
-  data_length = deserialize_uint32(buffer, offset);
-  data = deserialize_str(buffer, offset, data_length);
+  put_uint32(buffer, offset, MESSAGE_TYPE_PARITY);
+  put_uint64(buffer, offset, message.transfer_id);
+  put_uint64(buffer, offset, message.first_packet);
+  put_uint32(buffer, offset, message.group_size);
+  put_uint32(buffer, offset, message.parity_index);
+  put_uint32(buffer, offset, message.checksum);
+  put_uint32(buffer, offset, message.data.size());
+  return offset;
 }
-std::vector<uint8_t> StartMessage::serialize_message() const {
-  std::vector<uint8_t> result;
+bool ParityMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < PARITY_HEADER_SIZE)
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  transfer_id = get_uint64(buffer, offset);
+  first_packet = get_uint64(buffer, offset);
+  group_size = get_uint32(buffer, offset);
+  parity_index = get_uint32(buffer, offset);
+  checksum = get_uint32(buffer, offset);
+  uint32_t data_length = get_uint32(buffer, offset);
+  if (buffer.size() - offset < data_length)
+    return false;
+  data = buffer.subspan(offset, data_length);
+  return true;
+}
+
+uint32_t StartMessage::encoded_size() const noexcept {
+  uint32_t size = MESSAGE_HEADER_SIZE + 16;
+  for (const ManifestEntry &file : files)
+    size += 20 + file.name.size();
+  return size;
+}
+uint32_t StartMessage::encode(std::span<uint8_t> buffer) const {
   uint32_t offset = 0;
-  serialize_uint32(result, offset, type);
-  serialize_uint32(result, offset, port);
-  serialize_uint32(result, offset, filename.size());
-  serialize_str(result, offset, filename);
-  return result;
+  put_uint32(buffer, offset, TYPE);
+  put_uint64(buffer, offset, transfer_id);
+  put_uint32(buffer, offset, stripe_count);
+  put_uint32(buffer, offset, flags);
+  put_uint32(buffer, offset, chunk_size);
+  put_uint32(buffer, offset, files.size());
+  for (const ManifestEntry &file : files) {
+    put_uint64(buffer, offset, file.size);
+    put_uint64(buffer, offset, file.modified);
+    put_uint32(buffer, offset, file.name.size());
+    for (char symbol : file.name)
+      buffer[offset++] = symbol;
+  }
+  return offset;
 }
-void StartMessage::deserialize_message(const std::vector<uint8_t> &buffer) {
+bool StartMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < MESSAGE_HEADER_SIZE + 16)
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  transfer_id = get_uint64(buffer, offset);
+  stripe_count = get_uint32(buffer, offset);
+  flags = get_uint32(buffer, offset);
+  chunk_size = get_uint32(buffer, offset);
+  uint32_t file_count = get_uint32(buffer, offset);
+  if (file_count > MAX_MANIFEST_FILES)
+    return false;
+  files.clear();
+  for (uint32_t i = 0; i < file_count; ++i) {
+    if (buffer.size() - offset < 20)
+      return false;
+    ManifestEntry file;
+    file.size = get_uint64(buffer, offset);
+    file.modified = get_uint64(buffer, offset);
+    uint32_t name_length = get_uint32(buffer, offset);
+    if (buffer.size() - offset < name_length)
+      return false;
+    file.name.assign(buffer.begin() + offset,
+                     buffer.begin() + offset + name_length);
+    offset += name_length;
+    files.push_back(std::move(file));
+  }
+  return true;
+}
+bool StartMessage::add_file(const std::string &name, uint64_t size,
+                            uint64_t modified) {
+  if (files.size() == MAX_MANIFEST_FILES ||
+      encoded_size() + 20 + name.size() > MAX_CONTROL_MESSAGE_SIZE)
+    return false;
+  files.push_back({name, size, modified});
+  return true;
+}
+uint64_t StartMessage::get_file_size() const noexcept {
+  uint64_t size = 0;
+  for (const ManifestEntry &file : files)
+    size += file.size;
+  return size;
+}
+uint32_t ConfirmMessage::encode(std::span<uint8_t> buffer) const {
   uint32_t offset = 0;
-  type = static_cast<MESSAGE_TYPE>(deserialize_uint32(buffer, offset));
-  port = deserialize_uint32(buffer, offset);
-  name_length = deserialize_uint32(buffer, offset);
-  filename = deserialize_str(buffer, offset, name_length);
+  put_uint32(buffer, offset, TYPE);
+  put_uint64(buffer, offset, transfer_id);
+  put_uint64(buffer, offset, packet_number);
+  put_uint32(buffer, offset, status);
+  return offset;
 }
-std::vector<uint8_t> ConfirmMessage::serialize_message() const {
-  std::vector<uint8_t> result;
+bool ConfirmMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < CONFIRM_MESSAGE_SIZE)
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  transfer_id = get_uint64(buffer, offset);
+  packet_number = get_uint64(buffer, offset);
+  status = static_cast<MESSAGE_STATUS>(get_uint32(buffer, offset));
+  return true;
+}
+uint32_t FinalMessage::encode(std::span<uint8_t> buffer) const {
   uint32_t offset = 0;
-  serialize_uint32(result, offset, type);
-  serialize_uint32(result, offset, packet_number);
-  serialize_uint32(result, offset, status);
-  return result;
+  put_uint32(buffer, offset, TYPE);
+  put_uint64(buffer, offset, transfer_id);
+  put_uint32(buffer, offset, crc_code);
+  return offset;
+}
+bool FinalMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < encoded_size())
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  transfer_id = get_uint64(buffer, offset);
+  crc_code = get_uint32(buffer, offset);
+  return true;
 }
-void ConfirmMessage::deserialize_message(const std::vector<uint8_t> &buffer) {
+uint32_t AcceptMessage::encode(std::span<uint8_t> buffer) const {
   uint32_t offset = 0;
-  type = static_cast<MESSAGE_TYPE>(deserialize_uint32(buffer, offset));
-  packet_number = deserialize_uint32(buffer, offset);
-  status = static_cast<MESSAGE_STATUS>(deserialize_uint32(buffer, offset));
+  put_uint32(buffer, offset, TYPE);
+  put_uint64(buffer, offset, transfer_id);
+  put_uint32(buffer, offset, status);
+  put_uint32(buffer, offset, stripe_count);
+  for (const Stripe &stripe : get_stripes()) {
+    put_uint64(buffer, offset, stripe.stripe_id);
+    put_uint32(buffer, offset, stripe.port);
+    put_uint64(buffer, offset, stripe.first_packet);
+    put_uint64(buffer, offset, stripe.end_packet);
+  }
+  return offset;
+}
+bool AcceptMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < ACCEPT_HEADER_SIZE)
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  transfer_id = get_uint64(buffer, offset);
+  status = static_cast<MESSAGE_STATUS>(get_uint32(buffer, offset));
+  stripe_count = get_uint32(buffer, offset);
+  if (stripe_count > MAX_STRIPES ||
+      buffer.size() < ACCEPT_HEADER_SIZE + stripe_count * ACCEPT_STRIPE_SIZE)
+    return false;
+  for (uint32_t i = 0; i < stripe_count; ++i) {
+    stripes[i].stripe_id = get_uint64(buffer, offset);
+    stripes[i].port = get_uint32(buffer, offset);
+    stripes[i].first_packet = get_uint64(buffer, offset);
+    stripes[i].end_packet = get_uint64(buffer, offset);
+  }
+  return true;
 }
-std::vector<uint8_t> FinalMessage::serialize_message() const {
+uint32_t NakMessage::encode(std::span<uint8_t> buffer) const {
   uint32_t offset = 0;
-  std::vector<uint8_t> result;
-  serialize_uint32(result, offset, type);
-  serialize_uint32(result, offset, crc_code);
-  return result;
+  put_uint32(buffer, offset, TYPE);
+  put_uint64(buffer, offset, transfer_id);
+  put_uint64(buffer, offset, packet_number);
+  return offset;
+}
+bool NakMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < NAK_MESSAGE_SIZE)
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  transfer_id = get_uint64(buffer, offset);
+  packet_number = get_uint64(buffer, offset);
+  return true;
 }
-void FinalMessage::deserialize_message(const std::vector<uint8_t> &buffer) {
+uint32_t ProbeMessage::encode(std::span<uint8_t> buffer) const {
   uint32_t offset = 0;
-  type = static_cast<MESSAGE_TYPE>(deserialize_uint32(buffer, offset));
-  crc_code = deserialize_uint32(buffer, offset);
+  put_uint32(buffer, offset, TYPE);
+  put_uint32(buffer, offset, size);
+  put_uint32(buffer, offset, answer);
+  std::fill(buffer.begin() + offset, buffer.begin() + encoded_size(), 0);
+  return encoded_size();
 }
-MESSAGE_TYPE get_type(std::vector<uint8_t> raw_data) {
-  uint32_t dummy_offset = 0;
-  MESSAGE_TYPE result =
-      static_cast<MESSAGE_TYPE>(deserialize_uint32(raw_data, dummy_offset));
-  return result;
+bool ProbeMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < PROBE_HEADER_SIZE)
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  size = get_uint32(buffer, offset);
+  answer = get_uint32(buffer, offset);
+  // A probe that arrived is as long as it says.
+  return answer != 0 || size == buffer.size();
 }
-std::string StartMessage::get_filename() const {
-  std::string name;
-  name.resize(filename.size());
-  for (int i = 0; i < filename.size(); ++i)
-    name[i] = filename[i];
-  return name;
-}
-void StartMessage::set_filename(const std::string &name) {
-  filename.resize(name.size());
-  for (int i = 0; i < filename.size(); ++i)
-    filename[i] = name[i];
+uint32_t AckMessage::encode(std::span<uint8_t> buffer) const {
+  uint32_t offset = 0;
+  put_uint32(buffer, offset, TYPE);
+  put_uint64(buffer, offset, transfer_id);
+  put_uint64(buffer, offset, cumulative);
+  put_uint32(buffer, offset, echo_timestamp);
+  put_uint32(buffer, offset, ack_delay);
+  put_uint32(buffer, offset, recovered);
+  put_uint32(buffer, offset, range_count);
+  for (const SackRange &range : get_ranges()) {
+    put_uint64(buffer, offset, range.start);
+    put_uint64(buffer, offset, range.end);
+  }
+  return offset;
+}
+bool AckMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < ACK_HEADER_SIZE)
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  transfer_id = get_uint64(buffer, offset);
+  cumulative = get_uint64(buffer, offset);
+  echo_timestamp = get_uint32(buffer, offset);
+  ack_delay = get_uint32(buffer, offset);
+  recovered = get_uint32(buffer, offset);
+  range_count = get_uint32(buffer, offset);
+  if (range_count > MAX_SACK_RANGES ||
+      buffer.size() - offset < range_count * 16)
+    return false;
+  for (uint32_t i = 0; i < range_count; ++i) {
+    ranges[i].start = get_uint64(buffer, offset);
+    ranges[i].end = get_uint64(buffer, offset);
+  }
+  return true;
+}
+uint32_t ResumeMessage::encode(std::span<uint8_t> buffer) const {
+  uint32_t offset = 0;
+  put_uint32(buffer, offset, TYPE);
+  put_uint64(buffer, offset, transfer_id);
+  put_uint32(buffer, offset, range_count);
+  for (const SackRange &range : get_ranges()) {
+    put_uint64(buffer, offset, range.start);
+    put_uint64(buffer, offset, range.end);
+  }
+  return offset;
+}
+bool ResumeMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < RESUME_HEADER_SIZE)
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  transfer_id = get_uint64(buffer, offset);
+  range_count = get_uint32(buffer, offset);
+  if (range_count > MAX_RESUME_RANGES ||
+      buffer.size() - offset < range_count * 16)
+    return false;
+  for (uint32_t i = 0; i < range_count; ++i) {
+    ranges[i].start = get_uint64(buffer, offset);
+    ranges[i].end = get_uint64(buffer, offset);
+  }
+  return true;
+}
+uint32_t SignatureMessage::encode(std::span<uint8_t> buffer) const {
+  uint32_t offset = 0;
+  put_uint32(buffer, offset, TYPE);
+  put_uint64(buffer, offset, transfer_id);
+  put_uint64(buffer, offset, base_size);
+  put_uint32(buffer, offset, block_size);
+  put_uint64(buffer, offset, first_block);
+  put_uint32(buffer, offset, block_count);
+  for (const BlockSignature &block : get_blocks()) {
+    put_uint32(buffer, offset, block.weak);
+    for (uint8_t byte : block.strong)
+      buffer[offset++] = byte;
+  }
+  return offset;
+}
+bool SignatureMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < SIGNATURE_HEADER_SIZE)
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  transfer_id = get_uint64(buffer, offset);
+  base_size = get_uint64(buffer, offset);
+  block_size = get_uint32(buffer, offset);
+  first_block = get_uint64(buffer, offset);
+  block_count = get_uint32(buffer, offset);
+  if (block_count > MAX_SIGNATURE_BLOCKS ||
+      buffer.size() - offset < block_count * SIGNATURE_ENTRY_SIZE)
+    return false;
+  for (uint32_t i = 0; i < block_count; ++i) {
+    blocks[i].weak = get_uint32(buffer, offset);
+    for (uint8_t &byte : blocks[i].strong)
+      byte = buffer[offset++];
+  }
+  return true;
+}
+uint32_t DeltaMessage::encode(std::span<uint8_t> buffer) const {
+  uint32_t offset = 0;
+  put_uint32(buffer, offset, TYPE);
+  put_uint64(buffer, offset, transfer_id);
+  put_uint32(buffer, offset, last);
+  put_uint32(buffer, offset, copy_count);
+  for (const DeltaCopy &copy : get_copies()) {
+    put_uint64(buffer, offset, copy.offset);
+    put_uint64(buffer, offset, copy.base_offset);
+    put_uint64(buffer, offset, copy.length);
+  }
+  return offset;
+}
+bool DeltaMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < DELTA_HEADER_SIZE)
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  transfer_id = get_uint64(buffer, offset);
+  last = get_uint32(buffer, offset) != 0;
+  copy_count = get_uint32(buffer, offset);
+  if (copy_count > MAX_DELTA_COPIES ||
+      buffer.size() - offset < copy_count * DELTA_COPY_SIZE)
+    return false;
+  for (uint32_t i = 0; i < copy_count; ++i) {
+    copies[i].offset = get_uint64(buffer, offset);
+    copies[i].base_offset = get_uint64(buffer, offset);
+    copies[i].length = get_uint64(buffer, offset);
+  }
+  return true;
+}
+uint32_t ChunkMessage::encode(std::span<uint8_t> buffer) const {
+  uint32_t offset = 0;
+  put_uint32(buffer, offset, TYPE);
+  put_uint64(buffer, offset, transfer_id);
+  put_uint32(buffer, offset, last);
+  put_uint32(buffer, offset, chunk_count);
+  for (const ChunkHash &chunk : get_chunks()) {
+    put_uint32(buffer, offset, chunk.length);
+    for (uint8_t byte : chunk.strong)
+      buffer[offset++] = byte;
+  }
+  return offset;
+}
+bool ChunkMessage::decode(std::span<const uint8_t> buffer) {
+  if (buffer.size() < CHUNK_HEADER_SIZE)
+    return false;
+  uint32_t offset = sizeof(uint32_t);
+  transfer_id = get_uint64(buffer, offset);
+  last = get_uint32(buffer, offset) != 0;
+  chunk_count = get_uint32(buffer, offset);
+  if (chunk_count > MAX_CHUNK_ENTRIES ||
+      buffer.size() - offset < chunk_count * CHUNK_ENTRY_SIZE)
+    return false;
+  for (uint32_t i = 0; i < chunk_count; ++i) {
+    chunks[i].length = get_uint32(buffer, offset);
+    for (uint8_t &byte : chunks[i].strong)
+      byte = buffer[offset++];
+  }
+  return true;
 }
 } // namespace MESG
\ No newline at end of file
@@ -1,90 +1,564 @@
 #pragma once
 
+#include "typedef.hpp"
+
+#include <algorithm>
+#include <array>
 #include <cstdint>
+#include <span>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace MESG {
 enum MESSAGE_TYPE : uint32_t {
-  MESSAGE_TYPE_START,   // Info about file.
-  MESSAGE_TYPE_FILE,    // Binary file data.
-  MESSAGE_TYPE_CONFIRM, // Confirm receiving packet.
-  MESSAGE_TYPE_FINAL,   // Final message.
+  MESSAGE_TYPE_START,     // Manifest of the files of an upload.
+  MESSAGE_TYPE_FILE,      // Binary file data.
+  MESSAGE_TYPE_CONFIRM,   // Verdict on an upload, after its final message.
+  MESSAGE_TYPE_FINAL,     // Final message.
+  MESSAGE_TYPE_ACK,       // Cumulative + selective ack of file packets.
+  MESSAGE_TYPE_ACCEPT,    // Transfer ID and data stripes of a started upload.
+  MESSAGE_TYPE_RESUME,    // Packets the server already holds.
+  MESSAGE_TYPE_SIGNATURE, // Block checksums of the server's old version.
+  MESSAGE_TYPE_DELTA,     // Blocks of the old version found in the new one.
+  MESSAGE_TYPE_NAK,       // A file packet arrived corrupted.
+  MESSAGE_TYPE_CHUNK,     // Content-defined chunks of a dedup upload.
+  MESSAGE_TYPE_PARITY,    // FEC parity of a group of file packets.
+  MESSAGE_TYPE_PROBE,     // Path MTU probe and its answer.
 };
 enum MESSAGE_STATUS : uint32_t {
   MESSAGE_SUCCESS,
   MESSAGE_FAILURE,
 };
 
-void serialize_uint32(std::vector<uint8_t> &buffer, uint32_t &offset,
-                      uint32_t number);
-void serialize_str(std::vector<uint8_t> &buffer, uint32_t &offset,
-                   const std::vector<uint8_t> &str);
-uint32_t deserialize_uint32(const std::vector<uint8_t> &buffer,
-                            uint32_t &offset);
-std::vector<uint8_t> deserialize_str(const std::vector<uint8_t> &buffer,
-                                     uint32_t &offset, uint32_t length);
+// Type and transfer ID, first in every message. The ID names the upload
+// on a server serving many; 0 until the server assigned one. File packets
+// and acks carry the ID of their stripe instead, see AcceptMessage.
+constexpr uint32_t MESSAGE_HEADER_SIZE = 12;
+constexpr uint32_t CONFIRM_MESSAGE_SIZE = 24; // Serialized ConfirmMessage.
+constexpr uint32_t ACCEPT_HEADER_SIZE = 20;
+constexpr uint32_t ACCEPT_STRIPE_SIZE = 28; // Per stripe in AcceptMessage.
+constexpr uint32_t MAX_STRIPES = 32;
+constexpr uint32_t MAX_MANIFEST_FILES = 128;
+// Largest control message, read in one piece by the server.
+constexpr uint32_t MAX_CONTROL_MESSAGE_SIZE = 8192;
+constexpr uint32_t MAX_SACK_RANGES = 64;
+constexpr uint32_t RESUME_HEADER_SIZE = 16;
+constexpr uint32_t MAX_RESUME_RANGES = 256;
+constexpr uint32_t STRONG_CHECKSUM_SIZE = 16; // Truncated SHA-256.
+constexpr uint32_t SIGNATURE_HEADER_SIZE = 36;
+constexpr uint32_t SIGNATURE_ENTRY_SIZE = 4 + STRONG_CHECKSUM_SIZE;
+constexpr uint32_t MAX_SIGNATURE_BLOCKS = 400;
+constexpr uint32_t DELTA_HEADER_SIZE = 20;
+constexpr uint32_t DELTA_COPY_SIZE = 24;
+constexpr uint32_t MAX_DELTA_COPIES = 256;
+constexpr uint32_t CHUNK_HEADER_SIZE = 20;
+constexpr uint32_t CHUNK_ENTRY_SIZE = 4 + STRONG_CHECKSUM_SIZE;
+constexpr uint32_t MAX_CHUNK_ENTRIES = 400;
+
+// StartMessage flags.
+constexpr uint32_t START_FLAG_DELTA = 1; // Send only what the server lacks.
+constexpr uint32_t START_FLAG_DEDUP = 2; // Skip chunks the server stores.
+
+// Span-based codec: writes into caller-owned buffers, reads without
+// copying. The caller guarantees the buffer is large enough.
+void put_uint32(std::span<uint8_t> buffer, uint32_t &offset, uint32_t number);
+void put_uint64(std::span<uint8_t> buffer, uint32_t &offset, uint64_t number);
+uint32_t get_uint32(std::span<const uint8_t> buffer, uint32_t &offset);
+uint64_t get_uint64(std::span<const uint8_t> buffer, uint32_t &offset);
+// Transfer ID of an encoded message without decoding it, 0 if truncated.
+uint64_t peek_transfer_id(std::span<const uint8_t> buffer);
+
+// Every message has a TYPE, encoded_size(), encode() into a buffer of at
+// least encoded_size() bytes and decode(), which returns false for
+// truncated or malformed input. Messages are plain values meant to live
+// on the stack; dispatch() below picks the type at compile time.
+
+// How the payload of a file packet is stored.
+enum FILE_ENCODING : uint32_t {
+  FILE_ENCODING_RAW,
+  FILE_ENCODING_LZ, // LZ::compress, always smaller than the chunk.
+};
+
+// File packet. The header is encoded into a reusable buffer and sent
+// together with the payload in one scatter-gather datagram; on receipt
+// data is a view into the receive buffer.
+constexpr uint32_t FILE_HEADER_SIZE = 36;
+struct FileMessage {
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_FILE;
+  uint64_t transfer_id;
+  uint64_t packet_number;
+  uint32_t timestamp; // Sender clock, microseconds. Echoed in acks.
+  uint32_t checksum;  // CRC-32C of the chunk, checked before it is written.
+  FILE_ENCODING encoding = FILE_ENCODING_RAW;
+  std::span<const uint8_t> data;
+
+  bool decode(std::span<const uint8_t> buffer);
+};
+uint32_t encode_file_header(std::span<uint8_t> buffer,
+                            const FileMessage &message);
+
+// Parity chunk of a FEC group: packets [first_packet, first_packet +
+// group_size) of a stripe, each zero padded to the chunk size, see FEC.
+// Sent once after the group's data, encoded and received like file
+// packets.
+constexpr uint32_t PARITY_HEADER_SIZE = 36;
+struct ParityMessage {
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_PARITY;
+  uint64_t transfer_id; // The stripe's.
+  uint64_t first_packet;
+  uint32_t group_size;
+  uint32_t parity_index;
+  uint32_t checksum; // CRC-32C of data.
+  std::span<const uint8_t> data;
 
-MESSAGE_TYPE get_type(std::vector<uint8_t> raw_data);
+  bool decode(std::span<const uint8_t> buffer);
+};
+uint32_t encode_parity_header(std::span<uint8_t> buffer,
+                              const ParityMessage &message);
 
-class BaseMessage {
-protected:
-  MESSAGE_TYPE type;
+// One file of an upload. The name is relative, '/' separated.
+struct ManifestEntry {
+  std::string name;
+  uint64_t size;
+  // When the client's file was last written, in its own clock; tells its
+  // versions apart for resuming, 0 if unknown.
+  uint64_t modified = 0;
+};
+// Starts an upload of up to MAX_MANIFEST_FILES files, sent as one stream
+// in manifest order. Larger sets go as several uploads in a row over the
+// same connection.
+class StartMessage {
+  uint64_t transfer_id = 0;
+  uint32_t stripe_count = 1; // Parallel flows the client asks for.
+  uint32_t flags = 0;        // START_FLAG_*.
+  // File data per packet, from MIN_CHUNK_SIZE to MAX_CHUNK_SIZE; the
+  // server refuses others.
+  uint32_t chunk_size = BUFFER_MESSAGE_SIZE;
+  std::vector<ManifestEntry> files;
 
 public:
-  virtual ~BaseMessage() = default;
-  virtual std::vector<uint8_t> serialize_message() const = 0;
-  virtual void deserialize_message(const std::vector<uint8_t> &buffer) = 0;
-  MESSAGE_TYPE get_type() const noexcept { return type; }
-  void set_type(MESSAGE_TYPE m_type) noexcept { type = m_type; }
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_START;
+  uint32_t encoded_size() const noexcept;
+  uint32_t encode(std::span<uint8_t> buffer) const;
+  bool decode(std::span<const uint8_t> buffer);
+  uint64_t get_transfer_id() const noexcept { return transfer_id; }
+  void set_transfer_id(uint64_t new_transfer_id) noexcept {
+    transfer_id = new_transfer_id;
+  }
+  uint32_t get_stripe_count() const noexcept { return stripe_count; }
+  void set_stripe_count(uint32_t new_stripe_count) noexcept {
+    stripe_count = new_stripe_count;
+  }
+  uint32_t get_flags() const noexcept { return flags; }
+  void set_flags(uint32_t new_flags) noexcept { flags = new_flags; }
+  uint32_t get_chunk_size() const noexcept { return chunk_size; }
+  void set_chunk_size(uint32_t new_chunk_size) noexcept {
+    chunk_size = new_chunk_size;
+  }
+  const std::vector<ManifestEntry> &get_files() const noexcept {
+    return files;
+  }
+  // False if the file would not fit the message.
+  bool add_file(const std::string &name, uint64_t size,
+                uint64_t modified = 0);
+  uint64_t get_file_size() const noexcept; // Of the whole stream.
 };
-class FileMessage : public BaseMessage {
-  uint32_t packet_number;
-  uint32_t data_length;
+class ConfirmMessage {
+  uint64_t transfer_id = 0;
+  uint64_t packet_number = 0; // Packets of the upload the server has.
+  MESSAGE_STATUS status = MESSAGE_SUCCESS;
 
 public:
-  std::vector<uint8_t> data;
-  std::vector<uint8_t> serialize_message() const override;
-  void deserialize_message(const std::vector<uint8_t> &buffer) override;
-  uint32_t get_packet_number() const noexcept { return packet_number; }
-  void set_packet_number(uint32_t new_packet_number) noexcept {
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_CONFIRM;
+  uint32_t encoded_size() const noexcept { return CONFIRM_MESSAGE_SIZE; }
+  uint32_t encode(std::span<uint8_t> buffer) const;
+  bool decode(std::span<const uint8_t> buffer);
+  uint64_t get_transfer_id() const noexcept { return transfer_id; }
+  void set_transfer_id(uint64_t new_transfer_id) noexcept {
+    transfer_id = new_transfer_id;
+  }
+  uint64_t get_packet_number() const noexcept { return packet_number; }
+  void set_packet_number(uint64_t new_packet_number) noexcept {
     packet_number = new_packet_number;
   }
+  MESSAGE_STATUS get_message_status() const noexcept { return status; }
+  void set_message_status(MESSAGE_STATUS new_status) { status = new_status; }
 };
-class StartMessage : public BaseMessage {
-  uint32_t port;
-  uint32_t name_length;
-  std::vector<uint8_t> filename;
+class FinalMessage {
+  uint64_t transfer_id = 0;
+  uint32_t crc_code = 0;
 
 public:
-  std::vector<uint8_t> serialize_message() const override;
-  void deserialize_message(const std::vector<uint8_t> &buffer) override;
-  uint32_t get_port() const noexcept { return port; }
-  void set_port(uint32_t new_port) noexcept { port = new_port; }
-  std::string get_filename() const;
-  void set_filename(const std::string &name);
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_FINAL;
+  uint32_t encoded_size() const noexcept { return 16; }
+  uint32_t encode(std::span<uint8_t> buffer) const;
+  bool decode(std::span<const uint8_t> buffer);
+  uint64_t get_transfer_id() const noexcept { return transfer_id; }
+  void set_transfer_id(uint64_t new_transfer_id) noexcept {
+    transfer_id = new_transfer_id;
+  }
+  uint32_t get_crc_code() const noexcept { return crc_code; }
+  void set_crc_code(uint32_t new_crc_code) noexcept { crc_code = new_crc_code; }
 };
-class ConfirmMessage : public BaseMessage {
-  uint32_t packet_number;
-  MESSAGE_STATUS status;
+// Packets [first_packet, end_packet) of a file, sent as an own flow to
+// its own server port and acked under its own ID.
+struct Stripe {
+  uint64_t stripe_id;
+  uint32_t port;
+  uint64_t first_packet;
+  uint64_t end_packet;
+};
+// Server's answer to StartMessage: the stripes the file is split into,
+// at most as many as were asked for.
+class AcceptMessage {
+  uint64_t transfer_id = 0;
+  MESSAGE_STATUS status = MESSAGE_SUCCESS;
+  uint32_t stripe_count = 0;
+  std::array<Stripe, MAX_STRIPES> stripes;
 
 public:
-  std::vector<uint8_t> serialize_message() const override;
-  void deserialize_message(const std::vector<uint8_t> &buffer) override;
-  uint32_t get_packet_number() const noexcept { return packet_number; }
-  void set_packet_number(uint32_t new_packet_number) noexcept {
-    packet_number = new_packet_number;
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_ACCEPT;
+  uint32_t encoded_size() const noexcept {
+    return ACCEPT_HEADER_SIZE + stripe_count * ACCEPT_STRIPE_SIZE;
+  }
+  uint32_t encode(std::span<uint8_t> buffer) const;
+  bool decode(std::span<const uint8_t> buffer);
+  uint64_t get_transfer_id() const noexcept { return transfer_id; }
+  void set_transfer_id(uint64_t new_transfer_id) noexcept {
+    transfer_id = new_transfer_id;
   }
   MESSAGE_STATUS get_message_status() const noexcept { return status; }
   void set_message_status(MESSAGE_STATUS new_status) { status = new_status; }
+  std::span<const Stripe> get_stripes() const noexcept {
+    return std::span(stripes.data(), stripe_count);
+  }
+  bool add_stripe(const Stripe &stripe) noexcept {
+    if (stripe_count == MAX_STRIPES)
+      return false;
+    stripes[stripe_count++] = stripe;
+    return true;
+  }
 };
-class FinalMessage : public BaseMessage {
-  uint32_t crc_code;
+// Asks for one file packet again at once: it failed its checksum, which
+// says nothing about congestion.
+constexpr uint32_t NAK_MESSAGE_SIZE = 20;
+class NakMessage {
+  uint64_t transfer_id = 0; // Of the stripe, like acks.
+  uint64_t packet_number = 0;
 
 public:
-  std::vector<uint8_t> serialize_message() const override;
-  void deserialize_message(const std::vector<uint8_t> &buffer) override;
-  uint32_t get_crc_code() const noexcept { return crc_code; }
-  void set_crc_code(uint32_t new_crc_code) noexcept { crc_code = new_crc_code; }
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_NAK;
+  uint32_t encoded_size() const noexcept { return NAK_MESSAGE_SIZE; }
+  uint32_t encode(std::span<uint8_t> buffer) const;
+  bool decode(std::span<const uint8_t> buffer);
+  uint64_t get_transfer_id() const noexcept { return transfer_id; }
+  void set_transfer_id(uint64_t new_transfer_id) noexcept {
+    transfer_id = new_transfer_id;
+  }
+  uint64_t get_packet_number() const noexcept { return packet_number; }
+  void set_packet_number(uint64_t new_packet_number) noexcept {
+    packet_number = new_packet_number;
+  }
 };
-} // namespace MESG
\ No newline at end of file
+// Path MTU probe, sent over UDP to the server's TCP port number with the
+// don't-fragment bit and padded to size. The server answers every probe
+// that arrives with its size, unpadded.
+constexpr uint32_t PROBE_HEADER_SIZE = 12;
+constexpr uint32_t MAX_PROBE_SIZE = 65507; // Largest UDP payload.
+class ProbeMessage {
+  uint32_t size = PROBE_HEADER_SIZE; // Of the probe datagram.
+  uint32_t answer = 0;               // 1 from the server.
+
+public:
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_PROBE;
+  uint32_t encoded_size() const noexcept {
+    return answer ? PROBE_HEADER_SIZE : size;
+  }
+  uint32_t encode(std::span<uint8_t> buffer) const;
+  bool decode(std::span<const uint8_t> buffer);
+  uint32_t get_size() const noexcept { return size; }
+  void set_size(uint32_t new_size) noexcept {
+    size = std::max(new_size, PROBE_HEADER_SIZE);
+  }
+  bool is_answer() const noexcept { return answer != 0; }
+  void set_answer(bool new_answer) noexcept { answer = new_answer; }
+};
+// Range of received packets [start, end).
+struct SackRange {
+  uint64_t start;
+  uint64_t end;
+};
+constexpr uint32_t ACK_HEADER_SIZE = 36;
+constexpr uint32_t MAX_ACK_MESSAGE_SIZE =
+    ACK_HEADER_SIZE + MAX_SACK_RANGES * 16;
+class AckMessage {
+  uint64_t transfer_id = 0;
+  uint64_t cumulative = 0;     // Every packet below this number is received.
+  uint32_t echo_timestamp = 0; // Timestamp of the newest file packet.
+  uint32_t ack_delay = 0;      // Microseconds it was held before this ack.
+  uint32_t recovered = 0;      // Packets rebuilt from parity so far, wraps.
+  uint32_t range_count = 0;
+  std::array<SackRange, MAX_SACK_RANGES> ranges; // Above cumulative.
+
+public:
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_ACK;
+  uint32_t encoded_size() const noexcept {
+    return ACK_HEADER_SIZE + range_count * 16;
+  }
+  uint32_t encode(std::span<uint8_t> buffer) const;
+  bool decode(std::span<const uint8_t> buffer);
+  uint64_t get_transfer_id() const noexcept { return transfer_id; }
+  void set_transfer_id(uint64_t new_transfer_id) noexcept {
+    transfer_id = new_transfer_id;
+  }
+  uint64_t get_cumulative() const noexcept { return cumulative; }
+  void set_cumulative(uint64_t new_cumulative) noexcept {
+    cumulative = new_cumulative;
+  }
+  uint32_t get_echo_timestamp() const noexcept { return echo_timestamp; }
+  void set_echo_timestamp(uint32_t new_timestamp) noexcept {
+    echo_timestamp = new_timestamp;
+  }
+  uint32_t get_ack_delay() const noexcept { return ack_delay; }
+  void set_ack_delay(uint32_t new_delay) noexcept { ack_delay = new_delay; }
+  uint32_t get_recovered() const noexcept { return recovered; }
+  void set_recovered(uint32_t new_recovered) noexcept {
+    recovered = new_recovered;
+  }
+  std::span<const SackRange> get_ranges() const noexcept {
+    return std::span(ranges.data(), range_count);
+  }
+  bool add_range(uint64_t start, uint64_t end) noexcept {
+    if (range_count == MAX_SACK_RANGES)
+      return false;
+    ranges[range_count++] = {start, end};
+    return true;
+  }
+};
+
+// Sent right before the AcceptMessage when the server already holds part
+// of the upload: from an interrupted attempt, or copied from its old
+// version in a delta upload. Packets in the ranges are on its disk and
+// must not be sent again. More ranges than fit go as several messages.
+class ResumeMessage {
+  uint64_t transfer_id = 0;
+  uint32_t range_count = 0;
+  std::array<SackRange, MAX_RESUME_RANGES> ranges;
+
+public:
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_RESUME;
+  uint32_t encoded_size() const noexcept {
+    return RESUME_HEADER_SIZE + range_count * 16;
+  }
+  uint32_t encode(std::span<uint8_t> buffer) const;
+  bool decode(std::span<const uint8_t> buffer);
+  uint64_t get_transfer_id() const noexcept { return transfer_id; }
+  void set_transfer_id(uint64_t new_transfer_id) noexcept {
+    transfer_id = new_transfer_id;
+  }
+  std::span<const SackRange> get_ranges() const noexcept {
+    return std::span(ranges.data(), range_count);
+  }
+  bool add_range(uint64_t start, uint64_t end) noexcept {
+    if (range_count == MAX_RESUME_RANGES)
+      return false;
+    ranges[range_count++] = {start, end};
+    return true;
+  }
+};
+
+// Delta uploads (START_FLAG_DELTA) in the manner of rsync. The server
+// splits its old version of the manifest's files, seen as one stream
+// like the new one, into blocks and sends their checksums; blocks past
+// the last full one are not signed.
+struct BlockSignature {
+  uint32_t weak; // Rolling checksum, see DLT::RollingChecksum.
+  std::array<uint8_t, STRONG_CHECKSUM_SIZE> strong;
+};
+// Signatures of blocks [first_block, first_block + count), in order. The
+// last message is the one reaching base_size / block_size.
+class SignatureMessage {
+  uint64_t transfer_id = 0;
+  uint64_t base_size = 0; // Of the old stream.
+  uint32_t block_size = 0;
+  uint64_t first_block = 0;
+  uint32_t block_count = 0;
+  std::array<BlockSignature, MAX_SIGNATURE_BLOCKS> blocks;
+
+public:
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_SIGNATURE;
+  uint32_t encoded_size() const noexcept {
+    return SIGNATURE_HEADER_SIZE + block_count * SIGNATURE_ENTRY_SIZE;
+  }
+  uint32_t encode(std::span<uint8_t> buffer) const;
+  bool decode(std::span<const uint8_t> buffer);
+  uint64_t get_transfer_id() const noexcept { return transfer_id; }
+  void set_transfer_id(uint64_t new_transfer_id) noexcept {
+    transfer_id = new_transfer_id;
+  }
+  uint64_t get_base_size() const noexcept { return base_size; }
+  void set_base_size(uint64_t new_size) noexcept { base_size = new_size; }
+  uint32_t get_block_size() const noexcept { return block_size; }
+  void set_block_size(uint32_t new_size) noexcept { block_size = new_size; }
+  uint64_t get_first_block() const noexcept { return first_block; }
+  void set_first_block(uint64_t new_first) noexcept { first_block = new_first; }
+  std::span<const BlockSignature> get_blocks() const noexcept {
+    return std::span(blocks.data(), block_count);
+  }
+  bool add_block(const BlockSignature &block) noexcept {
+    if (block_count == MAX_SIGNATURE_BLOCKS)
+      return false;
+    blocks[block_count++] = block;
+    return true;
+  }
+};
+// Bytes [offset, offset + length) of the new stream are bytes
+// [base_offset, base_offset + length) of the old one.
+struct DeltaCopy {
+  uint64_t offset;
+  uint64_t base_offset;
+  uint64_t length;
+};
+// The client's answer to the signatures, in as many messages as needed;
+// the server accepts the upload after the last one. What no copy covers
+// is sent as file packets.
+class DeltaMessage {
+  uint64_t transfer_id = 0;
+  bool last = false;
+  uint32_t copy_count = 0;
+  std::array<DeltaCopy, MAX_DELTA_COPIES> copies;
+
+public:
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_DELTA;
+  uint32_t encoded_size() const noexcept {
+    return DELTA_HEADER_SIZE + copy_count * DELTA_COPY_SIZE;
+  }
+  uint32_t encode(std::span<uint8_t> buffer) const;
+  bool decode(std::span<const uint8_t> buffer);
+  uint64_t get_transfer_id() const noexcept { return transfer_id; }
+  void set_transfer_id(uint64_t new_transfer_id) noexcept {
+    transfer_id = new_transfer_id;
+  }
+  bool is_last() const noexcept { return last; }
+  void set_last(bool new_last) noexcept { last = new_last; }
+  std::span<const DeltaCopy> get_copies() const noexcept {
+    return std::span(copies.data(), copy_count);
+  }
+  bool add_copy(const DeltaCopy &copy) noexcept {
+    if (copy_count == MAX_DELTA_COPIES)
+      return false;
+    copies[copy_count++] = copy;
+    return true;
+  }
+};
+
+// Dedup uploads (START_FLAG_DEDUP). The client cuts the stream where its
+// content says, so data shifted by an insert still yields the same
+// chunks, and sends their hashes after the start message. The server
+// copies those it stores from earlier uploads; the packets they cover
+// come back as resumed.
+struct ChunkHash {
+  uint32_t length;
+  std::array<uint8_t, STRONG_CHECKSUM_SIZE> strong;
+};
+// Chunks in stream order, each starting where the one before ends. The
+// last message brings them to the size of the stream.
+class ChunkMessage {
+  uint64_t transfer_id = 0;
+  bool last = false;
+  uint32_t chunk_count = 0;
+  std::array<ChunkHash, MAX_CHUNK_ENTRIES> chunks;
+
+public:
+  static constexpr MESSAGE_TYPE TYPE = MESSAGE_TYPE_CHUNK;
+  uint32_t encoded_size() const noexcept {
+    return CHUNK_HEADER_SIZE + chunk_count * CHUNK_ENTRY_SIZE;
+  }
+  uint32_t encode(std::span<uint8_t> buffer) const;
+  bool decode(std::span<const uint8_t> buffer);
+  uint64_t get_transfer_id() const noexcept { return transfer_id; }
+  void set_transfer_id(uint64_t new_transfer_id) noexcept {
+    transfer_id = new_transfer_id;
+  }
+  bool is_last() const noexcept { return last; }
+  void set_last(bool new_last) noexcept { last = new_last; }
+  std::span<const ChunkHash> get_chunks() const noexcept {
+    return std::span(chunks.data(), chunk_count);
+  }
+  bool add_chunk(const ChunkHash &chunk) noexcept {
+    if (chunk_count == MAX_CHUNK_ENTRIES)
+      return false;
+    chunks[chunk_count++] = chunk;
+    return true;
+  }
+};
+
+// Encodes a message into a new buffer.
+template <typename Message>
+std::vector<uint8_t> serialize(const Message &message) {
+  std::vector<uint8_t> result(message.encoded_size());
+  message.encode(result);
+  return result;
+}
+
+// Builds one handler out of lambdas: overloaded{[](const AckMessage &) {}}.
+template <typename... Handlers> struct overloaded : Handlers... {
+  using Handlers::operator()...;
+};
+template <typename... Handlers>
+overloaded(Handlers...) -> overloaded<Handlers...>;
+
+template <typename Message, typename Handler>
+bool decode_and_handle(std::span<const uint8_t> buffer, Handler &handler) {
+  if constexpr (std::is_invocable_v<Handler &, const Message &>) {
+    Message message;
+    if (!message.decode(buffer))
+      return false;
+    handler(message);
+    return true;
+  } else {
+    return false; // This side never receives such messages.
+  }
+}
+
+// Decodes buffer into a stack-resident message of the wire type and calls
+// the handler overload for it. No allocation, virtual call or RTTI.
+// Returns false for unknown, malformed or unhandled messages.
+template <typename Handler>
+bool dispatch(std::span<const uint8_t> buffer, Handler &&handler) {
+  if (buffer.size() < sizeof(uint32_t))
+    return false;
+  uint32_t offset = 0;
+  switch (get_uint32(buffer, offset)) {
+  case MESSAGE_TYPE_START:
+    return decode_and_handle<StartMessage>(buffer, handler);
+  case MESSAGE_TYPE_FILE:
+    return decode_and_handle<FileMessage>(buffer, handler);
+  case MESSAGE_TYPE_CONFIRM:
+    return decode_and_handle<ConfirmMessage>(buffer, handler);
+  case MESSAGE_TYPE_FINAL:
+    return decode_and_handle<FinalMessage>(buffer, handler);
+  case MESSAGE_TYPE_ACK:
+    return decode_and_handle<AckMessage>(buffer, handler);
+  case MESSAGE_TYPE_ACCEPT:
+    return decode_and_handle<AcceptMessage>(buffer, handler);
+  case MESSAGE_TYPE_RESUME:
+    return decode_and_handle<ResumeMessage>(buffer, handler);
+  case MESSAGE_TYPE_SIGNATURE:
+    return decode_and_handle<SignatureMessage>(buffer, handler);
+  case MESSAGE_TYPE_DELTA:
+    return decode_and_handle<DeltaMessage>(buffer, handler);
+  case MESSAGE_TYPE_NAK:
+    return decode_and_handle<NakMessage>(buffer, handler);
+  case MESSAGE_TYPE_CHUNK:
+    return decode_and_handle<ChunkMessage>(buffer, handler);
+  case MESSAGE_TYPE_PARITY:
+    return decode_and_handle<ParityMessage>(buffer, handler);
+  case MESSAGE_TYPE_PROBE:
+    return decode_and_handle<ProbeMessage>(buffer, handler);
+  default:
+    return false;
+  }
+}
+} // namespace MESG
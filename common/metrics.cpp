@@ -0,0 +1,117 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+
+namespace STAT {
+void Histogram::record(uint64_t value) noexcept {
+  buckets[std::bit_width(value)].add();
+  sum.add(value);
+  if (value > max.load(std::memory_order_relaxed))
+    max.store(value, std::memory_order_relaxed);
+}
+
+void Summary::add(const Histogram &histogram) {
+  for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    uint64_t bucket = histogram.buckets[i].get();
+    buckets[i] += bucket;
+    count += bucket;
+  }
+  sum += histogram.sum.get();
+  max = std::max(max, histogram.max.load(std::memory_order_relaxed));
+}
+
+double Summary::get_mean() const noexcept {
+  return count == 0 ? 0 : double(sum) / double(count);
+}
+
+uint64_t Summary::get_quantile(double quantile) const noexcept {
+  uint64_t rank = static_cast<uint64_t>(std::ceil(quantile * count));
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    seen += buckets[i];
+    if (seen >= rank && seen > 0)
+      return std::min(i == 0 ? 0 : (uint64_t(2) << (i - 1)) - 1, max);
+  }
+  return max;
+}
+
+ScopedTimer::~ScopedTimer() {
+  histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count());
+}
+
+void JsonObject::add_name(const char *name) {
+  if (text.size() > 1)
+    text += ',';
+  text += '"';
+  text += name;
+  text += "\":";
+}
+
+void JsonObject::add_number(const char *name, uint64_t value) {
+  add_name(name);
+  text += std::to_string(value);
+}
+
+void JsonObject::add_real(const char *name, double value) {
+  add_name(name);
+  char buffer[32];
+  std::to_chars_result result =
+      std::to_chars(buffer, std::end(buffer), std::isfinite(value) ? value : 0);
+  text.append(buffer, result.ptr);
+}
+
+void JsonObject::add_text(const char *name, const std::string &value) {
+  add_name(name);
+  text += '"';
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      text += '\\';
+      text += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      text += escaped;
+    } else {
+      text += c;
+    }
+  }
+  text += '"';
+}
+
+void JsonObject::add_flag(const char *name, bool value) {
+  add_name(name);
+  text += value ? "true" : "false";
+}
+
+void JsonObject::add_summary(const char *name, const Summary &summary) {
+  JsonObject nested;
+  nested.add_number("count", summary.get_count());
+  nested.add_real("mean", std::round(summary.get_mean() * 10) / 10);
+  nested.add_number("p50", summary.get_quantile(0.5));
+  nested.add_number("p90", summary.get_quantile(0.9));
+  nested.add_number("p99", summary.get_quantile(0.99));
+  nested.add_number("max", summary.get_max());
+  add_name(name);
+  text += nested.finish();
+}
+
+bool append_line(const std::string &path, const std::string &line) {
+  FILE *file = std::fopen(path.c_str(), "a");
+  if (file == nullptr)
+    return false;
+  bool written = std::fputs((line + "\n").c_str(), file) >= 0;
+  return std::fclose(file) == 0 && written;
+}
+
+double get_megabits(uint64_t bytes, std::chrono::steady_clock::duration time) {
+  double seconds = std::chrono::duration<double>(time).count();
+  return seconds > 0 ? bytes * 8 / seconds / 1e6 : 0;
+}
+} // namespace STAT
\ No newline at end of file
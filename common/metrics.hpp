@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Counters and histograms an upload fills in on its hot paths while other
+// threads read them for progress lines and the report at its end. Each
+// has a single writing thread, so adding is a plain load and store, no
+// locked instruction; readers see recent, not necessarily exact, values.
+namespace STAT {
+class Counter {
+  std::atomic<uint64_t> value = 0;
+
+public:
+  void add(uint64_t amount = 1) noexcept {
+    value.store(value.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+  }
+  uint64_t get() const noexcept {
+    return value.load(std::memory_order_relaxed);
+  }
+};
+
+// Bucket i counts the values of bit width i: 0, 1, 2-3, 4-7 and so on.
+constexpr uint32_t HISTOGRAM_BUCKETS = 65;
+
+class Histogram {
+  std::array<Counter, HISTOGRAM_BUCKETS> buckets;
+  Counter sum;
+  std::atomic<uint64_t> max = 0;
+  friend class Summary;
+
+public:
+  void record(uint64_t value) noexcept;
+};
+
+// Histograms added up as they were when read.
+class Summary {
+  std::array<uint64_t, HISTOGRAM_BUCKETS> buckets = {};
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+
+public:
+  void add(const Histogram &histogram);
+  uint64_t get_count() const noexcept { return count; }
+  uint64_t get_max() const noexcept { return max; }
+  double get_mean() const noexcept;
+  // Upper end of the bucket the quantile falls in, at most the maximum.
+  uint64_t get_quantile(double quantile) const noexcept;
+};
+
+// Records its lifetime into a histogram, in nanoseconds.
+class ScopedTimer {
+  Histogram &histogram;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+public:
+  explicit ScopedTimer(Histogram &histogram) : histogram(histogram) {}
+  ~ScopedTimer();
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+};
+
+// A flat JSON object on one line; a summary becomes a nested object of
+// count, mean, p50, p90, p99 and max.
+class JsonObject {
+  std::string text = "{";
+  void add_name(const char *name);
+
+public:
+  void add_number(const char *name, uint64_t value);
+  void add_real(const char *name, double value);
+  void add_text(const char *name, const std::string &value);
+  void add_flag(const char *name, bool value);
+  void add_summary(const char *name, const Summary &summary);
+  std::string finish() const { return text + "}"; }
+};
+
+// Appends the line to the file, creating it; false on error.
+bool append_line(const std::string &path, const std::string &line);
+// Megabits per second, 0 for no time.
+double get_megabits(uint64_t bytes, std::chrono::steady_clock::duration time);
+} // namespace STAT
\ No newline at end of file
@@ -0,0 +1,288 @@
+#include "reactor.hpp"
+#include "log.hpp"
+#include "socket.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+namespace {
+constexpr int MAX_EVENTS = 64;
+} // namespace
+
+namespace SCK {
+#ifdef __linux__
+namespace {
+uint32_t to_epoll(uint32_t events) {
+  uint32_t result = 0;
+  if (events & EVENT_READ)
+    result |= EPOLLIN;
+  if (events & EVENT_WRITE)
+    result |= EPOLLOUT;
+  return result;
+}
+} // namespace
+
+Reactor::Reactor() {
+  poll_fd = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (poll_fd == -1 || wake_fd == -1 || timer_fd == -1) {
+    LOG::error("Failed to create an event loop. {}", last_error());
+    return;
+  }
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wake_fd;
+  epoll_ctl(poll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+  event.data.fd = timer_fd;
+  epoll_ctl(poll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+}
+
+Reactor::~Reactor() {
+  for (int fd : {poll_fd, wake_fd, timer_fd})
+    if (fd != -1)
+      close(fd);
+}
+
+bool Reactor::add(int fd, uint32_t events, Handler handler) {
+  struct epoll_event event = {};
+  event.events = to_epoll(events);
+  event.data.fd = fd;
+  if (epoll_ctl(poll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    return false;
+  watches[fd] = {events, std::make_shared<Handler>(std::move(handler))};
+  return true;
+}
+
+bool Reactor::modify(int fd, uint32_t events) {
+  auto watch = watches.find(fd);
+  if (watch == watches.end())
+    return false;
+  if (watch->second.events == events)
+    return true;
+  struct epoll_event event = {};
+  event.events = to_epoll(events);
+  event.data.fd = fd;
+  if (epoll_ctl(poll_fd, EPOLL_CTL_MOD, fd, &event) < 0)
+    return false;
+  watch->second.events = events;
+  return true;
+}
+
+void Reactor::remove(int fd) {
+  if (watches.erase(fd))
+    epoll_ctl(poll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void Reactor::wake() {
+  uint64_t one = 1;
+  [[maybe_unused]] ssize_t result = write(wake_fd, &one, sizeof(one));
+}
+
+void Reactor::drain_wake() {
+  uint64_t count = 0;
+  [[maybe_unused]] ssize_t result = read(wake_fd, &count, sizeof(count));
+}
+
+void Reactor::wait_events() {
+  // timerfd gives the loop sub-millisecond timer resolution.
+  Clock::time_point earliest =
+      timers.empty() ? Clock::time_point::max() : timers.begin()->first.first;
+  if (earliest != armed_deadline) {
+    struct itimerspec spec = {};
+    if (earliest != Clock::time_point::max()) {
+      auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             earliest.time_since_epoch())
+                             .count();
+      since_epoch = std::max<int64_t>(since_epoch, 1); // 0 would disarm.
+      spec.it_value.tv_sec = since_epoch / 1000000000;
+      spec.it_value.tv_nsec = since_epoch % 1000000000;
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    armed_deadline = earliest;
+  }
+  struct epoll_event events[MAX_EVENTS];
+  int count = epoll_wait(poll_fd, events, MAX_EVENTS, -1);
+  for (int i = 0; i < count; ++i) {
+    int fd = events[i].data.fd;
+    if (fd == wake_fd) {
+      drain_wake();
+    } else if (fd == timer_fd) {
+      uint64_t expirations = 0;
+      [[maybe_unused]] ssize_t result =
+          read(timer_fd, &expirations, sizeof(expirations));
+      armed_deadline = Clock::time_point::max();
+    } else {
+      uint32_t ready = 0;
+      if (events[i].events & EPOLLIN)
+        ready |= EVENT_READ;
+      if (events[i].events & EPOLLOUT)
+        ready |= EVENT_WRITE;
+      if (events[i].events & (EPOLLERR | EPOLLHUP))
+        ready |= EVENT_ERROR;
+      dispatch(fd, ready);
+    }
+  }
+}
+#else
+// Portable backend: poll()/WSAPoll, woken through a loopback UDP socket.
+Reactor::Reactor() {
+  poll_fd = 0;
+  wake_fd = static_cast<int>(socket(AF_INET, SOCK_DGRAM, 0));
+  struct sockaddr_in address = make_address("127.0.0.1", 0);
+  addr_length_t length = sizeof(address);
+  if (wake_fd < 0 ||
+      bind(wake_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      getsockname(wake_fd, (struct sockaddr *)&address, &length) < 0 ||
+      connect(wake_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      !set_nonblocking(wake_fd)) {
+    LOG::error("Failed to create an event loop. {}", last_error());
+    wake_fd = -1;
+  }
+}
+
+Reactor::~Reactor() {
+  if (wake_fd != -1)
+    close_socket(wake_fd);
+}
+
+bool Reactor::add(int fd, uint32_t events, Handler handler) {
+  watches[fd] = {events, std::make_shared<Handler>(std::move(handler))};
+  return true;
+}
+
+bool Reactor::modify(int fd, uint32_t events) {
+  auto watch = watches.find(fd);
+  if (watch == watches.end())
+    return false;
+  watch->second.events = events;
+  return true;
+}
+
+void Reactor::remove(int fd) { watches.erase(fd); }
+
+void Reactor::wake() {
+  char byte = 0;
+  send(wake_fd, &byte, 1, 0);
+}
+
+void Reactor::drain_wake() {
+  char buffer[64];
+  while (recv(wake_fd, buffer, sizeof(buffer), 0) > 0) {
+  }
+}
+
+void Reactor::wait_events() {
+  std::vector<struct pollfd> fds;
+  fds.push_back({static_cast<decltype(pollfd::fd)>(wake_fd), POLLIN, 0});
+  for (const auto &[fd, watch] : watches) {
+    short events = 0;
+    if (watch.events & EVENT_READ)
+      events |= POLLIN;
+    if (watch.events & EVENT_WRITE)
+      events |= POLLOUT;
+    fds.push_back({static_cast<decltype(pollfd::fd)>(fd), events, 0});
+  }
+  int timeout = -1;
+  if (!timers.empty()) {
+    auto left = timers.begin()->first.first - Clock::now();
+    timeout = static_cast<int>(std::max<int64_t>(
+        0, std::chrono::ceil<std::chrono::milliseconds>(left).count()));
+  }
+  if (poll(fds.data(), static_cast<unsigned long>(fds.size()), timeout) <= 0)
+    return;
+  if (fds[0].revents)
+    drain_wake();
+  for (size_t i = 1; i < fds.size(); ++i) {
+    uint32_t ready = 0;
+    if (fds[i].revents & POLLIN)
+      ready |= EVENT_READ;
+    if (fds[i].revents & POLLOUT)
+      ready |= EVENT_WRITE;
+    if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+      ready |= EVENT_ERROR;
+    if (ready)
+      dispatch(static_cast<int>(fds[i].fd), ready);
+  }
+}
+#endif
+
+void Reactor::dispatch(int fd, uint32_t events) {
+  auto watch = watches.find(fd);
+  if (watch == watches.end())
+    return; // Removed by an earlier handler in this batch.
+  std::shared_ptr<Handler> handler = watch->second.handler;
+  (*handler)(events);
+}
+
+uint64_t Reactor::add_timer(Clock::time_point deadline, Task task) {
+  uint64_t id = next_timer_id++;
+  timers.emplace(std::make_pair(deadline, id), std::move(task));
+  timer_deadlines[id] = deadline;
+  return id;
+}
+
+void Reactor::cancel_timer(uint64_t id) {
+  auto deadline = timer_deadlines.find(id);
+  if (deadline == timer_deadlines.end())
+    return;
+  timers.erase(std::make_pair(deadline->second, id));
+  timer_deadlines.erase(deadline);
+}
+
+void Reactor::post(Task task) {
+  {
+    const std::lock_guard<std::mutex> lock(post_mutex);
+    posted.push_back(std::move(task));
+  }
+  wake();
+}
+
+void Reactor::run_timers() {
+  Clock::time_point now = Clock::now();
+  while (running && !timers.empty() && timers.begin()->first.first <= now) {
+    auto timer = timers.begin();
+    Task task = std::move(timer->second);
+    timer_deadlines.erase(timer->first.second);
+    timers.erase(timer);
+    task();
+  }
+}
+
+void Reactor::run_posted() {
+  std::vector<Task> tasks;
+  {
+    const std::lock_guard<std::mutex> lock(post_mutex);
+    tasks.swap(posted);
+  }
+  for (Task &task : tasks)
+    task();
+}
+
+void Reactor::run() {
+  if (!is_valid())
+    return;
+  running = true;
+  while (running) {
+    wait_events();
+    run_timers();
+    run_posted();
+  }
+}
+
+void Reactor::stop() {
+  running = false;
+  wake();
+}
+} // namespace SCK
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace SCK {
+enum EVENT : uint32_t {
+  EVENT_READ = 1,
+  EVENT_WRITE = 2,
+  EVENT_ERROR = 4, // Error or hang-up, always reported.
+};
+
+// Single-threaded event loop over socket readiness and one-shot timers:
+// epoll + timerfd + eventfd on Linux, poll()/WSAPoll elsewhere. Handlers
+// and timers run on the thread inside run(); only post() and stop() may
+// be called from other threads.
+class Reactor {
+public:
+  using Clock = std::chrono::steady_clock;
+  using Handler = std::function<void(uint32_t events)>;
+  using Task = std::function<void()>;
+
+  Reactor();
+  ~Reactor();
+  Reactor(const Reactor &) = delete;
+  Reactor &operator=(const Reactor &) = delete;
+
+  bool is_valid() const noexcept { return poll_fd != -1 && wake_fd != -1; }
+  bool add(int fd, uint32_t events, Handler handler);
+  bool modify(int fd, uint32_t events);
+  void remove(int fd);
+  uint64_t add_timer(Clock::time_point deadline, Task task); // Returns id.
+  void cancel_timer(uint64_t id);
+  void post(Task task);
+  void run(); // Until stop().
+  void stop();
+
+private:
+  struct Watch {
+    uint32_t events;
+    std::shared_ptr<Handler> handler; // Survives remove() from itself.
+  };
+  int poll_fd = -1;  // epoll instance; unused by the poll() backend.
+  int wake_fd = -1;  // eventfd, or a UDP socket sending to itself.
+  int timer_fd = -1; // timerfd, Linux only.
+  std::unordered_map<int, Watch> watches;
+  std::map<std::pair<Clock::time_point, uint64_t>, Task> timers;
+  std::unordered_map<uint64_t, Clock::time_point> timer_deadlines;
+  uint64_t next_timer_id = 1;
+  Clock::time_point armed_deadline = Clock::time_point::max();
+  std::mutex post_mutex;
+  std::vector<Task> posted;
+  std::atomic<bool> running = false;
+
+  void wake();
+  void drain_wake();
+  void wait_events();
+  void dispatch(int fd, uint32_t events);
+  void run_timers();
+  void run_posted();
+};
+} // namespace SCK
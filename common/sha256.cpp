@@ -0,0 +1,212 @@
+#include "sha256.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SHA_HAS_SHANI
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SHANI
+#else
+#include <cpuid.h>
+#define TARGET_SHANI __attribute__((target("sha,sse4.1")))
+#endif
+#endif
+
+namespace {
+constexpr uint32_t ROUND_CONSTANTS[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+using State = std::array<uint32_t, 8>;
+
+uint32_t rotate_right(uint32_t value, int bits) {
+  return (value >> bits) | (value << (32 - bits));
+}
+
+void compress_plain(State &state, const uint8_t *data, size_t blocks) {
+  for (; blocks > 0; --blocks, data += 64) {
+    uint32_t schedule[64];
+    for (int i = 0; i < 16; ++i)
+      schedule[i] = uint32_t(data[4 * i]) << 24 |
+                    uint32_t(data[4 * i + 1]) << 16 |
+                    uint32_t(data[4 * i + 2]) << 8 | data[4 * i + 3];
+    for (int i = 16; i < 64; ++i) {
+      uint32_t s0 = rotate_right(schedule[i - 15], 7) ^
+                    rotate_right(schedule[i - 15], 18) ^
+                    (schedule[i - 15] >> 3);
+      uint32_t s1 = rotate_right(schedule[i - 2], 17) ^
+                    rotate_right(schedule[i - 2], 19) ^
+                    (schedule[i - 2] >> 10);
+      schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+      uint32_t s1 =
+          rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+      uint32_t choice = (e & f) ^ (~e & g);
+      uint32_t t1 = h + s1 + choice + ROUND_CONSTANTS[i] + schedule[i];
+      uint32_t s0 =
+          rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+      uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = s0 + majority;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#ifdef SHA_HAS_SHANI
+// Four rounds per step on the sha256rnds2 instruction, which keeps the
+// state as ABEF and CDGH.
+TARGET_SHANI void compress_shani(State &state, const uint8_t *data,
+                                 size_t blocks) {
+  const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                      0x0405060700010203ULL); // Big endian.
+  __m128i dcba = _mm_loadu_si128(reinterpret_cast<__m128i *>(&state[0]));
+  __m128i hgfe = _mm_loadu_si128(reinterpret_cast<__m128i *>(&state[4]));
+  __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+  __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+  __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+  __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+  for (; blocks > 0; --blocks, data += 64) {
+    __m128i abef_before = abef;
+    __m128i cdgh_before = cdgh;
+    __m128i words[4]; // The schedule, four words at a time.
+#pragma GCC unroll 16
+    for (int i = 0; i < 16; ++i) {
+      __m128i &current = words[i & 3];
+      if (i < 4) {
+        current = _mm_shuffle_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16 * i)),
+            swap);
+      } else {
+        const __m128i &last = words[(i + 3) & 3];
+        current = _mm_sha256msg1_epu32(current, words[(i + 1) & 3]);
+        current = _mm_add_epi32(
+            current, _mm_alignr_epi8(last, words[(i + 2) & 3], 4));
+        current = _mm_sha256msg2_epu32(current, last);
+      }
+      __m128i input = _mm_add_epi32(
+          current, _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                       &ROUND_CONSTANTS[4 * i])));
+      cdgh = _mm_sha256rnds2_epu32(cdgh, abef, input);
+      abef = _mm_sha256rnds2_epu32(abef, cdgh,
+                                   _mm_shuffle_epi32(input, 0x0E));
+    }
+    abef = _mm_add_epi32(abef, abef_before);
+    cdgh = _mm_add_epi32(cdgh, cdgh_before);
+  }
+  __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+  __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+  dcba = _mm_blend_epi16(feba, dchg, 0xF0);
+  hgfe = _mm_alignr_epi8(dchg, feba, 8);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), dcba);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), hgfe);
+}
+
+bool has_shani() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuidex(info, 7, 0);
+  return (info[1] >> 29) & 1;
+#else
+  unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+  return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+         ((ebx >> 29) & 1) && __builtin_cpu_supports("sse4.1");
+#endif
+}
+#endif
+
+using Kernel = void (*)(State &state, const uint8_t *data, size_t blocks);
+
+Kernel select_kernel() {
+#ifdef SHA_HAS_SHANI
+  if (has_shani())
+    return compress_shani;
+#endif
+  return compress_plain;
+}
+} // namespace
+
+namespace SHA {
+
+Sha256::Sha256()
+    : state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f,
+            0x9b05688c, 0x1f83d9ab, 0x5be0cd19} {}
+
+void Sha256::compress(const uint8_t *data, size_t blocks) {
+  static const Kernel kernel = select_kernel();
+  kernel(state, data, blocks);
+}
+
+void Sha256::update(const uint8_t *data, size_t size) {
+  size_t used = length % block.size();
+  length += size;
+  if (used != 0) {
+    size_t taken = std::min(size, block.size() - used);
+    std::memcpy(block.data() + used, data, taken);
+    data += taken;
+    size -= taken;
+    if (used + taken < block.size())
+      return;
+    compress(block.data(), 1);
+  }
+  size_t blocks = size / block.size();
+  compress(data, blocks);
+  data += blocks * block.size();
+  std::memcpy(block.data(), data, size % block.size());
+}
+
+Digest Sha256::finish() {
+  uint64_t bits = length * 8;
+  size_t used = length % block.size();
+  block[used++] = 0x80;
+  if (used > block.size() - 8) {
+    std::memset(block.data() + used, 0, block.size() - used);
+    compress(block.data(), 1);
+    used = 0;
+  }
+  std::memset(block.data() + used, 0, block.size() - 8 - used);
+  for (int i = 0; i < 8; ++i)
+    block[block.size() - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+  compress(block.data(), 1);
+  Digest digest;
+  for (int i = 0; i < 8; ++i)
+    for (int j = 0; j < 4; ++j)
+      digest[4 * i + j] = static_cast<uint8_t>(state[i] >> (24 - 8 * j));
+  return digest;
+}
+
+Digest get_digest(const uint8_t *data, size_t size) {
+  Sha256 sha;
+  sha.update(data, size);
+  return sha.finish();
+}
+} // namespace SHA
\ No newline at end of file
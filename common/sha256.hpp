@@ -0,0 +1,27 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace SHA {
+constexpr uint32_t DIGEST_SIZE = 32;
+using Digest = std::array<uint8_t, DIGEST_SIZE>;
+
+// SHA-256 (FIPS 180-4), fed in pieces of any size. Uses the SHA
+// extensions where the CPU has them.
+class Sha256 {
+  std::array<uint32_t, 8> state;
+  std::array<uint8_t, 64> block;
+  uint64_t length = 0; // Bytes hashed so far.
+
+  void compress(const uint8_t *data, size_t blocks); // Whole blocks.
+
+public:
+  Sha256();
+  void update(const uint8_t *data, size_t size);
+  Digest finish(); // Only once.
+};
+
+Digest get_digest(const uint8_t *data, size_t size);
+} // namespace SHA
\ No newline at end of file
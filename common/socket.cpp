@@ -0,0 +1,128 @@
+#include "socket.hpp"
+
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace SCK {
+#ifdef _WIN32
+bool init() {
+  WSADATA wsaData;
+  return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+}
+
+void close_socket(int sockfd) { closesocket(sockfd); }
+
+int last_error() { return WSAGetLastError(); }
+
+bool would_block(int error) {
+  return error == WSAEWOULDBLOCK || error == WSAETIMEDOUT;
+}
+
+bool set_nonblocking(int sockfd) {
+  u_long mode = 1;
+  return ioctlsocket(sockfd, FIONBIO, &mode) == 0;
+}
+
+int send_gather(int sockfd, const struct sockaddr_in &addr,
+                std::span<const uint8_t> header,
+                std::span<const uint8_t> payload) {
+  WSABUF buffers[2];
+  buffers[0].buf =
+      reinterpret_cast<char *>(const_cast<uint8_t *>(header.data()));
+  buffers[0].len = static_cast<ULONG>(header.size());
+  buffers[1].buf =
+      reinterpret_cast<char *>(const_cast<uint8_t *>(payload.data()));
+  buffers[1].len = static_cast<ULONG>(payload.size());
+  DWORD sent = 0;
+  if (WSASendTo(sockfd, buffers, payload.empty() ? 1 : 2, &sent, 0,
+                (const struct sockaddr *)&addr, sizeof(addr), nullptr,
+                nullptr) != 0)
+    return -1;
+  return static_cast<int>(sent);
+}
+#else
+bool init() {
+  signal(SIGPIPE, SIG_IGN); // Broken connections are reported by send().
+  return true;
+}
+
+void close_socket(int sockfd) { close(sockfd); }
+
+int last_error() { return errno; }
+
+bool would_block(int error) {
+  return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+}
+
+bool set_nonblocking(int sockfd) {
+  int flags = fcntl(sockfd, F_GETFL, 0);
+  return flags >= 0 && fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+int send_gather(int sockfd, const struct sockaddr_in &addr,
+                std::span<const uint8_t> header,
+                std::span<const uint8_t> payload) {
+  struct iovec buffers[2];
+  buffers[0].iov_base = const_cast<uint8_t *>(header.data());
+  buffers[0].iov_len = header.size();
+  buffers[1].iov_base = const_cast<uint8_t *>(payload.data());
+  buffers[1].iov_len = payload.size();
+  struct msghdr message;
+  std::memset(&message, 0, sizeof(message));
+  message.msg_name = const_cast<struct sockaddr_in *>(&addr);
+  message.msg_namelen = sizeof(addr);
+  message.msg_iov = buffers;
+  message.msg_iovlen = payload.empty() ? 1 : 2;
+  return static_cast<int>(sendmsg(sockfd, &message, 0));
+}
+#endif
+
+struct sockaddr_in make_address(const std::string &ip, uint32_t port) {
+  struct sockaddr_in sockaddr;
+  std::memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin_family = AF_INET;
+  sockaddr.sin_port = htons(port);
+  sockaddr.sin_addr.s_addr = inet_addr(ip.c_str());
+  return sockaddr;
+}
+bool set_dont_fragment(int sockfd) {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+  int mode = IP_PMTUDISC_PROBE;
+  return setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &mode,
+                    sizeof(mode)) == 0;
+#elif defined(IP_DONTFRAGMENT)
+  DWORD enabled = TRUE;
+  return setsockopt(sockfd, IPPROTO_IP, IP_DONTFRAGMENT,
+                    reinterpret_cast<const char *>(&enabled),
+                    sizeof(enabled)) == 0;
+#elif defined(IP_DONTFRAG)
+  int enabled = 1;
+  return setsockopt(sockfd, IPPROTO_IP, IP_DONTFRAG, &enabled,
+                    sizeof(enabled)) == 0;
+#else
+  (void)sockfd;
+  return false;
+#endif
+}
+
+uint32_t get_path_mtu(int sockfd) {
+#ifdef IP_MTU
+  int mtu = 0;
+  addr_length_t length = sizeof(mtu);
+  if (getsockopt(sockfd, IPPROTO_IP, IP_MTU, reinterpret_cast<char *>(&mtu),
+                 &length) == 0 &&
+      mtu > 0)
+    return static_cast<uint32_t>(mtu);
+#else
+  (void)sockfd;
+#endif
+  return 0;
+}
+} // namespace SCK
@@ -1,9 +1,40 @@
 #pragma once
 
 #include <atomic>
-#include <winsock.h>
+#include <cstdint>
+#include <span>
+#include <string>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
 
 namespace SCK {
+#ifdef _WIN32
+using addr_length_t = int;
+#else
+using addr_length_t = socklen_t;
+#endif
+
+bool init();                 // WSAStartup on Windows, SIGPIPE off on POSIX.
+void close_socket(int sockfd);
+int last_error();            // errno / WSAGetLastError of the last call.
+bool would_block(int error); // Nonblocking call has nothing to do.
+bool set_nonblocking(int sockfd);
+struct sockaddr_in make_address(const std::string &ip, uint32_t port);
+// Datagrams go out with the don't-fragment bit, also those above the path
+// MTU the kernel knows, so they can probe for a larger one. False if the
+// platform cannot.
+bool set_dont_fragment(int sockfd);
+// Path MTU to the address a datagram socket is connected to, as far as
+// the kernel knows; 0 if it does not tell.
+uint32_t get_path_mtu(int sockfd);
+
 class Socket {
   std::atomic<int> sockfd;
 
@@ -12,7 +43,7 @@ public:
   Socket() : sockfd(-1) {}
   ~Socket() {
     if (sockfd.load() >= 0)
-      closesocket(sockfd.load());
+      close_socket(sockfd.load());
   }
   Socket(const Socket &) = delete;
   Socket &operator=(const Socket &) = delete;
@@ -20,11 +51,16 @@ public:
   Socket &operator=(Socket &&other) noexcept {
     if (this != &other) {
       if (sockfd.load() >= 0)
-        closesocket(sockfd.load());
+        close_socket(sockfd.load());
       sockfd.store(other.sockfd.exchange(-1));
     }
     return *this;
   }
   int get_sockfd() const noexcept { return sockfd.load(); }
 };
-} // namespace SCK
\ No newline at end of file
+
+// Sends header and payload as one datagram without joining them first.
+int send_gather(int sockfd, const struct sockaddr_in &addr,
+                std::span<const uint8_t> header,
+                std::span<const uint8_t> payload);
+} // namespace SCK
@@ -2,5 +2,10 @@
 
 #include <cstdint>
 
+// Chunk size of an upload unless the client asks for another one, see
+// MESG::StartMessage: file data per UDP packet.
 constexpr uint32_t BUFFER_MESSAGE_SIZE = 8192;
-constexpr uint32_t MAX_FILE_SIZE = 10e6;
\ No newline at end of file
+// Chunk sizes an upload may use. The smallest fits any IPv4 path, the
+// largest a loopback or jumbo frame path with room to spare.
+constexpr uint32_t MIN_CHUNK_SIZE = 512;
+constexpr uint32_t MAX_CHUNK_SIZE = 32768;
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include "chunk_reader.hpp"
+#include "crc.hpp"
+#include "log.hpp"
+#include "lz.hpp"
+
+#include <algorithm>
+
+namespace {
+constexpr uint32_t SKIP_READ_SIZE = 1 << 20;
+// Compressed chunks must save at least 1 / MIN_SAVING of their size.
+constexpr uint32_t MIN_SAVING = 8;
+// After n tries in a row that did not shrink, the next 2^n chunks read
+// are sent as they are.
+constexpr uint32_t MAX_MISSES = 6;
+} // namespace
+
+namespace CLN {
+void ChunkReader::open(std::shared_ptr<const FIO::FileSet> new_files,
+                       uint32_t new_chunk_size, CompressionPool *new_pool,
+                       std::shared_ptr<const std::vector<uint32_t>> new_sums) {
+  files = std::move(new_files);
+  file_size = files->size();
+  chunk_size = new_chunk_size;
+  pool = new_pool;
+  sums = std::move(new_sums);
+  if (sums && sums->size() != get_chunk_count())
+    sums.reset();
+}
+
+void ChunkReader::start(uint32_t capacity, uint64_t first, uint64_t last) {
+  slots.assign(capacity ? capacity : 1, Chunk());
+  for (Chunk &slot : slots) {
+    slot.data.reserve(chunk_size);
+    if (pool != nullptr)
+      slot.compressed.reserve(chunk_size);
+  }
+  base = first;
+  loaded = first;
+  end = std::min(last, get_chunk_count());
+  failed = false;
+  checksum = 0;
+  misses = 0;
+  skip_until = 0;
+  running = true;
+  worker = std::thread(&ChunkReader::read_ahead, this);
+}
+
+void ChunkReader::stop() {
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+  cv.notify_all();
+  if (worker.joinable())
+    worker.join();
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [&] { return compressing == 0; });
+}
+
+void ChunkReader::read_ahead() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (running && loaded < end) {
+    // A released chunk may still be on the pool.
+    cv.wait(lock, [&] {
+      return !running || (loaded < base + slots.size() &&
+                          !slots[loaded % slots.size()].compressing);
+    });
+    if (!running)
+      break;
+    uint64_t chunk = loaded;
+    uint64_t released = std::min(base, end); // Unread, resumed chunks.
+    lock.unlock();
+    bool read = chunk < released ? checksum_chunks(chunk, released)
+                                 : read_chunk(chunk);
+    lock.lock();
+    if (!read) {
+      LOG::error("Failed to read a file chunk.");
+      failed = true;
+      cv.notify_all();
+      break;
+    }
+    // After a miss only one chunk at a time is tried.
+    if (chunk >= released && pool != nullptr && chunk >= skip_until &&
+        (misses == 0 || compressing == 0)) {
+      slots[chunk % slots.size()].compressing = true;
+      compressing++;
+      pool->post([this, chunk] { compress_chunk(chunk); });
+    }
+    loaded = std::max(chunk + 1, released);
+    cv.notify_all();
+  }
+}
+
+// The slot belonged to a released chunk, nobody else touches it now.
+bool ChunkReader::read_chunk(uint64_t chunk) {
+  Chunk &slot = slots[chunk % slots.size()];
+  uint64_t offset = chunk * chunk_size;
+  uint32_t size = static_cast<uint32_t>(
+      std::min<uint64_t>(chunk_size, file_size - offset));
+  slot.data.resize(size);
+  slot.compressed.clear();
+  {
+    STAT::ScopedTimer timer(read_time);
+    if (files->read_at(offset, slot.data.data(), size) != size)
+      return false;
+  }
+  {
+    STAT::ScopedTimer timer(crc_time);
+    slot.checksum = CRC::get_crc32c(slot.data.data(), size);
+  }
+  checksum = CRC::combine(checksum, slot.checksum, size);
+  return true;
+}
+
+// Kept only if it saves enough to be worth the server's time.
+void ChunkReader::compress_chunk(uint64_t chunk) {
+  Chunk &slot = slots[chunk % slots.size()];
+  size_t size = slot.data.size();
+  slot.compressed.resize(size - size / MIN_SAVING);
+  slot.compressed.resize(LZ::compress(slot.data, slot.compressed));
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    slot.compressing = false;
+    compressing--;
+    if (!slot.compressed.empty()) {
+      misses = 0;
+      compressed_from += size;
+      compressed_to += slot.compressed.size();
+    } else {
+      misses = std::min(misses + 1, MAX_MISSES);
+      skip_until = std::max(skip_until, loaded + (uint64_t(1) << misses));
+    }
+  }
+  cv.notify_all();
+}
+
+// Chunks the server holds already, resumed or copied there by a delta or
+// dedup. Their data never crosses the network, yet the stream checksum
+// has to cover it: the server's copy is checked against these files, not
+// against what it was told. The sums of a delta or dedup pass spare
+// reading them again; a resumed upload reads them, once.
+bool ChunkReader::checksum_chunks(uint64_t first, uint64_t last) {
+  if (sums) {
+    for (uint64_t chunk = first; chunk < last; ++chunk)
+      checksum = CRC::combine(
+          checksum, (*sums)[chunk],
+          std::min<uint64_t>(chunk_size, file_size - chunk * chunk_size));
+    return true;
+  }
+  std::vector<uint8_t> buffer(SKIP_READ_SIZE);
+  uint64_t offset = first * chunk_size;
+  uint64_t end_offset = std::min(last * chunk_size, file_size);
+  while (offset < end_offset) {
+    uint32_t size = static_cast<uint32_t>(
+        std::min<uint64_t>(buffer.size(), end_offset - offset));
+    if (files->read_at(offset, buffer.data(), size) != size)
+      return false;
+    checksum = CRC::extend(checksum, buffer.data(), size);
+    offset += size;
+  }
+  return true;
+}
+
+const Chunk *ChunkReader::get(uint64_t chunk) {
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [&] {
+    return (chunk < loaded && !slots[chunk % slots.size()].compressing) ||
+           failed || !running;
+  });
+  if (chunk >= loaded || chunk < base)
+    return nullptr;
+  return &slots[chunk % slots.size()];
+}
+
+bool ChunkReader::get_checksum(uint32_t &value) {
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [&] { return loaded >= end || failed || !running; });
+  value = checksum;
+  return loaded >= end;
+}
+
+void ChunkReader::get_compression(uint64_t &from, uint64_t &to) {
+  const std::lock_guard<std::mutex> lock(mutex);
+  from = compressed_from;
+  to = compressed_to;
+}
+
+void ChunkReader::release(uint64_t new_base) {
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    if (new_base <= base)
+      return;
+    base = new_base;
+  }
+  cv.notify_all();
+}
+} // namespace CLN
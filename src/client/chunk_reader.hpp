@@ -0,0 +1,88 @@
+#pragma once
+
+#include "compression_pool.hpp"
+#include "file_set.hpp"
+#include "metrics.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace CLN {
+// A chunk as read and, if that made it enough smaller, compressed.
+struct Chunk {
+  std::vector<uint8_t> data;
+  uint32_t checksum = 0;           // CRC-32C of data, sent with it.
+  std::vector<uint8_t> compressed; // Empty if the chunk is sent as read.
+  bool compressing = false;        // On the pool, nobody touches it.
+};
+
+// Reads a file stream chunk by chunk on a read-ahead thread into a fixed
+// pool of buffers, so memory stays constant whatever the file size. Chunks
+// are kept until released, which lets the sender retransmit any chunk
+// inside its window.
+// Each chunk is checksummed once as it is read, the stream's checksum is
+// combined from those; given a pool, chunks are compressed there before
+// the sender gets them. Compression is sampled: chunks that do not shrink
+// make the reader skip ever more of the next ones, so compressed media
+// costs next to nothing.
+class ChunkReader {
+  std::shared_ptr<const FIO::FileSet> files;
+  uint64_t file_size = 0;
+  uint32_t chunk_size = 0;
+  CompressionPool *pool = nullptr; // None, no compression.
+  // CRCs of every chunk from an earlier pass, or empty.
+  std::shared_ptr<const std::vector<uint32_t>> sums;
+  std::vector<Chunk> slots;        // Chunk n lives in n % size.
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint64_t base = 0;   // Chunks below are released.
+  uint64_t loaded = 0; // Chunks below are in the pool.
+  uint64_t end = 0;    // Read up to here.
+  bool running = false;
+  bool failed = false;
+  uint32_t checksum = 0; // CRC-32C of chunks [first, loaded).
+  uint32_t compressing = 0; // Chunks on the pool.
+  uint32_t misses = 0;      // Chunks in a row that did not shrink.
+  uint64_t skip_until = 0;  // Chunks below are sent as read.
+  uint64_t compressed_from = 0; // Bytes of the chunks that shrank.
+  uint64_t compressed_to = 0;
+  STAT::Histogram read_time; // Per chunk, nanoseconds.
+  STAT::Histogram crc_time;  // Likewise.
+  std::thread worker;
+
+  void read_ahead();
+  bool read_chunk(uint64_t chunk);
+  void compress_chunk(uint64_t chunk); // On the pool.
+  bool checksum_chunks(uint64_t first, uint64_t last); // Without keeping.
+
+public:
+  ~ChunkReader() { stop(); }
+  void open(std::shared_ptr<const FIO::FileSet> new_files,
+            uint32_t new_chunk_size, CompressionPool *new_pool = nullptr,
+            std::shared_ptr<const std::vector<uint32_t>> new_sums = {});
+  // Reads chunks [first, last), capacity of them at a time.
+  void start(uint32_t capacity, uint64_t first, uint64_t last);
+  void stop(); // Also waits for the pool to be done with the chunks.
+  // Blocks until the chunk is read and compressed. Valid until released,
+  // nullptr on error.
+  const Chunk *get(uint64_t chunk);
+  void release(uint64_t new_base); // Chunks below new_base are done.
+  // CRC-32C of chunks [first, last), blocks until every one was read;
+  // released chunks are still read for it unless their sums were given.
+  // False on a read error.
+  bool get_checksum(uint32_t &value);
+  // Bytes of the chunks that were compressed, before and after.
+  void get_compression(uint64_t &from, uint64_t &to);
+  const STAT::Histogram &get_read_time() const noexcept { return read_time; }
+  const STAT::Histogram &get_crc_time() const noexcept { return crc_time; }
+  uint64_t get_file_size() const noexcept { return file_size; }
+  uint64_t get_chunk_count() const noexcept {
+    return (file_size + chunk_size - 1) / chunk_size;
+  }
+};
+} // namespace CLN
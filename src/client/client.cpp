@@ -1,257 +1,605 @@
 #include "client.hpp"
+#include "chunker.hpp"
 #include "crc.hpp"
+#include "delta.hpp"
+#include "file_io.hpp"
 #include "log.hpp"
+#include "metrics.hpp"
 #include "typedef.hpp"
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
-#include <fstream>
+#include <filesystem>
 #include <iostream>
-
-#include <winsock.h>
+#include <thread>
 
 namespace {
-constexpr uint32_t TIMEOUT_IN_SECONDS = 1;
+// IPv4 and UDP headers, below the payload of a datagram.
+constexpr uint32_t IP_UDP_HEADER_SIZE = 28;
+// Path MTUs probed below the local one: jumbo frames, Ethernet, PPPoE and
+// the IPv6 minimum most tunnels keep to.
+constexpr std::array<uint32_t, 4> COMMON_MTUS = {9000, 1500, 1492, 1280};
+
+// Of the file clock, only ever compared with itself; 0 if unknown.
+uint64_t get_modified(const std::string &path) {
+  std::error_code error;
+  auto time = std::filesystem::last_write_time(path, error);
+  if (error)
+    return 0;
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          time.time_since_epoch())
+          .count());
+}
 } // namespace
 
 namespace CLN {
 
-void Client::init_winsock() {
-  WSADATA wsaData;
-  int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
-  if (result != 0)
-    LOG::safe_print("WSAStartup failed");
+bool Client::run() {
+  if (!SCK::init() || !reactor.is_valid() || !collect_sources())
+    return false;
+  if (!connect_tcp())
+    return false;
+  if (options.compress)
+    compression = std::make_unique<CompressionPool>(
+        std::max(1u, std::thread::hardware_concurrency()));
+  reactor.add(tcp_socket.get_sockfd(), SCK::EVENT_READ,
+              [this](uint32_t) { on_tcp_event(); });
+  // The data phase starts on the server's accept.
+  if (options.chunk_size == 0)
+    probe_path();
+  else
+    start_upload();
+  reactor.run();
+  senders.clear(); // Stops and joins them.
+  return succeeded;
+}
+
+// A file keeps its name; files below a directory get their path from the
+// directory on, in a stable order.
+bool Client::collect_sources() {
+  namespace fs = std::filesystem;
+  std::error_code error;
+  fs::path root = fs::absolute(filename, error).lexically_normal();
+  if (root.filename().empty())
+    root = root.parent_path(); // Trailing separator.
+  if (fs::is_regular_file(root, error)) {
+    sources.push_back({root.string(), root.filename().generic_string()});
+    return true;
+  }
+  if (!fs::is_directory(root, error)) {
+    LOG::error("Failed to open a file.");
+    return false;
+  }
+  for (fs::recursive_directory_iterator entry(root, error), end;
+       !error && entry != end; entry.increment(error)) {
+    if (entry->is_regular_file(error))
+      sources.push_back(
+          {entry->path().string(),
+           (root.filename() / entry->path().lexically_relative(root))
+               .generic_string()});
+  }
+  if (error || sources.empty()) {
+    if (error)
+      LOG::error("Failed to read a directory. {}", error.message());
+    else
+      LOG::warning("Nothing to send.");
+    return false;
+  }
+  std::sort(sources.begin(), sources.end(),
+            [](const SourceFile &a, const SourceFile &b) {
+              return a.name < b.name;
+            });
+  return true;
 }
 
-void Client::run() {
-  init_winsock();
-  listen_tcp_worker = std::thread(&Client::listen_tcp, this);
+bool Client::connect_tcp() {
+  tcp_socket = SCK::Socket((socket(AF_INET, SOCK_STREAM, 0)));
+  if (tcp_socket.get_sockfd() < 0) {
+    LOG::error("Failed to create a tcp socket. {}", SCK::last_error());
+    return false;
+  }
+  struct sockaddr_in sockaddr = SCK::make_address(ip, tcp_port);
+  LOG::safe_print("Trying to connect to the server.");
+  if (connect(tcp_socket.get_sockfd(), (struct sockaddr *)&sockaddr,
+              sizeof(sockaddr)) < 0) {
+    LOG::error("Failed to connect to server. {}", SCK::last_error());
+    return false;
+  }
+  LOG::safe_print("Connected to server.");
+  return true;
+}
 
-  if (listen_tcp_worker.joinable())
-    listen_tcp_worker.join();
-  if (send_message_worker.joinable())
-    send_message_worker.join();
+// One probe per candidate size goes out at once, what is answered within
+// the initial timeout counts. Without an answer, from an older server or
+// through a firewall, chunks keep the default size and are fragmented.
+void Client::probe_path() {
+  probe_socket = SCK::Socket(socket(AF_INET, SOCK_DGRAM, 0));
+  int sockfd = probe_socket.get_sockfd();
+  struct sockaddr_in sockaddr = SCK::make_address(ip, tcp_port);
+  if (sockfd < 0 ||
+      connect(sockfd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) < 0 ||
+      !SCK::set_dont_fragment(sockfd) || !SCK::set_nonblocking(sockfd) ||
+      !reactor.add(sockfd, SCK::EVENT_READ,
+                   [this](uint32_t) { on_probe_event(); })) {
+    end_probe();
+    return;
+  }
+  const uint32_t smallest = MESG::FILE_HEADER_SIZE + MIN_CHUNK_SIZE;
+  probe_target = MESG::FILE_HEADER_SIZE + MAX_CHUNK_SIZE;
+  uint32_t local_mtu = SCK::get_path_mtu(sockfd);
+  if (local_mtu > IP_UDP_HEADER_SIZE + smallest)
+    probe_target = std::min(probe_target, local_mtu - IP_UDP_HEADER_SIZE);
+  std::vector<uint32_t> sizes = {probe_target};
+  for (uint32_t mtu : COMMON_MTUS)
+    if (mtu - IP_UDP_HEADER_SIZE < probe_target &&
+        mtu - IP_UDP_HEADER_SIZE >= smallest)
+      sizes.push_back(mtu - IP_UDP_HEADER_SIZE);
+  for (uint32_t size : sizes) {
+    MESG::ProbeMessage probe;
+    probe.set_size(size);
+    std::vector<uint8_t> encoded = MESG::serialize(probe);
+    // Larger than the local MTU fails right here, that is fine.
+    send(sockfd, reinterpret_cast<const char *>(encoded.data()),
+         encoded.size(), 0);
+  }
+  probe_timer = reactor.add_timer(
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(delay),
+      [this] {
+        probe_timer = 0;
+        end_probe();
+      });
 }
 
-void Client::send_file() {
-  send_start_message();
-  std::this_thread::sleep_for(std::chrono::milliseconds(
-      500)); /* Waiting for server start listening UDP. */
-  send_file_data();
-  send_final_message();
-  stop();
+void Client::on_probe_event() {
+  std::vector<uint8_t> &message = receive_buffer;
+  while (true) {
+    int result = recv(probe_socket.get_sockfd(),
+                      reinterpret_cast<char *>(message.data()),
+                      message.size(), 0);
+    if (result < 0)
+      break;
+    MESG::dispatch(std::span<const uint8_t>(message.data(), result),
+                   [this](const MESG::ProbeMessage &answer) {
+                     if (answer.is_answer() &&
+                         answer.get_size() <= probe_target)
+                       probed_size = std::max(probed_size, answer.get_size());
+                   });
+  }
+  if (probed_size == probe_target)
+    end_probe(); // Nothing larger to wait for.
+}
+
+void Client::end_probe() {
+  if (options.chunk_size != 0)
+    return; // Already ended.
+  if (probe_timer != 0)
+    reactor.cancel_timer(probe_timer);
+  probe_timer = 0;
+  if (probe_socket.get_sockfd() >= 0)
+    reactor.remove(probe_socket.get_sockfd());
+  probe_socket = SCK::Socket();
+  options.chunk_size = BUFFER_MESSAGE_SIZE;
+  if (probed_size >= MESG::FILE_HEADER_SIZE + MIN_CHUNK_SIZE)
+    options.chunk_size = probed_size - MESG::FILE_HEADER_SIZE;
+  LOG::safe_print((probed_size > 0 ? "Path MTU probed, chunks of "
+                                   : "Path MTU unknown, chunks of ") +
+                  std::to_string(options.chunk_size) + " bytes.");
+  start_upload();
 }
 
-void Client::send_start_message() {
+// The socket blocks, only an interrupted send leaves something queued.
+bool Client::flush_control() {
   if (tcp_socket.get_sockfd() < 0) {
-    LOG::safe_print("TCP socket is not connected.");
+    LOG::error("TCP socket is not connected.");
+    return false;
+  }
+  while (!control_writer.is_empty())
+    if (!control_writer.flush(tcp_socket.get_sockfd()))
+      return false;
+  return true;
+}
+
+// Takes as many of the remaining files as one manifest holds.
+void Client::start_upload() {
+  upload_start = std::chrono::steady_clock::now();
+  MESG::StartMessage manifest;
+  size_t end = next_source;
+  while (end < sources.size() && manifest.add_file(sources[end].name, 0))
+    end++;
+  if (end == next_source) {
+    LOG::error("Filename is too long: {}", sources[end].name);
     stop();
     return;
   }
+  std::vector<std::string> file_paths;
+  for (size_t i = next_source; i < end; ++i)
+    file_paths.push_back(sources[i].path);
+  files = std::make_shared<FIO::FileSet>();
+  if (!files->open_read(file_paths)) {
+    LOG::error("Failed to open a file.");
+    stop();
+    return;
+  }
+  // Sizes as opened, names are unchanged and still fit.
   MESG::StartMessage message;
-  message.set_type(MESG::MESSAGE_TYPE_START);
-  message.set_port(udp_port);
-  message.set_filename(filename);
-  std::vector<uint8_t> serialized_message = message.serialize_message();
-  int sent = send(tcp_socket.get_sockfd(),
-                  reinterpret_cast<const char *>(serialized_message.data()),
-                  serialized_message.size(), 0);
-  if (sent < 0) {
-    LOG::safe_print("Failed to send start message.");
+  message.set_stripe_count(options.stripes);
+  message.set_chunk_size(options.chunk_size);
+  message.set_flags((options.delta ? MESG::START_FLAG_DELTA : 0) |
+                    (options.dedup ? MESG::START_FLAG_DEDUP : 0));
+  for (size_t i = next_source; i < end; ++i)
+    message.add_file(sources[i].name, files->get_size(i - next_source),
+                     get_modified(sources[i].path));
+  next_source = end;
+  signatures.clear();
+  chunk_sums.reset();
+  send_control(message);
+  if (options.dedup && !send_chunks())
+    return;
+  if (!flush_control()) {
+    LOG::error("Failed to send start message.");
     stop();
-  } else {
-    LOG::safe_print("Start message sent.");
+    return;
   }
+  LOG::safe_print("Start message sent.");
 }
 
-void Client::send_file_data() {
-  fill_file_data(filename);
-  SCK::Socket sockfd(socket(AF_INET, SOCK_DGRAM, 0));
-  if (sockfd.get_sockfd() < 0) {
-    LOG::safe_print("Failed to create a udp socket.");
+void Client::on_accept(const MESG::AcceptMessage &message) {
+  if (message.get_message_status() != MESG::MESSAGE_SUCCESS ||
+      message.get_stripes().empty()) {
+    LOG::error("The server refused the file.");
     stop();
     return;
   }
-  struct sockaddr_in sockaddr = {0};
-  std::memset(&sockaddr, 0, sizeof(sockaddr));
-  sockaddr.sin_family = AF_INET;
-  sockaddr.sin_port = htons(udp_port);
-  sockaddr.sin_addr.s_addr = inet_addr(ip.c_str());
-
-  uint32_t packet_number = 0;
-  auto last_send = std::chrono::steady_clock::now();
-  while (should_run) {
-    MESG::FileMessage message;
-    message.data.resize(BUFFER_MESSAGE_SIZE);
-    message.set_packet_number(packet_number);
-    message.set_type(MESG::MESSAGE_TYPE_FILE);
-    uint32_t offset = packet_number * BUFFER_MESSAGE_SIZE;
-    if (offset >= file_data.size()) {
-      LOG::safe_print("All packets sent.");
-      break;
-    }
-    uint32_t chunk_size = BUFFER_MESSAGE_SIZE < file_data.size() - offset
-                              ? BUFFER_MESSAGE_SIZE
-                              : file_data.size() - offset;
-    message.set_packet_number(packet_number);
-    message.data.assign(file_data.begin() + offset,
-                        file_data.begin() + offset + chunk_size);
-    std::vector<uint8_t> serialized_message = message.serialize_message();
-    int sent = sendto(sockfd.get_sockfd(),
-                      reinterpret_cast<char *>(serialized_message.data()),
-                      serialized_message.size(), 0,
-                      (struct sockaddr *)&sockaddr, sizeof(sockaddr));
-    if (sent < 0) {
-      LOG::safe_print("Failed to send a message");
-      continue;
+  if (!senders.empty())
+    return; // Already sending.
+  transfer_id = message.get_transfer_id();
+  // The rate cap is for the whole transfer.
+  Options stripe_options = options;
+  stripe_options.rate_limit /= message.get_stripes().size();
+  for (const MESG::Stripe &stripe : message.get_stripes()) {
+    std::vector<MESG::SackRange> stripe_resumed;
+    for (const MESG::SackRange &range : resumed) {
+      uint64_t start = std::max(range.start, stripe.first_packet);
+      uint64_t end = std::min(range.end, stripe.end_packet);
+      if (start < end)
+        stripe_resumed.push_back({start, end});
     }
-    can_send_file.store(false);
-    last_send = std::chrono::steady_clock::now();
-    while (should_run && !can_send_file.load()) {
-      auto now = std::chrono::steady_clock::now();
-      std::chrono::duration<double> elapsed = now - last_send;
-      if (elapsed.count() * 1000 >= delay) {
-        break; // Resending a packet.
-      }
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    senders.push_back(std::make_unique<StripeSender>(
+        ip, files, stripe, delay, stripe_options, std::move(stripe_resumed),
+        chunk_sums, compression.get(), [this](bool success) {
+          reactor.post([this, success] { on_stripe_done(success); });
+        }));
+    if (!senders.back()->start()) {
+      stop();
+      return;
     }
-
-    if (can_send_file.load())
-      packet_number++;
   }
+  uint64_t kept = 0;
+  for (const MESG::SackRange &range : resumed)
+    kept += range.end - range.start;
+  if (kept > 0)
+    LOG::safe_print("The server already holds " + std::to_string(kept) +
+                    " packets.");
+  resumed.clear(); // Only for this upload.
+  upload_packets = 0;
+  for (const MESG::Stripe &stripe : message.get_stripes())
+    upload_packets = std::max(upload_packets, stripe.end_packet);
+  kept_packets = kept;
+  progress_acked = 0;
+  if (options.progress > 0)
+    schedule_progress();
+  LOG::safe_print("Sending " + std::to_string(senders.size()) +
+                  " stripes.");
 }
 
-void Client::send_final_message() {
-  if (tcp_socket.get_sockfd() < 0) {
-    LOG::safe_print("TCP socket is not connected.");
-    return;
-  }
-  uint8_t crc_code = CRC::get_crc(filename);
-  MESG::FinalMessage message;
-  message.set_type(MESG::MESSAGE_TYPE_FINAL);
-  message.set_crc_code(crc_code);
-  std::vector<uint8_t> serialized_message = message.serialize_message();
-  int sent = send(tcp_socket.get_sockfd(),
-                  reinterpret_cast<const char *>(serialized_message.data()),
-                  serialized_message.size(), 0);
-  if (sent < 0) {
-    LOG::safe_print("Failed to send final message TCP.");
-  } else {
-    LOG::safe_print("Final message sent. File transfer complete.");
+void Client::schedule_progress() {
+  progress_timer = reactor.add_timer(
+      SCK::Reactor::Clock::now() + std::chrono::seconds(options.progress),
+      [this] {
+        progress_timer = 0;
+        print_progress();
+        schedule_progress();
+      });
+}
+
+void Client::cancel_progress() {
+  if (progress_timer != 0)
+    reactor.cancel_timer(progress_timer);
+  progress_timer = 0;
+}
+
+uint64_t Client::get_acked() const {
+  uint64_t acked = 0;
+  for (const std::unique_ptr<StripeSender> &sender : senders)
+    acked += sender->get_metrics().packets_acked.get();
+  return acked;
+}
+
+// The rate is of the last interval, in full chunks.
+void Client::print_progress() {
+  uint64_t acked = get_acked();
+  uint64_t retransmitted = 0;
+  STAT::Summary rtt;
+  for (const std::unique_ptr<StripeSender> &sender : senders) {
+    retransmitted += sender->get_metrics().retransmitted.get();
+    rtt.add(sender->get_metrics().rtt);
   }
+  char line[128];
+  std::snprintf(
+      line, sizeof(line),
+      "%.1f%% of %llu packets, %.1f Mbit/s, %llu resent, RTT p50 %llu us.",
+      upload_packets == 0 ? 100.0
+                          : 100.0 * (kept_packets + acked) / upload_packets,
+      static_cast<unsigned long long>(upload_packets),
+      STAT::get_megabits((acked - progress_acked) * options.chunk_size,
+                         std::chrono::seconds(options.progress)),
+      static_cast<unsigned long long>(retransmitted),
+      static_cast<unsigned long long>(rtt.get_quantile(0.5)));
+  progress_acked = acked;
+  LOG::safe_print(line);
 }
 
-void Client::stop() { should_run.store(false); }
+// The senders are done and joined, their figures are final.
+void Client::report_metrics() {
+  uint64_t sent = 0, retransmitted = 0, timeouts = 0, parity = 0,
+           wire_bytes = 0, naks = 0;
+  STAT::Summary rtt, crc_time, read_time;
+  for (const std::unique_ptr<StripeSender> &sender : senders) {
+    const SenderMetrics &metrics = sender->get_metrics();
+    sent += metrics.packets_sent.get();
+    retransmitted += metrics.retransmitted.get();
+    timeouts += metrics.timeouts.get();
+    parity += metrics.parity_sent.get();
+    wire_bytes += metrics.wire_bytes.get();
+    naks += metrics.naks.get();
+    rtt.add(metrics.rtt);
+    crc_time.add(sender->get_crc_time());
+    read_time.add(sender->get_read_time());
+  }
+  auto duration = std::chrono::steady_clock::now() - upload_start;
+  uint64_t acked = get_acked();
+  uint64_t new_bytes =
+      std::min<uint64_t>(acked * options.chunk_size, files->size());
+  double goodput = STAT::get_megabits(new_bytes, duration);
+  char line[128];
+  std::snprintf(line, sizeof(line),
+                "Sent %llu packets, %llu resent, %.1f Mbit/s goodput.",
+                static_cast<unsigned long long>(sent),
+                static_cast<unsigned long long>(retransmitted), goodput);
+  LOG::safe_print(line);
+  if (options.metrics_path.empty())
+    return;
+  char id[17];
+  std::snprintf(id, sizeof(id), "%016llx",
+                static_cast<unsigned long long>(transfer_id));
+  STAT::JsonObject json;
+  json.add_text("side", "client");
+  json.add_text("transfer_id", id);
+  json.add_number("files", files->get_count());
+  json.add_number("bytes", files->size());
+  json.add_number("chunk_size", options.chunk_size);
+  json.add_number("stripes", senders.size());
+  json.add_number("duration_ms",
+                  std::chrono::duration_cast<std::chrono::milliseconds>(
+                      duration)
+                      .count());
+  json.add_real("goodput_mbps", std::round(goodput * 10) / 10);
+  json.add_number("packets_total", upload_packets);
+  json.add_number("packets_kept", kept_packets);
+  json.add_number("packets_acked", acked);
+  json.add_number("packets_sent", sent);
+  json.add_number("retransmitted", retransmitted);
+  json.add_number("timeouts", timeouts);
+  json.add_number("naks", naks);
+  json.add_number("parity_sent", parity);
+  json.add_number("wire_bytes", wire_bytes);
+  json.add_summary("rtt_us", rtt);
+  json.add_summary("crc_ns", crc_time);
+  json.add_summary("read_ns", read_time);
+  if (!STAT::append_line(options.metrics_path, json.finish()))
+    LOG::warning("Failed to write the metrics to {}", options.metrics_path);
+}
 
-void Client::fill_file_data(const std::string &path_to_file) {
-  std::ifstream file(path_to_file, std::ios::binary | std::ios::ate);
-  if (!file) {
-    LOG::safe_print("Failed to open a file.");
+// Signatures come in order; the last one lets the client look for the
+// signed blocks in its files.
+void Client::on_signature(const MESG::SignatureMessage &message) {
+  uint32_t block_size = message.get_block_size();
+  if (!DLT::is_valid_block_size(block_size) ||
+      message.get_first_block() != signatures.size()) {
+    LOG::error("Failed to parse a message.");
     stop();
+    return;
   }
-  std::streamsize size = file.tellg();
-  if (size > MAX_FILE_SIZE) {
-    LOG::safe_print("File size is too large.");
+  transfer_id = message.get_transfer_id();
+  signatures.insert(signatures.end(), message.get_blocks().begin(),
+                    message.get_blocks().end());
+  if (signatures.size() >= message.get_base_size() / block_size)
+    send_delta(block_size);
+}
+
+// A file that cannot be read here is sent whole, the stripes report it.
+void Client::send_delta(uint32_t block_size) {
+  std::vector<MESG::DeltaCopy> copies;
+  CRC::ChunkSums sums(options.chunk_size);
+  if (!DLT::match(*files, block_size, signatures, copies, &sums))
+    copies.clear();
+  chunk_sums = std::make_shared<const std::vector<uint32_t>>(
+      sums.finish(files->size()));
+  signatures.clear();
+  uint64_t found = 0;
+  for (const MESG::DeltaCopy &copy : copies)
+    found += copy.length;
+  LOG::safe_print("Delta: " + std::to_string(found) + " of " +
+                  std::to_string(files->size()) +
+                  " bytes are on the server already.");
+  size_t next = 0;
+  do {
+    MESG::DeltaMessage message;
+    message.set_transfer_id(transfer_id);
+    while (next < copies.size() && message.add_copy(copies[next]))
+      next++;
+    message.set_last(next == copies.size());
+    send_control(message);
+  } while (next < copies.size());
+  if (!flush_control()) {
+    LOG::error("Failed to send the delta.");
     stop();
   }
-  file.seekg(0, std::ios::beg);
-  file_data.resize(size);
-  if (!file.read(reinterpret_cast<char *>(file_data.data()), size)) {
-    LOG::safe_print("Failed to read a file.");
+}
+
+// Queued behind the manifest. The server answers with the packets it
+// found, like a resumed upload.
+bool Client::send_chunks() {
+  std::vector<MESG::ChunkHash> chunks;
+  CRC::ChunkSums sums(options.chunk_size);
+  if (!CDC::split(*files, chunks, &sums)) {
+    LOG::error("Failed to read a file chunk.");
     stop();
+    return false;
   }
+  chunk_sums = std::make_shared<const std::vector<uint32_t>>(
+      sums.finish(files->size()));
+  LOG::safe_print("Dedup: " + std::to_string(chunks.size()) + " chunks.");
+  size_t next = 0;
+  do {
+    MESG::ChunkMessage message;
+    message.set_transfer_id(transfer_id);
+    while (next < chunks.size() && message.add_chunk(chunks[next]))
+      next++;
+    message.set_last(next == chunks.size());
+    send_control(message);
+  } while (next < chunks.size());
+  return true;
 }
 
-void Client::parse_message(const std::vector<uint8_t> &data) {
-  MESG::MESSAGE_TYPE type = MESG::get_type(data);
-  std::unique_ptr<MESG::BaseMessage> message = create_message(type);
-  if (message == nullptr) {
-    LOG::safe_print("Failed to parse a message. Wrong type.");
+void Client::on_stripe_done(bool success) {
+  if (finished)
+    return;
+  if (!success) {
+    LOG::error("Failed to send a stripe.");
+    stop();
     return;
   }
-  message->deserialize_message(data);
-  switch (type) {
-  case MESG::MESSAGE_TYPE_CONFIRM: {
-    auto confirm_message = dynamic_cast<MESG::ConfirmMessage *>(message.get());
-    if (confirm_message->get_message_status() == MESG::MESSAGE_SUCCESS)
-      can_send_file.store(true);
-    else {
-      LOG::safe_print("Something went wrong on the server.");
-      stop();
-    }
-    break;
+  if (++done_stripes < senders.size())
+    return;
+  LOG::safe_print("All packets sent.");
+  cancel_progress();
+  report_metrics();
+  send_final_message();
+  senders.clear();
+  done_stripes = 0;
+  if (next_source < sources.size()) {
+    start_upload();
+    return;
   }
-  default: {
-    LOG::safe_print("Failed to match a message type.");
-    break;
+  finished = true;
+  if (!flush_control()) {
+    LOG::error("Failed to send final message TCP.");
+    stop();
+    return;
   }
+  LOG::safe_print("Final message sent.");
+}
+
+// The server's check of the oldest upload not answered yet.
+void Client::on_verdict(const MESG::ConfirmMessage &message) {
+  if (message.get_message_status() != MESG::MESSAGE_SUCCESS ||
+      pending_verdicts == 0) {
+    LOG::error("The server failed to verify an upload, {} packets arrived.",
+               message.get_packet_number());
+    stop();
+    return;
   }
+  if (--pending_verdicts > 0 || !finished)
+    return;
+  succeeded = true;
+  LOG::safe_print("File transfer complete.");
+  stop();
 }
 
-std::unique_ptr<MESG::BaseMessage>
-Client::create_message(MESG::MESSAGE_TYPE type) {
-  switch (type) {
-  case MESG::MESSAGE_TYPE_START:
-    return std::make_unique<MESG::StartMessage>();
-  case MESG::MESSAGE_TYPE_FILE:
-    return std::make_unique<MESG::FileMessage>();
-  case MESG::MESSAGE_TYPE_CONFIRM:
-    return std::make_unique<MESG::ConfirmMessage>();
-  case MESG::MESSAGE_TYPE_FINAL:
-    return std::make_unique<MESG::FinalMessage>();
-  default:
-    return nullptr;
+// The stripes checksummed their ranges while reading them; joined in
+// order they give the stream's.
+void Client::send_final_message() {
+  uint32_t crc_code = 0;
+  uint64_t compressed_from = 0;
+  uint64_t compressed_to = 0;
+  for (const std::unique_ptr<StripeSender> &sender : senders) {
+    uint64_t from = 0;
+    uint64_t to = 0;
+    sender->get_compression(from, to);
+    compressed_from += from;
+    compressed_to += to;
+    const MESG::Stripe &stripe = sender->get_stripe();
+    uint64_t size =
+        std::min(stripe.end_packet * options.chunk_size, files->size()) -
+        std::min(stripe.first_packet * options.chunk_size, files->size());
+    uint32_t checksum = 0;
+    if (!sender->get_checksum(checksum))
+      LOG::error("Failed to read a file chunk.");
+    crc_code = CRC::combine(crc_code, checksum, size);
   }
+  if (compressed_from > 0)
+    LOG::safe_print("Compressed " + std::to_string(compressed_from) +
+                    " bytes to " + std::to_string(compressed_to) + ".");
+  MESG::FinalMessage message;
+  message.set_transfer_id(transfer_id);
+  message.set_crc_code(crc_code);
+  send_control(message);
+  pending_verdicts++;
 }
 
-void Client::listen_tcp() {
-  tcp_socket = SCK::Socket((socket(AF_INET, SOCK_STREAM, 0)));
-  if (tcp_socket.get_sockfd() < 0) {
-    LOG::safe_print("Failed to create a tcp socket.");
-    stop();
+// A final message goes even if the next upload fails to start.
+void Client::stop() {
+  cancel_progress();
+  if (!control_writer.is_empty())
+    flush_control();
+  reactor.stop();
+}
+
+void Client::parse_message(std::span<const uint8_t> data) {
+  bool handled = MESG::dispatch(
+      data, MESG::overloaded{
+                [this](const MESG::ConfirmMessage &message) {
+                  on_verdict(message);
+                },
+                [this](const MESG::ResumeMessage &message) {
+                  // Come right before the accept of the same upload.
+                  resumed.insert(resumed.end(), message.get_ranges().begin(),
+                                 message.get_ranges().end());
+                },
+                [this](const MESG::SignatureMessage &message) {
+                  on_signature(message);
+                },
+                [this](const MESG::AcceptMessage &message) {
+                  on_accept(message);
+                },
+            });
+  if (!handled)
+    LOG::error("Failed to parse a message.");
+}
+
+void Client::on_tcp_event() {
+  int result = control_reader.receive(tcp_socket.get_sockfd());
+  if (result < 0 && SCK::would_block(SCK::last_error()))
     return;
-  }
-  struct sockaddr_in sockaddr;
-  std::memset(&sockaddr, 0, sizeof(sockaddr));
-  sockaddr.sin_family = AF_INET;
-  sockaddr.sin_port = htons(tcp_port);
-  sockaddr.sin_addr.s_addr = inet_addr(ip.c_str());
-  LOG::safe_print("Trying to connect to the server.");
-  if (connect(tcp_socket.get_sockfd(), (struct sockaddr *)&sockaddr,
-              sizeof(sockaddr)) < 0) {
-    LOG::safe_print("Failed to connect to server.");
+  if (result <= 0) {
+    if (!succeeded)
+      LOG::error(result == 0 ? "Server closed a connection."
+                             : "Something went wrong.");
     stop();
     return;
   }
-  LOG::safe_print("Connected to server.");
-  send_message_worker = std::thread(&Client::send_file, this);
-  DWORD timeout = TIMEOUT_IN_SECONDS * 1000;
-  setsockopt(tcp_socket.get_sockfd(), SOL_SOCKET, SO_RCVTIMEO,
-             (const char *)&timeout, sizeof timeout);
-  int result = 0;
-  std::vector<uint8_t> message(BUFFER_MESSAGE_SIZE);
-  while (should_run || result > 0) {
-    result =
-        recv(tcp_socket.get_sockfd(), reinterpret_cast<char *>(message.data()),
-             BUFFER_MESSAGE_SIZE, 0);
-    if (result < 0) {
-      int err = WSAGetLastError();
-      if (err == WSAETIMEDOUT)
-        continue; // Timeout.
-      else {
-        LOG::safe_print("Something went wrong.");
-        stop();
-        return;
-      }
-    }
-    if (result == 0) {
-      LOG::safe_print("Server closed a connection.");
-      stop();
-      return;
-    }
-    message.resize(result);
+  std::span<const uint8_t> message;
+  while (control_reader.next(message))
     parse_message(message);
-    message.resize(BUFFER_MESSAGE_SIZE);
+  if (control_reader.is_broken()) {
+    LOG::error("Failed to parse a message.");
+    stop();
   }
 }
 } // namespace CLN
\ No newline at end of file
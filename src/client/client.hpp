@@ -1,48 +1,102 @@
 #pragma once
 
+#include "compression_pool.hpp"
+#include "control_stream.hpp"
+#include "file_set.hpp"
 #include "message.hpp"
+#include "reactor.hpp"
 #include "socket.hpp"
+#include "stripe_sender.hpp"
+#include "typedef.hpp"
 
-#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
-#include <thread>
+#include <vector>
 
 namespace CLN {
+// A file to send: where it is and the name it gets on the server.
+struct SourceFile {
+  std::string path;
+  std::string name;
+};
+
+// Runs the TCP control connection on its own reactor. The file, or every
+// file below a directory, goes as a series of uploads of up to
+// MAX_MANIFEST_FILES each: announce the manifest, start one StripeSender
+// per stripe the server assigned, send the final message once all of
+// them are done, then the next upload on the same connection. Unless
+// told otherwise, chunks fill the largest datagram that reaches the
+// server unfragmented, as probed once per connection.
 class Client {
-  std::vector<uint8_t> file_data;
-  std::atomic<uint32_t> tcp_port;
-  std::atomic<uint32_t> udp_port;
-  std::atomic<bool> should_run = true;
-  std::atomic<bool> can_send_file = true;
-  std::atomic<uint32_t> delay; // Miliseconds.
-  std::thread send_message_worker;
-  std::thread listen_tcp_worker;
+  uint32_t tcp_port;
+  uint64_t transfer_id = 0; // Assigned by the server.
+  uint32_t delay; // Miliseconds. Initial retransmit timeout.
+  Options options;
+  SCK::Reactor reactor;
+  std::vector<SourceFile> sources;
+  size_t next_source = 0;              // First file of the next upload.
+  std::shared_ptr<FIO::FileSet> files;
+  std::vector<MESG::SackRange> resumed; // Packets the server already has.
+  std::vector<MESG::BlockSignature> signatures; // Of the server's version.
+  // CRCs of the upload's chunks, from the delta or dedup pass.
+  std::shared_ptr<const std::vector<uint32_t>> chunk_sums;
+  std::unique_ptr<CompressionPool> compression; // Outlives the senders.
+  std::vector<std::unique_ptr<StripeSender>> senders;
+  uint32_t done_stripes = 0;
+  bool finished = false;         // Every final message is sent.
+  uint32_t pending_verdicts = 0; // Final messages the server did not answer.
+  bool succeeded = false;        // The server confirmed every upload.
+  std::chrono::steady_clock::time_point upload_start;
+  uint64_t upload_packets = 0; // Of the whole upload.
+  uint64_t kept_packets = 0;   // Resumed, copied or deduplicated.
+  uint64_t progress_timer = 0; // Reactor timer id, 0 if none.
+  uint64_t progress_acked = 0; // Acked packets at the last progress line.
+  std::vector<uint8_t> receive_buffer; // Probe answers.
+  MESG::FrameReader control_reader;
+  MESG::FrameWriter control_writer;
   SCK::Socket tcp_socket;
+  SCK::Socket probe_socket; // UDP, while probing the path MTU.
+  uint64_t probe_timer = 0;
+  uint32_t probe_target = 0; // Largest probe sent.
+  uint32_t probed_size = 0;  // Largest probe answered.
   std::string ip;
-  std::string filename;
+  std::string filename; // A file or a directory.
 
-  void init_winsock();
-  void fill_file_data(const std::string &path_to_file);
-  void listen_tcp();
-  void parse_message(const std::vector<uint8_t> &data);
-  void stop();
-  void send_file();
-  void send_start_message(); // TCP
-  void send_file_data();     // UDP
-  void send_final_message(); // TCP
-  std::unique_ptr<MESG::BaseMessage> create_message(MESG::MESSAGE_TYPE type);
+  bool collect_sources();
+  bool connect_tcp();
+  void probe_path(); // Sizes the chunks unless options did, then starts.
+  void on_probe_event();
+  void end_probe();
+  void on_tcp_event();
+  void parse_message(std::span<const uint8_t> data);
+  void on_accept(const MESG::AcceptMessage &message);
+  void on_signature(const MESG::SignatureMessage &message);
+  void on_verdict(const MESG::ConfirmMessage &message);
+  void send_delta(uint32_t block_size); // TCP
+  bool send_chunks(); // False if it stopped.
+  void on_stripe_done(bool success);
+  void schedule_progress();
+  void print_progress();
+  void cancel_progress();
+  uint64_t get_acked() const; // New packets, by all the senders.
+  void report_metrics();      // Before the senders go.
+  void stop(); // Sends what is queued first.
+  // Control messages queue until flush_control(), so that those of one
+  // step, the final message and the next manifest, leave in one write.
+  template <typename Message> void send_control(const Message &message) {
+    control_writer.add(message);
+  }
+  bool flush_control();
+  void start_upload(); // TCP
+  void send_final_message();
 
 public:
-  void run();
-  Client(std::string ip, uint32_t tcp_port, uint32_t udp_port,
-         std::string filename, uint32_t delay)
-      : ip(ip), tcp_port(tcp_port), udp_port(udp_port), filename(filename),
-        delay(delay) {}
-  ~Client() {
-    if (listen_tcp_worker.joinable())
-      listen_tcp_worker.join();
-    if (send_message_worker.joinable())
-      send_message_worker.join();
-  }
+  bool run(); // True once the server confirmed every upload.
+  Client(std::string ip, uint32_t tcp_port, std::string filename,
+         uint32_t delay, Options options = {})
+      : tcp_port(tcp_port), delay(delay), options(options),
+        receive_buffer(BUFFER_MESSAGE_SIZE), ip(ip), filename(filename) {}
 };
 } // namespace CLN
\ No newline at end of file
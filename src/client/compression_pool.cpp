@@ -0,0 +1,40 @@
+#include "compression_pool.hpp"
+
+namespace CLN {
+CompressionPool::CompressionPool(uint32_t thread_count) {
+  for (uint32_t i = 0; i < thread_count; ++i)
+    threads.emplace_back(&CompressionPool::run, this);
+}
+
+CompressionPool::~CompressionPool() {
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+  }
+  cv.notify_all();
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+void CompressionPool::post(Task task) {
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  cv.notify_one();
+}
+
+void CompressionPool::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    cv.wait(lock, [&] { return !running || !tasks.empty(); });
+    if (tasks.empty())
+      return; // Stopped and drained.
+    Task task = std::move(tasks.front());
+    tasks.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+}
+} // namespace CLN
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CLN {
+// Threads that compress the chunks of every stripe, so compression
+// keeps up with the senders however many there are.
+class CompressionPool {
+public:
+  using Task = std::function<void()>;
+
+private:
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<Task> tasks;
+  bool running = true;
+  std::vector<std::thread> threads;
+
+  void run();
+
+public:
+  explicit CompressionPool(uint32_t thread_count);
+  ~CompressionPool(); // Runs what was posted, then joins.
+  CompressionPool(const CompressionPool &) = delete;
+  CompressionPool &operator=(const CompressionPool &) = delete;
+
+  void post(Task task);
+};
+} // namespace CLN
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include "congestion.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr double INITIAL_WINDOW = 10;
+constexpr double MIN_WINDOW = 2;
+constexpr double RENO_BETA = 0.5;
+constexpr double CUBIC_BETA = 0.7;
+constexpr double CUBIC_C = 0.4;
+constexpr double VEGAS_ALPHA = 2; // Packets queued in the network.
+constexpr double VEGAS_BETA = 4;
+constexpr double VEGAS_GAMMA = 1; // Leave slow start above this.
+// RTT above the base that is only the hosts' scheduling jitter. At
+// sub-millisecond RTTs it would otherwise read as a queue of many packets
+// and keep the window from growing.
+constexpr std::chrono::microseconds VEGAS_MIN_QUEUE_DELAY{500};
+constexpr std::chrono::microseconds PACER_BURST_TIME{1000};
+constexpr uint32_t PACER_BURST_PACKETS = 2;
+
+double seconds(std::chrono::microseconds time) { return time.count() / 1e6; }
+
+class RenoControl : public CLN::CongestionControl {
+  double window = INITIAL_WINDOW;
+  double ssthresh = INFINITY;
+
+public:
+  void on_ack(const CLN::AckSample &sample) override {
+    if (window < ssthresh)
+      window += sample.acked_packets;
+    else
+      window += sample.acked_packets / window;
+  }
+  void on_loss() override {
+    ssthresh = std::max(window * RENO_BETA, MIN_WINDOW);
+    window = ssthresh;
+  }
+  void on_timeout() override {
+    ssthresh = std::max(window * RENO_BETA, MIN_WINDOW);
+    window = MIN_WINDOW;
+  }
+  double get_window() const noexcept override { return window; }
+  bool in_slow_start() const noexcept override { return window < ssthresh; }
+  const char *get_name() const noexcept override { return "reno"; }
+};
+
+// RFC 8312.
+class CubicControl : public CLN::CongestionControl {
+  double window = INITIAL_WINDOW;
+  double ssthresh = INFINITY;
+  double w_max = 0;
+  double k = 0;
+  bool epoch_started = false;
+  std::chrono::steady_clock::time_point epoch_start;
+
+  void reduce() {
+    // Fast convergence: release bandwidth to newer flows.
+    w_max = window < w_max ? window * (1 + CUBIC_BETA) / 2 : window;
+    window = std::max(window * CUBIC_BETA, MIN_WINDOW);
+    ssthresh = window;
+    epoch_started = false;
+  }
+
+public:
+  void on_ack(const CLN::AckSample &sample) override {
+    if (window < ssthresh) {
+      window += sample.acked_packets;
+      return;
+    }
+    if (!epoch_started) {
+      epoch_started = true;
+      epoch_start = sample.now;
+      if (window < w_max)
+        k = std::cbrt((w_max - window) / CUBIC_C);
+      else {
+        k = 0;
+        w_max = window;
+      }
+    }
+    double t = std::chrono::duration<double>(sample.now - epoch_start).count();
+    double rtt = sample.srtt.count() > 0 ? seconds(sample.srtt) : 0.1;
+    double target = CUBIC_C * std::pow(t + rtt - k, 3) + w_max;
+    // Never grow slower than Reno would in the same conditions.
+    double reno = w_max * CUBIC_BETA +
+                  3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * (t / rtt);
+    target = std::max(target, reno);
+    if (target > window)
+      window += (target - window) / window * sample.acked_packets;
+  }
+  void on_loss() override { reduce(); }
+  void on_timeout() override {
+    reduce();
+    window = MIN_WINDOW;
+  }
+  double get_window() const noexcept override { return window; }
+  bool in_slow_start() const noexcept override { return window < ssthresh; }
+  const char *get_name() const noexcept override { return "cubic"; }
+};
+
+// TCP Vegas: keep between alpha and beta packets queued at the bottleneck.
+class VegasControl : public CLN::CongestionControl {
+  double window = INITIAL_WINDOW;
+  double ssthresh = INFINITY;
+  std::chrono::microseconds base_rtt = std::chrono::microseconds::max();
+  std::chrono::microseconds round_min_rtt = std::chrono::microseconds::max();
+  std::chrono::steady_clock::time_point round_end;
+
+public:
+  void on_ack(const CLN::AckSample &sample) override {
+    if (sample.rtt.count() > 0) {
+      base_rtt = std::min(base_rtt, sample.rtt);
+      round_min_rtt = std::min(round_min_rtt, sample.rtt);
+    }
+    if (round_min_rtt == std::chrono::microseconds::max()) {
+      window += sample.acked_packets / window; // No delay signal yet.
+      return;
+    }
+    if (sample.now < round_end) {
+      if (window < ssthresh)
+        window += sample.acked_packets;
+      return;
+    }
+    // Once per round trip compare expected and actual throughput.
+    auto queue_delay = round_min_rtt - base_rtt - VEGAS_MIN_QUEUE_DELAY;
+    double diff = queue_delay.count() <= 0
+                      ? 0
+                      : window * seconds(queue_delay) / seconds(round_min_rtt);
+    if (window < ssthresh && diff > VEGAS_GAMMA)
+      ssthresh = window;
+    if (window >= ssthresh) {
+      if (diff < VEGAS_ALPHA)
+        window += 1;
+      else if (diff > VEGAS_BETA)
+        window = std::max(window - 1, MIN_WINDOW);
+    }
+    round_end = sample.now + round_min_rtt;
+    round_min_rtt = std::chrono::microseconds::max();
+  }
+  void on_loss() override {
+    ssthresh = std::max(window * RENO_BETA, MIN_WINDOW);
+    window = ssthresh;
+  }
+  void on_timeout() override {
+    ssthresh = std::max(window * RENO_BETA, MIN_WINDOW);
+    window = MIN_WINDOW;
+  }
+  double get_window() const noexcept override { return window; }
+  bool in_slow_start() const noexcept override { return window < ssthresh; }
+  const char *get_name() const noexcept override { return "vegas"; }
+};
+} // namespace
+
+namespace CLN {
+std::unique_ptr<CongestionControl>
+create_congestion_control(const std::string &name) {
+  if (name == "reno")
+    return std::make_unique<RenoControl>();
+  if (name == "cubic")
+    return std::make_unique<CubicControl>();
+  if (name == "vegas")
+    return std::make_unique<VegasControl>();
+  return nullptr;
+}
+
+void Pacer::set_rate(double bytes_per_second, uint32_t packet_size) {
+  rate = bytes_per_second;
+  burst = std::max<double>(PACER_BURST_PACKETS * packet_size,
+                           rate * seconds(PACER_BURST_TIME));
+  tokens = std::min(tokens, burst);
+}
+
+void Pacer::refill(std::chrono::steady_clock::time_point now) {
+  if (now <= last_refill)
+    return;
+  tokens = std::min(
+      burst,
+      tokens + rate * std::chrono::duration<double>(now - last_refill).count());
+  last_refill = now;
+}
+
+bool Pacer::try_consume(uint32_t bytes,
+                        std::chrono::steady_clock::time_point now) {
+  if (rate <= 0)
+    return true;
+  refill(now);
+  if (tokens < bytes)
+    return false;
+  tokens -= bytes;
+  return true;
+}
+
+void Pacer::charge(uint32_t bytes, std::chrono::steady_clock::time_point now) {
+  if (rate <= 0)
+    return;
+  refill(now);
+  tokens -= bytes;
+}
+
+std::chrono::steady_clock::time_point
+Pacer::next_send_time(uint32_t bytes,
+                      std::chrono::steady_clock::time_point now) {
+  if (rate <= 0)
+    return now;
+  refill(now);
+  if (tokens >= bytes)
+    return now;
+  return now + std::chrono::microseconds(
+                   static_cast<int64_t>((bytes - tokens) / rate * 1e6) + 1);
+}
+} // namespace CLN
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace CLN {
+struct AckSample {
+  uint32_t acked_packets;         // Newly acked by this ack.
+  std::chrono::microseconds rtt;  // Zero if the ack carried no sample.
+  std::chrono::microseconds srtt; // Zero until the first sample.
+  std::chrono::steady_clock::time_point now;
+};
+
+// Congestion window in packets, driven by acks and loss events.
+class CongestionControl {
+public:
+  virtual ~CongestionControl() = default;
+  virtual void on_ack(const AckSample &sample) = 0;
+  virtual void on_loss() = 0;    // Loss detected by selective acks.
+  virtual void on_timeout() = 0; // Retransmit timer expired.
+  virtual double get_window() const noexcept = 0;
+  virtual bool in_slow_start() const noexcept = 0;
+  virtual const char *get_name() const noexcept = 0;
+};
+
+// "reno" (AIMD), "cubic" or "vegas" (delay based). nullptr if unknown.
+std::unique_ptr<CongestionControl>
+create_congestion_control(const std::string &name);
+
+// Token bucket spreading packets evenly over time.
+class Pacer {
+  double rate = 0; // Bytes per second, 0 = unlimited.
+  double tokens = 0;
+  double burst = 0;
+  std::chrono::steady_clock::time_point last_refill;
+
+  void refill(std::chrono::steady_clock::time_point now);
+
+public:
+  void set_rate(double bytes_per_second, uint32_t packet_size);
+  bool try_consume(uint32_t bytes, std::chrono::steady_clock::time_point now);
+  // Takes the bytes even without tokens; later sends wait off the debt.
+  void charge(uint32_t bytes, std::chrono::steady_clock::time_point now);
+  std::chrono::steady_clock::time_point
+  next_send_time(uint32_t bytes, std::chrono::steady_clock::time_point now);
+};
+} // namespace CLN
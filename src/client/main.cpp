@@ -1,20 +1,97 @@
 #include "client.hpp"
+#include "fec.hpp"
+#include "log.hpp"
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 
 int main(int argc, char **argv) {
-  if (argc < 6 || argc > 6) {
+  if (argc < 5 || argc % 2 != 1) {
     std::cout << "Invalid argument" << std::endl;
     return EXIT_FAILURE;
   }
   std::string ip, filename;
-  uint32_t tcp_port = 0, udp_port = 0;
+  uint32_t tcp_port = 0;
+  CLN::Options options;
   double delay = 0;
   ip = argv[1];
   tcp_port = std::stoi(argv[2]);
-  udp_port = std::stoi(argv[3]);
-  filename = argv[4];
-  delay = std::stoi(argv[5]);
-  CLN::Client client(ip, tcp_port, udp_port, filename, delay);
-  client.run();
-}
\ No newline at end of file
+  filename = argv[3];
+  delay = std::stoi(argv[4]);
+  for (int i = 5; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--window") == 0)
+      options.window_size = std::stoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--rate") == 0)
+      options.rate_limit = std::stod(argv[i + 1]) * 1e6 / 8; // Mbit/s.
+    else if (std::strcmp(argv[i], "--cc") == 0) {
+      options.congestion = argv[i + 1];
+      if (!CLN::create_congestion_control(options.congestion)) {
+        std::cout << "Unknown congestion control: " << argv[i + 1]
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--gso") == 0) {
+      options.segmentation = std::strcmp(argv[i + 1], "on") == 0;
+    } else if (std::strcmp(argv[i], "--stripes") == 0) {
+      options.stripes = std::stoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--delta") == 0) {
+      options.delta = std::strcmp(argv[i + 1], "on") == 0;
+    } else if (std::strcmp(argv[i], "--dedup") == 0) {
+      options.dedup = std::strcmp(argv[i + 1], "on") == 0;
+    } else if (std::strcmp(argv[i], "--compress") == 0) {
+      options.compress = std::strcmp(argv[i + 1], "on") == 0;
+    } else if (std::strcmp(argv[i], "--chunk") == 0) {
+      options.chunk_size = 0; // auto probes the path MTU.
+      if (std::strcmp(argv[i + 1], "auto") != 0) {
+        options.chunk_size = std::stoi(argv[i + 1]);
+        if (options.chunk_size < MIN_CHUNK_SIZE ||
+            options.chunk_size > MAX_CHUNK_SIZE) {
+          std::cout << "Chunk size must be from " << MIN_CHUNK_SIZE << " to "
+                    << MAX_CHUNK_SIZE << " bytes." << std::endl;
+          return EXIT_FAILURE;
+        }
+      }
+    } else if (std::strcmp(argv[i], "--fec") == 0) {
+      // off, auto or <data>:<parity> packets per group.
+      options.fec_group = options.fec_parity = 0;
+      if (std::strcmp(argv[i + 1], "auto") == 0) {
+        options.fec_group = CLN::DEFAULT_FEC_GROUP;
+      } else if (std::strcmp(argv[i + 1], "off") != 0 &&
+                 (std::sscanf(argv[i + 1], "%u:%u", &options.fec_group,
+                              &options.fec_parity) != 2 ||
+                  options.fec_group == 0 ||
+                  options.fec_group > FEC::MAX_GROUP_SIZE ||
+                  options.fec_parity == 0 ||
+                  options.fec_parity > FEC::MAX_PARITY)) {
+        std::cout << "Invalid FEC groups: " << argv[i + 1] << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--metrics") == 0) {
+      options.metrics_path = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--progress") == 0) {
+      options.progress = std::stoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--log") == 0) {
+      if (!LOG::open(argv[i + 1])) {
+        std::cout << "Failed to open the log: " << argv[i + 1] << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--log-level") == 0) {
+      LOG::LEVEL level = LOG::LEVEL_INFO;
+      if (!LOG::parse_level(argv[i + 1], level)) {
+        std::cout << "Unknown log level: " << argv[i + 1] << std::endl;
+        return EXIT_FAILURE;
+      }
+      LOG::set_level(level);
+    } else {
+      std::cout << "Unknown option: " << argv[i] << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (options.delta && options.dedup) {
+    std::cout << "--delta and --dedup cannot be combined." << std::endl;
+    return EXIT_FAILURE;
+  }
+  CLN::Client client(ip, tcp_port, filename, delay, options);
+  return client.run() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
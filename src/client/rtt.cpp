@@ -0,0 +1,40 @@
+#include "rtt.hpp"
+
+#include <algorithm>
+
+namespace {
+constexpr std::chrono::microseconds MIN_RTO{10000};    // Above ack delay.
+constexpr std::chrono::microseconds MAX_RTO{60000000}; // One minute.
+constexpr std::chrono::microseconds CLOCK_GRANULARITY{1000};
+constexpr uint32_t MAX_BACKOFF_SHIFT = 6;
+} // namespace
+
+namespace CLN {
+void RttEstimator::add_sample(std::chrono::microseconds rtt) {
+  if (rtt.count() < 0)
+    return;
+  if (!has_sample) {
+    srtt = rtt;
+    rttvar = rtt / 2;
+    has_sample = true;
+  } else {
+    auto error = srtt > rtt ? srtt - rtt : rtt - srtt;
+    rttvar = (3 * rttvar + error) / 4;
+    srtt = (7 * srtt + rtt) / 8;
+  }
+  backoff_shift = 0; // Fresh sample, the path is alive again.
+}
+
+void RttEstimator::backoff() noexcept {
+  if (backoff_shift < MAX_BACKOFF_SHIFT)
+    backoff_shift++;
+}
+
+std::chrono::microseconds RttEstimator::get_rto() const noexcept {
+  std::chrono::microseconds rto =
+      has_sample ? srtt + std::max(CLOCK_GRANULARITY, 4 * rttvar)
+                 : initial_rto;
+  rto = std::clamp(rto, MIN_RTO, MAX_RTO);
+  return std::min(rto * (1 << backoff_shift), MAX_RTO);
+}
+} // namespace CLN
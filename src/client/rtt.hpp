@@ -0,0 +1,24 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace CLN {
+// Smoothed RTT / RTTVAR estimator with exponential backoff (RFC 6298).
+class RttEstimator {
+  std::chrono::microseconds srtt{0};
+  std::chrono::microseconds rttvar{0};
+  std::chrono::microseconds initial_rto;
+  uint32_t backoff_shift = 0; // RTO is doubled this many times.
+  bool has_sample = false;
+
+public:
+  explicit RttEstimator(std::chrono::microseconds initial_rto)
+      : initial_rto(initial_rto) {}
+  void add_sample(std::chrono::microseconds rtt);
+  void backoff() noexcept;
+  std::chrono::microseconds get_rto() const noexcept;
+  std::chrono::microseconds get_srtt() const noexcept { return srtt; }
+  std::chrono::microseconds get_rttvar() const noexcept { return rttvar; }
+};
+} // namespace CLN
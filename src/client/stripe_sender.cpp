@@ -0,0 +1,497 @@
+#include "stripe_sender.hpp"
+#include "crc.hpp"
+#include "fec.hpp"
+#include "log.hpp"
+#include "typedef.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// A packet is lost once this many later packets were acked.
+constexpr uint32_t REORDER_THRESHOLD = 3;
+// Chunks read beyond the send window.
+constexpr uint32_t READ_AHEAD_CHUNKS = 64;
+constexpr double PACING_GAIN = 1.25;
+constexpr double PACING_GAIN_SLOW_START = 2.0;
+// First sends per loss rate sample, and the weight of a new sample.
+constexpr uint64_t LOSS_SAMPLE_PACKETS = 256;
+constexpr double LOSS_SAMPLE_WEIGHT = 0.25;
+} // namespace
+
+namespace CLN {
+
+StripeSender::StripeSender(std::string ip,
+                           std::shared_ptr<const FIO::FileSet> files,
+                           const MESG::Stripe &stripe, uint32_t delay,
+                           Options options,
+                           std::vector<MESG::SackRange> resumed,
+                           std::shared_ptr<const std::vector<uint32_t>> sums,
+                           CompressionPool *compression, DoneHandler on_done)
+    : stripe(stripe), delay(delay), options(options),
+      packet_wire_size(options.chunk_size + MESG::FILE_HEADER_SIZE),
+      on_done(std::move(on_done)), rtt(std::chrono::milliseconds(delay)),
+      congestion(create_congestion_control(options.congestion)),
+      highest_acked(stripe.first_packet),
+      recovery_point(stripe.first_packet), resumed(std::move(resumed)),
+      window_base(stripe.first_packet),
+      next_packet(stripe.first_packet), receive_buffer(BUFFER_MESSAGE_SIZE),
+      ip(std::move(ip)) {
+  reader.open(std::move(files), options.chunk_size, compression,
+              std::move(sums));
+  if (this->options.window_size == 0)
+    this->options.window_size =
+        std::max(1u, DEFAULT_WINDOW_BYTES / options.chunk_size);
+  if (!congestion)
+    congestion = create_congestion_control("cubic");
+}
+
+StripeSender::~StripeSender() { stop(); }
+
+bool StripeSender::start() {
+  if (!reactor.is_valid() || !open_udp())
+    return false;
+  send_batch.set_segmentation(options.segmentation);
+  reader.start(options.window_size + READ_AHEAD_CHUNKS, stripe.first_packet,
+               stripe.end_packet);
+  reactor.post([this] { pump(); });
+  thread = std::thread([this] { reactor.run(); });
+  return true;
+}
+
+void StripeSender::stop() {
+  reactor.stop();
+  if (thread.joinable())
+    thread.join();
+  reader.stop();
+}
+
+bool StripeSender::open_udp() {
+  udp_socket = SCK::Socket(socket(AF_INET, SOCK_DGRAM, 0));
+  if (udp_socket.get_sockfd() < 0) {
+    LOG::error("Failed to create a udp socket. {}", SCK::last_error());
+    return false;
+  }
+  // Any port, the server answers to our address.
+  struct sockaddr_in local_addr = SCK::make_address("0.0.0.0", 0);
+  if (bind(udp_socket.get_sockfd(), (struct sockaddr *)&local_addr,
+           sizeof(local_addr)) < 0 ||
+      !SCK::set_nonblocking(udp_socket.get_sockfd())) {
+    LOG::error("Failed to bind a udp socket. {}", SCK::last_error());
+    return false;
+  }
+  server_udp_addr = SCK::make_address(ip, stripe.port);
+  return reactor.add(udp_socket.get_sockfd(), SCK::EVENT_READ,
+                     [this](uint32_t events) { on_udp_event(events); });
+}
+
+void StripeSender::finish(bool success) {
+  if (finished)
+    return;
+  finished = true;
+  if (send_timer != 0)
+    reactor.cancel_timer(send_timer);
+  send_timer = 0;
+  reactor.stop();
+  on_done(success);
+}
+
+void StripeSender::pump() {
+  if (finished || waiting_writable)
+    return;
+  // With nothing in flight a resumed range is skipped as a whole.
+  while (window.empty() && resumed_end(next_packet) != 0) {
+    next_packet = window_base = resumed_end(next_packet);
+    reader.release(window_base);
+  }
+  if (window_base >= stripe.end_packet) {
+    finish(true);
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  auto rto = rtt.get_rto();
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  update_pacing_rate();
+  bool timed_out = false;
+  bool paced = false;
+  // Selective retransmit: packets reported missing by SACK, whose timer
+  // expired or that arrived corrupted.
+  for (uint64_t i = 0; i < window.size() && !waiting_writable; ++i) {
+    PacketState &state = window[i];
+    if (state.acked)
+      continue;
+    uint64_t packet_number = window_base + i;
+    // With FEC the server first gets its group's parity to rebuild it.
+    bool lost = !state.lost && get_group_end(packet_number) +
+                                       REORDER_THRESHOLD <
+                                   highest_acked;
+    bool expired = now - state.last_send >= rto;
+    if (lost || expired || state.corrupted) {
+      uint32_t wire_size = get_wire_size(packet_number);
+      if (!paced && !pacer.try_consume(wire_size, now)) {
+        paced = true;
+        deadline = std::min(deadline, pacer.next_send_time(wire_size, now));
+      }
+      if (paced)
+        continue; // Retried at the next pacing slot.
+      if (!send_packet(packet_number))
+        return;
+      metrics.retransmitted.add();
+      if (expired)
+        metrics.timeouts.add();
+      if (lost || expired) { // Corruption is no sign of congestion.
+        on_loss_event(packet_number, expired);
+        if (state.retransmits == 0)
+          sample_lost++;
+      }
+      state.corrupted = false;
+      state.last_send = now;
+      state.retransmits++;
+      state.lost = true;
+      timed_out |= expired;
+    }
+    deadline = std::min(deadline, state.last_send + rto);
+  }
+  if (timed_out)
+    rtt.backoff();
+  update_loss_rate();
+  while (!paced && !waiting_writable && next_packet < stripe.end_packet &&
+         next_packet < window_base + options.window_size &&
+         in_flight < congestion->get_window()) {
+    if (resumed_end(next_packet) != 0) {
+      PacketState state;
+      state.acked = true;
+      window.push_back(state);
+      next_packet++;
+      continue;
+    }
+    uint32_t wire_size = get_wire_size(next_packet);
+    if (!pacer.try_consume(wire_size, now)) {
+      paced = true;
+      deadline = std::min(deadline, pacer.next_send_time(wire_size, now));
+      break;
+    }
+    if (!send_packet(next_packet))
+      return;
+    if (options.fec_group != 0)
+      protect_packet(next_packet);
+    sample_sent++;
+    PacketState state;
+    state.last_send = now;
+    window.push_back(state);
+    next_packet++;
+    in_flight++;
+    deadline = std::min(deadline, now + rto);
+  }
+  advance_window(); // Past resumed packets.
+  if (!waiting_writable)
+    flush_batch();
+  if (window_base >= stripe.end_packet) {
+    finish(true);
+    return;
+  }
+  // Woken again by a pacing slot, the earliest retransmit timer, an ack or
+  // free space in the send buffer.
+  schedule_pump(deadline);
+}
+
+void StripeSender::schedule_pump(
+    std::chrono::steady_clock::time_point deadline) {
+  if (send_timer != 0 && send_deadline == deadline)
+    return;
+  if (send_timer != 0)
+    reactor.cancel_timer(send_timer);
+  send_timer = 0;
+  if (deadline == std::chrono::steady_clock::time_point::max())
+    return;
+  send_deadline = deadline;
+  send_timer = reactor.add_timer(deadline, [this] {
+    send_timer = 0;
+    pump();
+  });
+}
+
+// Returns false, and gives up the stripe, if the chunk cannot be read.
+bool StripeSender::send_packet(uint64_t packet_number) {
+  const Chunk *chunk = reader.get(packet_number);
+  if (chunk == nullptr) {
+    finish(false);
+    return false;
+  }
+  MESG::FileMessage message;
+  message.transfer_id = stripe.stripe_id;
+  message.packet_number = packet_number;
+  message.timestamp = timestamp_now();
+  message.checksum = chunk->checksum;
+  if (chunk->compressed.empty()) {
+    message.data = chunk->data;
+  } else {
+    message.encoding = MESG::FILE_ENCODING_LZ;
+    message.data = chunk->compressed;
+  }
+  auto &header = file_headers[send_batch.size()];
+  uint32_t header_size = MESG::encode_file_header(header, message);
+  send_batch.add(std::span(header.data(), header_size), message.data);
+  metrics.packets_sent.add();
+  metrics.wire_bytes.add(header_size + message.data.size());
+  if (send_batch.is_full())
+    flush_batch();
+  return true;
+}
+
+// Groups are counted from the stripe's first packet. A group that was not
+// sent whole, around resumed packets, gets no parity.
+void StripeSender::protect_packet(uint64_t packet_number) {
+  uint64_t index = (packet_number - stripe.first_packet) % options.fec_group;
+  uint64_t first = packet_number - index;
+  if (index == 0 || first != group_first) {
+    group_first = first;
+    group_broken = index != 0;
+    group_parity = get_parity_count();
+    if (parity.empty() && !spare_parity.empty()) {
+      parity = std::move(spare_parity.back());
+      spare_parity.pop_back();
+    }
+    parity.assign(size_t(group_parity) * options.chunk_size, 0);
+  } else if (packet_number != group_next) {
+    group_broken = true;
+  }
+  group_next = packet_number + 1;
+  const Chunk *chunk = reader.get(packet_number);
+  if (group_broken || chunk == nullptr)
+    return;
+  FEC::encode(parity, group_parity, static_cast<uint32_t>(index),
+              chunk->data, options.chunk_size);
+  if (group_next == get_group_end(packet_number))
+    send_parity();
+}
+
+// Parity is best effort: what does not fit a full socket is dropped. It
+// takes pacing tokens but no congestion window.
+void StripeSender::send_parity() {
+  auto now = std::chrono::steady_clock::now();
+  for (uint32_t j = 0; j < group_parity && !waiting_writable; ++j) {
+    MESG::ParityMessage message;
+    message.transfer_id = stripe.stripe_id;
+    message.first_packet = group_first;
+    message.group_size = static_cast<uint32_t>(group_next - group_first);
+    message.parity_index = j;
+    message.data = std::span(parity).subspan(size_t(j) * options.chunk_size,
+                                             options.chunk_size);
+    message.checksum =
+        CRC::get_crc32c(message.data.data(), message.data.size());
+    auto &header = file_headers[send_batch.size()];
+    uint32_t header_size = MESG::encode_parity_header(header, message);
+    send_batch.add(std::span(header.data(), header_size), message.data);
+    metrics.parity_sent.add();
+    metrics.wire_bytes.add(header_size + message.data.size());
+    pacer.charge(packet_wire_size, now);
+    if (send_batch.is_full())
+      flush_batch();
+  }
+  queued_parity.push_back(std::move(parity));
+  parity.clear();
+  group_broken = true; // Sent.
+}
+
+// Parity for about twice the expected losses of a group, at least one.
+uint32_t StripeSender::get_parity_count() const {
+  if (options.fec_parity != 0)
+    return options.fec_parity;
+  double expected = loss_rate * options.fec_group;
+  return std::clamp(static_cast<uint32_t>(std::ceil(2 * expected)) + 1, 1u,
+                    FEC::MAX_PARITY);
+}
+
+uint64_t StripeSender::get_group_end(uint64_t packet_number) const {
+  if (options.fec_group == 0)
+    return packet_number + 1;
+  uint64_t index = (packet_number - stripe.first_packet) % options.fec_group;
+  return std::min(packet_number - index + options.fec_group,
+                  stripe.end_packet);
+}
+
+// Losses are first sends that were retransmitted or rebuilt by the server.
+void StripeSender::update_loss_rate() {
+  if (sample_sent < LOSS_SAMPLE_PACKETS)
+    return;
+  double rate = std::min(1.0, double(sample_lost) / double(sample_sent));
+  loss_rate += LOSS_SAMPLE_WEIGHT * (rate - loss_rate);
+  sample_sent = sample_lost = 0;
+}
+
+uint32_t StripeSender::get_wire_size(uint64_t packet_number) {
+  const Chunk *chunk = reader.get(packet_number);
+  if (chunk == nullptr || chunk->compressed.empty())
+    return packet_wire_size; // A short last chunk is close enough.
+  return MESG::FILE_HEADER_SIZE + chunk->compressed.size();
+}
+
+// Returns false if the socket is full; on_udp_event flushes the rest once
+// it is writable again.
+bool StripeSender::flush_batch() {
+  int sent = send_batch.flush(udp_socket.get_sockfd(), server_udp_addr);
+  if (options.segmentation && !send_batch.uses_segmentation()) {
+    LOG::safe_print("UDP segmentation offload is not available.");
+    options.segmentation = false;
+  }
+  if (sent < 0) // Dropped, the retransmit timers recover.
+    LOG::warning("Failed to send a message. {}", SCK::last_error());
+  if (sent < 0 || send_batch.is_empty()) {
+    for (std::vector<uint8_t> &buffer : queued_parity)
+      spare_parity.push_back(std::move(buffer));
+    queued_parity.clear();
+    return true;
+  }
+  waiting_writable = true;
+  reactor.modify(udp_socket.get_sockfd(), SCK::EVENT_READ | SCK::EVENT_WRITE);
+  return false;
+}
+
+void StripeSender::on_ack(const MESG::AckMessage &message) {
+  AckSample sample = {};
+  sample.now = std::chrono::steady_clock::now();
+  if (message.get_echo_timestamp() != 0) {
+    int32_t rtt_sample = static_cast<int32_t>(
+        timestamp_now() - message.get_echo_timestamp() -
+        message.get_ack_delay());
+    sample.rtt = std::chrono::microseconds(rtt_sample);
+    rtt.add_sample(sample.rtt);
+    if (rtt_sample > 0)
+      metrics.rtt.record(rtt_sample);
+  }
+  uint32_t in_flight_before = in_flight;
+  uint64_t window_end = window_base + window.size();
+  uint64_t cumulative = std::min(message.get_cumulative(), window_end);
+  for (uint64_t i = window_base; i < cumulative; ++i)
+    mark_acked(i);
+  for (const MESG::SackRange &range : message.get_ranges()) {
+    uint64_t start = std::max(range.start, window_base);
+    uint64_t end = std::min(range.end, window_end);
+    for (uint64_t i = start; i < end; ++i)
+      mark_acked(i);
+  }
+  // Packets the server rebuilt count as lost for the parity to send.
+  uint32_t recovered = message.get_recovered() - last_recovered;
+  if (static_cast<int32_t>(recovered) > 0) {
+    sample_lost += recovered;
+    last_recovered = message.get_recovered();
+  }
+  sample.acked_packets = in_flight_before - in_flight;
+  sample.srtt = rtt.get_srtt();
+  if (sample.acked_packets > 0)
+    congestion->on_ack(sample);
+  advance_window();
+}
+
+void StripeSender::on_nak(const MESG::NakMessage &message) {
+  uint64_t packet_number = message.get_packet_number();
+  if (packet_number < window_base ||
+      packet_number >= window_base + window.size())
+    return;
+  PacketState &state = window[packet_number - window_base];
+  metrics.naks.add();
+  if (!state.acked)
+    state.corrupted = true;
+}
+
+void StripeSender::mark_acked(uint64_t packet_number) {
+  PacketState &state = window[packet_number - window_base];
+  if (state.acked)
+    return;
+  state.acked = true;
+  in_flight--;
+  metrics.packets_acked.add();
+  highest_acked = std::max(highest_acked, packet_number + 1);
+}
+
+// One window reduction per round
+// trip: losses of packets sent before the previous reduction are ignored.
+void StripeSender::on_loss_event(uint64_t packet_number, bool timeout) {
+  if (packet_number < recovery_point)
+    return;
+  recovery_point = next_packet;
+  LOG::debug(timeout ? "Stripe {}: timeout at packet {}."
+                     : "Stripe {}: loss at packet {}.",
+             stripe.stripe_id, packet_number);
+  if (timeout)
+    congestion->on_timeout();
+  else
+    congestion->on_loss();
+}
+
+void StripeSender::update_pacing_rate() {
+  double rate = 0;
+  auto srtt = rtt.get_srtt();
+  if (srtt.count() > 0) {
+    double gain = congestion->in_slow_start() ? PACING_GAIN_SLOW_START
+                                              : PACING_GAIN;
+    rate = gain * congestion->get_window() * packet_wire_size /
+           (srtt.count() / 1e6);
+  }
+  if (options.rate_limit > 0)
+    rate = rate > 0 ? std::min(rate, options.rate_limit) : options.rate_limit;
+  pacer.set_rate(rate, packet_wire_size);
+}
+
+uint32_t StripeSender::timestamp_now() const {
+  return static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start_time)
+          .count());
+}
+
+// Datagrams still queued point into their chunks, which stay until the
+// batch has drained.
+void StripeSender::advance_window() {
+  while (!window.empty() && window.front().acked) {
+    window.pop_front();
+    window_base++;
+  }
+  if (!waiting_writable)
+    reader.release(window_base);
+}
+
+uint64_t StripeSender::resumed_end(uint64_t packet_number) {
+  while (next_resumed < resumed.size() &&
+         resumed[next_resumed].end <= packet_number)
+    next_resumed++;
+  if (next_resumed == resumed.size() ||
+      resumed[next_resumed].start > packet_number)
+    return 0;
+  return resumed[next_resumed].end;
+}
+
+void StripeSender::on_udp_event(uint32_t events) {
+  if ((events & SCK::EVENT_WRITE) && waiting_writable) {
+    waiting_writable = false;
+    reactor.modify(udp_socket.get_sockfd(), SCK::EVENT_READ);
+    if (flush_batch())
+      reader.release(window_base); // Held back while queued.
+  }
+  std::vector<uint8_t> &message = receive_buffer;
+  // Drain every queued ack before sending again.
+  while (events & (SCK::EVENT_READ | SCK::EVENT_ERROR)) {
+    int result =
+        recv(udp_socket.get_sockfd(), reinterpret_cast<char *>(message.data()),
+             message.size(), 0);
+    if (result < 0) {
+      int err = SCK::last_error();
+      if (!SCK::would_block(err))
+        LOG::warning("Failed to receive an ack. {}", err);
+      break;
+    }
+    MESG::dispatch(std::span<const uint8_t>(message.data(), result),
+                   MESG::overloaded{
+                       [this](const MESG::AckMessage &message) {
+                         if (message.get_transfer_id() == stripe.stripe_id)
+                           on_ack(message);
+                       },
+                       [this](const MESG::NakMessage &message) {
+                         if (message.get_transfer_id() == stripe.stripe_id)
+                           on_nak(message);
+                       }});
+  }
+  pump();
+}
+} // namespace CLN
\ No newline at end of file
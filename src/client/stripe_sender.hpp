@@ -0,0 +1,189 @@
+#pragma once
+
+#include "chunk_reader.hpp"
+#include "congestion.hpp"
+#include "datagram_batch.hpp"
+#include "message.hpp"
+#include "metrics.hpp"
+#include "reactor.hpp"
+#include "rtt.hpp"
+#include "socket.hpp"
+#include "typedef.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace CLN {
+// Bytes in flight at most unless a window is given in packets.
+constexpr uint32_t DEFAULT_WINDOW_BYTES = 1024 * BUFFER_MESSAGE_SIZE;
+constexpr uint32_t DEFAULT_FEC_GROUP = 32;     // Data packets, --fec auto.
+
+struct Options {
+  uint32_t window_size = 0; // Max packets in flight, 0 = by the bytes.
+  double rate_limit = 0; // Bytes per second, 0 = no cap.
+  std::string congestion = "cubic";
+  uint32_t chunk_size = 0;   // File data per packet, 0 = by path MTU.
+  bool segmentation = false; // UDP GSO, needs a path MTU above a packet.
+  uint32_t stripes = 1;      // Parallel flows asked for, the server decides.
+  bool delta = false; // Only send what the server's old version lacks.
+  bool dedup = false; // Skip chunks the server stores from other uploads.
+  bool compress = false; // Chunks that shrink go compressed.
+  uint32_t fec_group = 0;  // Data packets per parity group, 0 = no FEC.
+  uint32_t fec_parity = 0; // Parity packets per group, 0 = by loss rate.
+  uint32_t progress = 0;    // Seconds between progress lines, 0 = none.
+  std::string metrics_path; // A JSON line per upload, empty = none.
+};
+
+// Filled in by the sender thread, read by the client's.
+struct SenderMetrics {
+  STAT::Counter packets_sent;  // File packets, resent ones too.
+  STAT::Counter retransmitted; // Lost, timed out or corrupted.
+  STAT::Counter timeouts;      // Retransmits on an expired timer.
+  STAT::Counter parity_sent;
+  STAT::Counter wire_bytes; // Headers and payload as sent.
+  STAT::Counter packets_acked;
+  STAT::Counter naks;
+  STAT::Histogram rtt; // Microseconds, the ack delay taken out.
+};
+
+// Retransmit state of one packet inside the send window.
+struct PacketState {
+  std::chrono::steady_clock::time_point last_send;
+  uint32_t retransmits = 0;
+  bool acked = false;
+  bool lost = false; // Already fast-retransmitted.
+  bool corrupted = false; // NAKed by the server, resent right away.
+};
+
+// Sends one stripe of the file: its own thread and reactor, UDP socket,
+// window, congestion control and pacing, and a chunk reader over just
+// its packet range. Stripes of one file share nothing, so they scale
+// with the cores on both ends.
+class StripeSender {
+public:
+  // Called once from the sender thread, true if every packet was acked.
+  using DoneHandler = std::function<void(bool success)>;
+
+private:
+  MESG::Stripe stripe;
+  uint32_t delay; // Miliseconds. Initial retransmit timeout.
+  Options options;
+  // Header plus a full chunk. Compressed packets are paced at their size,
+  // so under a rate cap they go out that much faster.
+  uint32_t packet_wire_size;
+  DoneHandler on_done;
+  SCK::Reactor reactor;
+  RttEstimator rtt;
+  std::unique_ptr<CongestionControl> congestion;
+  Pacer pacer;
+  uint32_t in_flight = 0;      // Sent and not acked.
+  uint64_t highest_acked = 0;  // One past the highest acked packet.
+  uint64_t recovery_point = 0; // Losses below it belong to the last event.
+  const std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+  std::vector<MESG::SackRange> resumed; // Kept by the server, never sent.
+  size_t next_resumed = 0;              // First range not behind us.
+  std::deque<PacketState> window; // Packets [window_base, next_packet).
+  uint64_t window_base = 0;
+  uint64_t next_packet = 0;
+  uint64_t send_timer = 0; // Reactor timer id, 0 if none.
+  std::chrono::steady_clock::time_point send_deadline;
+  bool waiting_writable = false; // UDP send buffer was full.
+  bool finished = false;
+  ChunkReader reader;
+  SCK::SendBatch send_batch;
+  // One per batch slot, alive until the batch was flushed.
+  std::array<std::array<uint8_t, std::max(MESG::FILE_HEADER_SIZE,
+                                          MESG::PARITY_HEADER_SIZE)>,
+             SCK::BATCH_SIZE>
+      file_headers;
+  // FEC: parity of the group being sent, added up as its packets first go
+  // out, then sent behind them.
+  uint64_t group_first = 0;
+  uint64_t group_next = 0;   // Packet expected next.
+  uint32_t group_parity = 0; // Parity chunks of the group.
+  bool group_broken = true;  // Not all of it was sent (resumed), no parity.
+  std::vector<uint8_t> parity;
+  std::vector<std::vector<uint8_t>> queued_parity; // Views in send_batch.
+  std::vector<std::vector<uint8_t>> spare_parity;
+  // Loss rate of first sends, sizes the parity if not fixed.
+  double loss_rate = 0;
+  uint64_t sample_sent = 0;
+  uint64_t sample_lost = 0;
+  uint32_t last_recovered = 0; // The server's count.
+  SenderMetrics metrics;
+  std::vector<uint8_t> receive_buffer; // Acks.
+  SCK::Socket udp_socket; // Sends file packets, receives acks.
+  struct sockaddr_in server_udp_addr;
+  std::string ip;
+  std::thread thread;
+
+  bool open_udp();
+  void on_udp_event(uint32_t events);
+  void on_ack(const MESG::AckMessage &message);
+  void on_nak(const MESG::NakMessage &message);
+  void advance_window();
+  // End of the resumed range packet_number is in, 0 if none. Only asked
+  // for increasing packets.
+  uint64_t resumed_end(uint64_t packet_number);
+  // Header and payload, as sent; full size if the chunk is not readable.
+  uint32_t get_wire_size(uint64_t packet_number);
+  void mark_acked(uint64_t packet_number);
+  void on_loss_event(uint64_t packet_number, bool timeout);
+  uint32_t timestamp_now() const; // Microseconds since start, wraps.
+  void update_pacing_rate();
+  bool send_packet(uint64_t packet_number); // Queued into send_batch.
+  // Adds a first sent packet to its FEC group, sends the group's parity
+  // after its last one.
+  void protect_packet(uint64_t packet_number);
+  void send_parity();
+  uint32_t get_parity_count() const;
+  // One past the FEC group packet_number is in.
+  uint64_t get_group_end(uint64_t packet_number) const;
+  void update_loss_rate();
+  bool flush_batch();
+  void pump(); // Sends what window, pacer and timers allow.
+  void schedule_pump(std::chrono::steady_clock::time_point deadline);
+  void finish(bool success);
+
+public:
+  // Resumed ranges are sorted and inside the stripe; sums, if any, are
+  // the CRCs of every chunk of the files. Chunks are compressed on the
+  // pool if there is one.
+  StripeSender(std::string ip, std::shared_ptr<const FIO::FileSet> files,
+               const MESG::Stripe &stripe, uint32_t delay, Options options,
+               std::vector<MESG::SackRange> resumed,
+               std::shared_ptr<const std::vector<uint32_t>> sums,
+               CompressionPool *compression, DoneHandler on_done);
+  ~StripeSender();
+  StripeSender(const StripeSender &) = delete;
+  StripeSender &operator=(const StripeSender &) = delete;
+
+  bool start(); // Opens the socket, starts the thread.
+  void stop();  // Joins the sender, not from its own thread.
+  const MESG::Stripe &get_stripe() const noexcept { return stripe; }
+  // CRC-32C of the stripe's bytes, read while sending. Blocks until the
+  // reader is through; false on a read error.
+  bool get_checksum(uint32_t &checksum) {
+    return reader.get_checksum(checksum);
+  }
+  void get_compression(uint64_t &from, uint64_t &to) {
+    reader.get_compression(from, to);
+  }
+  const SenderMetrics &get_metrics() const noexcept { return metrics; }
+  const STAT::Histogram &get_read_time() const noexcept {
+    return reader.get_read_time();
+  }
+  const STAT::Histogram &get_crc_time() const noexcept {
+    return reader.get_crc_time();
+  }
+};
+} // namespace CLN
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "chunk_store.hpp"
+#include "crc.hpp"
+#include "file_io.hpp"
+#include "log.hpp"
+
+#include <cstring>
+#include <filesystem>
+
+namespace {
+constexpr uint32_t RECORD_MAGIC = 0x4643484B; // "FCHK"
+
+// One record per upload: magic, names, chunks and a CRC-32C of the rest.
+std::vector<uint8_t> encode_record(const std::vector<std::string> &names,
+                                   const std::vector<MESG::ChunkHash> &chunks) {
+  size_t size = 12 + chunks.size() * MESG::CHUNK_ENTRY_SIZE + 4;
+  for (const std::string &name : names)
+    size += 4 + name.size();
+  std::vector<uint8_t> buffer(size);
+  uint32_t offset = 0;
+  MESG::put_uint32(buffer, offset, RECORD_MAGIC);
+  MESG::put_uint32(buffer, offset, names.size());
+  for (const std::string &name : names) {
+    MESG::put_uint32(buffer, offset, name.size());
+    std::memcpy(buffer.data() + offset, name.data(), name.size());
+    offset += name.size();
+  }
+  MESG::put_uint32(buffer, offset, chunks.size());
+  for (const MESG::ChunkHash &chunk : chunks) {
+    MESG::put_uint32(buffer, offset, chunk.length);
+    std::memcpy(buffer.data() + offset, chunk.strong.data(),
+                chunk.strong.size());
+    offset += chunk.strong.size();
+  }
+  MESG::put_uint32(buffer, offset, CRC::get_crc32c(buffer.data(), offset));
+  return buffer;
+}
+
+// False for a damaged or torn record.
+bool decode_record(std::span<const uint8_t> buffer, uint32_t &offset,
+                   std::vector<std::string> &names,
+                   std::vector<MESG::ChunkHash> &chunks) {
+  uint32_t start = offset;
+  auto left = [&] { return buffer.size() - offset; };
+  if (left() < 8 || MESG::get_uint32(buffer, offset) != RECORD_MAGIC)
+    return false;
+  uint32_t name_count = MESG::get_uint32(buffer, offset);
+  if (name_count == 0 || name_count > MESG::MAX_MANIFEST_FILES)
+    return false;
+  for (uint32_t i = 0; i < name_count; ++i) {
+    if (left() < 4)
+      return false;
+    uint32_t length = MESG::get_uint32(buffer, offset);
+    if (length > left())
+      return false;
+    names.emplace_back(
+        reinterpret_cast<const char *>(buffer.data() + offset), length);
+    offset += length;
+  }
+  if (left() < 4)
+    return false;
+  uint32_t chunk_count = MESG::get_uint32(buffer, offset);
+  if (chunk_count > left() / MESG::CHUNK_ENTRY_SIZE)
+    return false;
+  chunks.resize(chunk_count);
+  for (MESG::ChunkHash &chunk : chunks) {
+    chunk.length = MESG::get_uint32(buffer, offset);
+    std::memcpy(chunk.strong.data(), buffer.data() + offset,
+                chunk.strong.size());
+    offset += chunk.strong.size();
+  }
+  if (left() < 4)
+    return false;
+  uint32_t checksum = CRC::get_crc32c(buffer.data() + start, offset - start);
+  return MESG::get_uint32(buffer, offset) == checksum;
+}
+} // namespace
+
+namespace SRV {
+
+size_t ChunkStore::KeyHash::operator()(const Key &key) const noexcept {
+  size_t hash;
+  std::memcpy(&hash, key.data(), sizeof(hash)); // Already random.
+  return hash;
+}
+
+void ChunkStore::open(const std::string &new_directory) {
+  const std::lock_guard<std::mutex> lock(mutex);
+  directory = new_directory;
+  path = (std::filesystem::path(directory) / CHUNK_INDEX).string();
+  FIO::File file;
+  if (!file.open_read(path))
+    return;
+  uint64_t size = file.size();
+  if (size == 0)
+    return;
+  std::vector<uint8_t> buffer(size < UINT32_MAX ? size : 0);
+  if (buffer.empty() ||
+      file.read_at(0, buffer.data(), size) != static_cast<int64_t>(size)) {
+    LOG::warning("Failed to read the chunk index.");
+    return;
+  }
+  file.close();
+  uint32_t offset = 0;
+  while (offset < buffer.size()) {
+    Upload upload;
+    if (!decode_record(buffer, offset, upload.names, upload.chunks))
+      break;
+    insert(std::move(upload));
+  }
+  if (offset < buffer.size() || dropped > 0)
+    compact(); // Without the damaged tail or the replaced uploads.
+  LOG::safe_print("Chunk index: " + std::to_string(index.size()) +
+                  " chunks of " + std::to_string(uploads.size()) +
+                  " uploads.");
+}
+
+bool ChunkStore::find(const Key &strong, ChunkSource &source) const {
+  const std::lock_guard<std::mutex> lock(mutex);
+  auto found = index.find(strong);
+  if (found == index.end())
+    return false;
+  source.paths.clear();
+  for (const std::string &name : uploads[found->second.upload].names)
+    source.paths.push_back(
+        (std::filesystem::path(directory) / name).string());
+  source.offset = found->second.offset;
+  source.length = found->second.length;
+  return true;
+}
+
+void ChunkStore::add(const std::vector<std::string> &paths,
+                     const std::vector<MESG::ChunkHash> &chunks) {
+  if (chunks.empty())
+    return;
+  Upload upload;
+  for (const std::string &file_path : paths)
+    upload.names.push_back(std::filesystem::path(file_path)
+                               .lexically_relative(directory)
+                               .generic_string());
+  upload.chunks = chunks;
+  const std::lock_guard<std::mutex> lock(mutex);
+  if (!append(upload))
+    LOG::warning("Failed to save the chunk index.");
+  insert(std::move(upload));
+  if (dropped > uploads.size() / 2)
+    compact();
+}
+
+void ChunkStore::insert(Upload upload) {
+  uint32_t number = static_cast<uint32_t>(uploads.size());
+  for (const std::string &name : upload.names) {
+    auto owner = owners.find(name);
+    if (owner != owners.end() && !uploads[owner->second].names.empty())
+      drop(owner->second); // Its files are being replaced.
+    owners[name] = number;
+  }
+  uint64_t offset = 0;
+  for (const MESG::ChunkHash &chunk : upload.chunks) {
+    index[chunk.strong] = {number, offset, chunk.length};
+    offset += chunk.length;
+  }
+  uploads.push_back(std::move(upload));
+}
+
+void ChunkStore::drop(uint32_t number) {
+  Upload &upload = uploads[number];
+  for (const MESG::ChunkHash &chunk : upload.chunks) {
+    auto found = index.find(chunk.strong);
+    if (found != index.end() && found->second.upload == number)
+      index.erase(found);
+  }
+  for (const std::string &name : upload.names) {
+    auto owner = owners.find(name);
+    if (owner != owners.end() && owner->second == number)
+      owners.erase(owner);
+  }
+  upload = Upload();
+  dropped++;
+}
+
+void ChunkStore::compact() {
+  std::vector<Upload> live;
+  for (Upload &upload : uploads)
+    if (!upload.names.empty())
+      live.push_back(std::move(upload));
+  uploads.clear();
+  index.clear();
+  owners.clear();
+  dropped = 0;
+  for (Upload &upload : live)
+    insert(std::move(upload));
+  if (!rewrite())
+    LOG::warning("Failed to save the chunk index.");
+}
+
+bool ChunkStore::append(const Upload &upload) const {
+  std::vector<uint8_t> record = encode_record(upload.names, upload.chunks);
+  FIO::File file;
+  return file.open_update(path) &&
+         file.write_at(file.size(), record.data(), record.size());
+}
+
+// Replaced by rename, never half written.
+bool ChunkStore::rewrite() const {
+  std::string temporary =
+      (std::filesystem::path(directory) / CHUNK_INDEX_TEMPORARY).string();
+  FIO::File file;
+  if (!file.open_write(temporary))
+    return false;
+  uint64_t offset = 0;
+  for (const Upload &upload : uploads) {
+    std::vector<uint8_t> record = encode_record(upload.names, upload.chunks);
+    if (!file.write_at(offset, record.data(), record.size()))
+      return false;
+    offset += record.size();
+  }
+  file.close();
+  std::error_code error;
+  std::filesystem::rename(temporary, path, error);
+  return !error;
+}
+} // namespace SRV
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "message.hpp"
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace SRV {
+// The index in the upload directory, and its replacement while it is
+// rewritten; uploads may not write either.
+inline constexpr char CHUNK_INDEX[] = ".chunks";
+inline constexpr char CHUNK_INDEX_TEMPORARY[] = ".chunks.tmp";
+
+// Where a stored chunk is: an offset in the files of an earlier upload,
+// seen as one stream.
+struct ChunkSource {
+  std::vector<std::string> paths;
+  uint64_t offset = 0;
+  uint32_t length = 0;
+};
+
+// Index of the chunks of completed dedup uploads by strong checksum,
+// kept in directory/.chunks. Entries are hints: the files may have
+// changed since, so a chunk is checked again when it is read. An upload
+// replacing any file of an earlier one drops that one from the index.
+// Shared by the workers, safe from any thread.
+class ChunkStore {
+  using Key = std::array<uint8_t, MESG::STRONG_CHECKSUM_SIZE>;
+  struct KeyHash {
+    size_t operator()(const Key &key) const noexcept;
+  };
+  struct Location {
+    uint32_t upload; // Index into uploads.
+    uint64_t offset;
+    uint32_t length;
+  };
+  // Names relative to directory; none once dropped.
+  struct Upload {
+    std::vector<std::string> names;
+    std::vector<MESG::ChunkHash> chunks;
+  };
+  std::string directory;
+  std::string path;
+  mutable std::mutex mutex;
+  std::vector<Upload> uploads;
+  std::unordered_map<Key, Location, KeyHash> index;
+  std::unordered_map<std::string, uint32_t> owners; // Upload by name.
+  uint32_t dropped = 0; // Uploads.
+
+  void insert(Upload upload);
+  void drop(uint32_t upload);
+  // Forgets the dropped uploads, in memory and in the file.
+  void compact();
+  bool append(const Upload &upload) const; // To the file.
+  bool rewrite() const;
+
+public:
+  // Loads the index; a missing or damaged file leaves it (partly) empty.
+  void open(const std::string &new_directory);
+  bool find(const Key &strong, ChunkSource &source) const;
+  void add(const std::vector<std::string> &paths,
+           const std::vector<MESG::ChunkHash> &chunks);
+};
+} // namespace SRV
\ No newline at end of file
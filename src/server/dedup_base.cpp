@@ -0,0 +1,74 @@
+#include "dedup_base.hpp"
+#include "chunker.hpp"
+#include "delta.hpp"
+#include "delta_base.hpp"
+
+namespace SRV {
+
+DedupBase::~DedupBase() {
+  cancel = true;
+  if (thread.joinable())
+    thread.join();
+}
+
+bool DedupBase::add_chunks(std::span<const MESG::ChunkHash> new_chunks,
+                           uint64_t stream_size) {
+  if (thread.joinable())
+    return false; // Already applying.
+  for (const MESG::ChunkHash &chunk : new_chunks) {
+    if (chunk.length == 0 || chunk.length > CDC::MAX_CHUNK_SIZE ||
+        chunk.length > stream_size - chunked)
+      return false;
+    chunks.push_back(chunk);
+    chunked += chunk.length;
+  }
+  return true;
+}
+
+void DedupBase::apply(std::shared_ptr<FIO::FileSet> files,
+                      std::shared_ptr<PacketBitmap> received,
+                      DoneHandler done) {
+  thread = std::thread([this, files = std::move(files),
+                        received = std::move(received),
+                        done = std::move(done)] {
+    done(copy(*files, *received));
+  });
+}
+
+// A chunk that cannot be read or changed since it was stored is left to
+// the client.
+bool DedupBase::copy(FIO::FileSet &files, PacketBitmap &received) {
+  std::vector<MESG::DeltaCopy> copies;
+  std::vector<uint8_t> buffer;
+  FIO::FileSet source;
+  std::vector<std::string> source_paths;
+  bool source_open = false;
+  uint64_t offset = 0;
+  for (const MESG::ChunkHash &chunk : chunks) {
+    if (cancel)
+      return false;
+    uint64_t chunk_offset = offset;
+    offset += chunk.length;
+    ChunkSource found;
+    if (!store.find(chunk.strong, found) || found.length != chunk.length)
+      continue;
+    if (found.paths != source_paths) {
+      source = FIO::FileSet();
+      source_paths = found.paths;
+      source_open = source.open_read(source_paths);
+    }
+    buffer.resize(chunk.length);
+    if (!source_open ||
+        source.read_at(found.offset, buffer.data(), chunk.length) !=
+            chunk.length ||
+        DLT::get_strong_checksum(buffer.data(), chunk.length) != chunk.strong)
+      continue;
+    if (!files.write_at(chunk_offset, buffer.data(), chunk.length))
+      return false;
+    copies.push_back({chunk_offset, found.offset, chunk.length});
+    copied += chunk.length;
+  }
+  mark_copied(copies, files.size(), chunk_size, received);
+  return true;
+}
+} // namespace SRV
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "chunk_store.hpp"
+#include "file_set.hpp"
+#include "message.hpp"
+#include "stripe.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace SRV {
+// The chunks of a dedup upload, as the client cut them. Those the store
+// knows are read from earlier uploads, checked against their checksum
+// and copied into the new files, on a thread of their own like a delta.
+class DedupBase {
+public:
+  // Called from the dedup thread.
+  using DoneHandler = std::function<void(bool success)>;
+
+private:
+  const ChunkStore &store;
+  uint32_t chunk_size; // Of the upload's packets.
+  std::vector<MESG::ChunkHash> chunks; // In stream order.
+  uint64_t chunked = 0;                // Bytes they cover.
+  uint64_t copied = 0;
+  std::atomic<bool> cancel = false;
+  std::thread thread;
+
+  bool copy(FIO::FileSet &files, PacketBitmap &received);
+
+public:
+  DedupBase(const ChunkStore &store, uint32_t chunk_size)
+      : store(store), chunk_size(chunk_size) {}
+  ~DedupBase(); // Cancels and waits for the thread.
+  DedupBase(const DedupBase &) = delete;
+  DedupBase &operator=(const DedupBase &) = delete;
+
+  // False if a chunk is empty, too long or runs past the stream, or once
+  // applying.
+  bool add_chunks(std::span<const MESG::ChunkHash> new_chunks,
+                  uint64_t stream_size);
+  bool is_complete(uint64_t stream_size) const noexcept {
+    return chunked == stream_size;
+  }
+  // Copies into files and marks the packets that are then complete.
+  void apply(std::shared_ptr<FIO::FileSet> files,
+             std::shared_ptr<PacketBitmap> received, DoneHandler done);
+  uint64_t get_copied() const noexcept { return copied; } // Once applied.
+  // Once applied, for the store when the upload checks out.
+  std::vector<MESG::ChunkHash> take_chunks() { return std::move(chunks); }
+};
+} // namespace SRV
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "delta_base.hpp"
+#include "delta.hpp"
+
+#include <algorithm>
+#include <filesystem>
+
+namespace {
+constexpr uint32_t COPY_BUFFER_SIZE = 1 << 20;
+} // namespace
+
+namespace SRV {
+
+DeltaBase::~DeltaBase() {
+  cancel = true;
+  if (thread.joinable())
+    thread.join();
+}
+
+bool DeltaBase::open(const std::vector<std::string> &paths,
+                     uint32_t new_chunk_size) {
+  std::vector<std::string> existing;
+  for (const std::string &path : paths) {
+    std::error_code error;
+    if (std::filesystem::is_regular_file(path, error))
+      existing.push_back(path);
+  }
+  if (existing.empty() || !base.open_read(existing))
+    return false;
+  chunk_size = new_chunk_size;
+  block_size = DLT::get_block_size(base.size(), chunk_size);
+  return base.size() >= block_size;
+}
+
+void DeltaBase::sign(DoneHandler done) {
+  thread = std::thread([this, done = std::move(done)] {
+    done(DLT::sign(base, block_size, signatures, cancel));
+  });
+}
+
+bool DeltaBase::add_copies(std::span<const MESG::DeltaCopy> new_copies,
+                           uint64_t stream_size) {
+  for (const MESG::DeltaCopy &copy : new_copies) {
+    if (copy.length == 0 || copy.offset > stream_size ||
+        copy.length > stream_size - copy.offset ||
+        copy.base_offset > base.size() ||
+        copy.length > base.size() - copy.base_offset)
+      return false;
+    copies.push_back(copy);
+  }
+  return true;
+}
+
+void DeltaBase::apply(std::shared_ptr<FIO::FileSet> files,
+                      std::shared_ptr<PacketBitmap> received,
+                      DoneHandler done) {
+  if (thread.joinable())
+    thread.join(); // Signing, already done.
+  thread = std::thread([this, files = std::move(files),
+                        received = std::move(received),
+                        done = std::move(done)] {
+    done(copy(*files, *received));
+  });
+}
+
+bool DeltaBase::copy(FIO::FileSet &files, PacketBitmap &received) {
+  std::vector<uint8_t> buffer(COPY_BUFFER_SIZE);
+  for (const MESG::DeltaCopy &copy : copies) {
+    for (uint64_t done = 0; done < copy.length;) {
+      if (cancel)
+        return false;
+      uint32_t length = static_cast<uint32_t>(
+          std::min<uint64_t>(buffer.size(), copy.length - done));
+      if (base.read_at(copy.base_offset + done, buffer.data(), length) !=
+              length ||
+          !files.write_at(copy.offset + done, buffer.data(), length))
+        return false;
+      done += length;
+    }
+    copied += copy.length;
+  }
+  mark_copied(copies, files.size(), chunk_size, received);
+  return true;
+}
+
+// Neighbouring copies may share a packet between them.
+void mark_copied(std::vector<MESG::DeltaCopy> &copies, uint64_t stream_size,
+                 uint32_t chunk_size, PacketBitmap &received) {
+  std::sort(copies.begin(), copies.end(),
+            [](const MESG::DeltaCopy &left, const MESG::DeltaCopy &right) {
+              return left.offset < right.offset;
+            });
+  auto mark = [&](uint64_t start, uint64_t end) {
+    uint64_t first = (start + chunk_size - 1) / chunk_size;
+    uint64_t last = end == stream_size ? received.size() : end / chunk_size;
+    for (uint64_t packet = first; packet < last; ++packet)
+      received.set(packet);
+  };
+  uint64_t start = 0;
+  uint64_t end = 0;
+  for (const MESG::DeltaCopy &copy : copies) {
+    if (copy.offset > end) {
+      mark(start, end);
+      start = copy.offset;
+    }
+    end = std::max(end, copy.offset + copy.length);
+  }
+  mark(start, end);
+}
+} // namespace SRV
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "file_set.hpp"
+#include "message.hpp"
+#include "stripe.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace SRV {
+// Marks the packets the copies, sorted here, cover entirely; those on
+// the edges are sent by the client as usual.
+void mark_copied(std::vector<MESG::DeltaCopy> &copies, uint64_t stream_size,
+                 uint32_t chunk_size, PacketBitmap &received);
+
+// The old version of a delta upload's files, as one stream like the new
+// one. First signed for the client, then the blocks the client found in
+// its new version are copied from here into the new files. Both run on
+// a thread of their own so the worker's other uploads go on meanwhile.
+class DeltaBase {
+public:
+  // Called from the delta thread.
+  using DoneHandler = std::function<void(bool success)>;
+
+private:
+  FIO::FileSet base;
+  uint32_t chunk_size = 0; // Of the new upload's packets.
+  uint32_t block_size = 0;
+  std::vector<MESG::BlockSignature> signatures;
+  std::vector<MESG::DeltaCopy> copies;
+  uint64_t copied = 0; // Bytes.
+  std::atomic<bool> cancel = false;
+  std::thread thread;
+
+  bool copy(FIO::FileSet &files, PacketBitmap &received);
+
+public:
+  DeltaBase() = default;
+  ~DeltaBase(); // Cancels and waits for the thread.
+  DeltaBase(const DeltaBase &) = delete;
+  DeltaBase &operator=(const DeltaBase &) = delete;
+
+  // Those of paths that exist. False if they hold no full block.
+  bool open(const std::vector<std::string> &paths, uint32_t new_chunk_size);
+  uint64_t size() const noexcept { return base.size(); }
+  uint32_t get_block_size() const noexcept { return block_size; }
+  void sign(DoneHandler done);
+  // Valid once signing is done.
+  const std::vector<MESG::BlockSignature> &get_signatures() const noexcept {
+    return signatures;
+  }
+  // False if a copy reaches outside either stream.
+  bool add_copies(std::span<const MESG::DeltaCopy> new_copies,
+                  uint64_t stream_size);
+  // Copies into files and marks the packets that are then complete.
+  void apply(std::shared_ptr<FIO::FileSet> files,
+             std::shared_ptr<PacketBitmap> received, DoneHandler done);
+  uint64_t get_copied() const noexcept { return copied; } // Once applied.
+};
+} // namespace SRV
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "journal.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+namespace {
+constexpr uint32_t JOURNAL_MAGIC = 0x464A524E; // "FJRN"
+// Magic, manifest hash, packet count; the bitmap and a checksum follow.
+constexpr uint32_t JOURNAL_HEADER_SIZE = 20;
+constexpr uint64_t FNV_OFFSET = 0xCBF29CE484222325ULL;
+
+uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t length) {
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= data[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+uint64_t fnv1a(uint64_t hash, uint64_t number) {
+  uint8_t bytes[8];
+  for (int i = 0; i < 8; ++i)
+    bytes[i] = static_cast<uint8_t>(number >> (8 * i));
+  return fnv1a(hash, bytes, sizeof(bytes));
+}
+} // namespace
+
+namespace SRV {
+
+// Names, sizes and the chunk size decide where every packet goes, the
+// flags where the files are written; the modification times keep another
+// version of the same files from resuming on this one's packets.
+Journal::Journal(const std::string &directory,
+                 const MESG::StartMessage &manifest) {
+  uint64_t hash = fnv1a(FNV_OFFSET, manifest.get_chunk_size());
+  hash = fnv1a(hash, manifest.get_flags());
+  for (const MESG::ManifestEntry &file : manifest.get_files()) {
+    hash = fnv1a(hash, reinterpret_cast<const uint8_t *>(file.name.data()),
+                 file.name.size() + 1); // The terminator separates names.
+    hash = fnv1a(hash, file.size);
+    hash = fnv1a(hash, file.modified);
+  }
+  manifest_hash = hash;
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx",
+                static_cast<unsigned long long>(hash));
+  std::filesystem::path directory_path =
+      std::filesystem::path(directory) / JOURNAL_DIRECTORY;
+  std::error_code error;
+  std::filesystem::create_directories(directory_path, error);
+  stem = (directory_path / name).string();
+  path = stem + ".journal";
+}
+
+std::string Journal::get_part_path(size_t index) const {
+  return stem + "." + std::to_string(index) + ".part";
+}
+
+bool Journal::load(PacketBitmap &bitmap) const {
+  FIO::File file;
+  if (!is_valid() || !file.open_read(path))
+    return false;
+  uint64_t size = JOURNAL_HEADER_SIZE + bitmap.get_word_count() * 8 + 8;
+  if (file.size() != size)
+    return false;
+  std::vector<uint8_t> buffer(size);
+  if (file.read_at(0, buffer.data(), size) != static_cast<int64_t>(size))
+    return false;
+  uint32_t offset = 0;
+  if (MESG::get_uint32(buffer, offset) != JOURNAL_MAGIC ||
+      MESG::get_uint64(buffer, offset) != manifest_hash ||
+      MESG::get_uint64(buffer, offset) != bitmap.size())
+    return false;
+  uint32_t checksum_offset = size - 8;
+  if (MESG::get_uint64(buffer, checksum_offset) !=
+      fnv1a(FNV_OFFSET, buffer.data(), size - 8))
+    return false;
+  for (size_t i = 0; i < bitmap.get_word_count(); ++i)
+    bitmap.set_word(i, MESG::get_uint64(buffer, offset));
+  return true;
+}
+
+std::vector<uint8_t>
+Journal::encode(const PacketBitmap &bitmap) const {
+  uint32_t size = JOURNAL_HEADER_SIZE + bitmap.get_word_count() * 8 + 8;
+  std::vector<uint8_t> buffer(size);
+  uint32_t offset = 0;
+  MESG::put_uint32(buffer, offset, JOURNAL_MAGIC);
+  MESG::put_uint64(buffer, offset, manifest_hash);
+  MESG::put_uint64(buffer, offset, bitmap.size());
+  // Taken before the sync, so every bit refers to data it covers.
+  for (size_t i = 0; i < bitmap.get_word_count(); ++i)
+    MESG::put_uint64(buffer, offset, bitmap.get_word(i));
+  MESG::put_uint64(buffer, offset,
+                   fnv1a(FNV_OFFSET, buffer.data(), offset));
+  return buffer;
+}
+
+bool Journal::write(const std::vector<uint8_t> &contents,
+                    FIO::FileSet &files) const {
+  if (!is_valid() || !files.sync())
+    return false;
+  std::string temporary = path + ".tmp";
+  FIO::File file;
+  if (!file.open_write(temporary) ||
+      !file.write_at(0, contents.data(), contents.size()) || !file.sync())
+    return false;
+  file.close();
+  std::error_code error;
+  std::filesystem::rename(temporary, path, error);
+  if (error)
+    return false;
+  return FIO::sync_directory(
+      std::filesystem::path(path).parent_path().string());
+}
+
+void Journal::remove() const {
+  if (!is_valid())
+    return;
+  std::error_code error;
+  std::filesystem::remove(path, error);
+  // Only goes once empty.
+  std::filesystem::remove(std::filesystem::path(path).parent_path(), error);
+}
+void JournalSaver::save(const Journal &journal, std::vector<uint8_t> contents,
+                        uint64_t packets,
+                        std::shared_ptr<FIO::FileSet> files) {
+  wait();
+  busy = true;
+  thread = std::thread([this, journal, contents = std::move(contents),
+                        packets, files = std::move(files)] {
+    if (journal.write(contents, *files))
+      saved = packets;
+    else
+      failed = true;
+    busy = false;
+  });
+}
+
+void JournalSaver::wait() {
+  if (thread.joinable())
+    thread.join();
+}
+} // namespace SRV
\ No newline at end of file
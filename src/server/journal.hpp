@@ -0,0 +1,71 @@
+#pragma once
+
+#include "file_set.hpp"
+#include "message.hpp"
+#include "stripe.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace SRV {
+// Below the upload directory; uploads may not write there.
+inline constexpr char JOURNAL_DIRECTORY[] = ".resume";
+
+// Crash-safe record of the packets of an upload already on disk, kept in
+// directory/.resume/ under a hash of the manifest. An upload of the same
+// manifest after a crash or a lost connection starts from it instead of
+// packet 0.
+class Journal {
+  std::string stem; // Path without extension.
+  std::string path;
+  uint64_t manifest_hash = 0;
+
+public:
+  Journal() = default;
+  Journal(const std::string &directory, const MESG::StartMessage &manifest);
+  bool is_valid() const noexcept { return !path.empty(); }
+  // Where a delta upload writes file index until it is complete, next
+  // to the journal.
+  std::string get_part_path(size_t index) const;
+  // False if there is none or it belongs to other data.
+  bool load(PacketBitmap &bitmap) const;
+  // The journal's contents for the bitmap as it is now.
+  std::vector<uint8_t> encode(const PacketBitmap &bitmap) const;
+  // Syncs the files first: a packet is only recorded once its data would
+  // survive a crash. The journal is replaced by rename, never half written.
+  bool write(const std::vector<uint8_t> &contents, FIO::FileSet &files) const;
+  bool save(const PacketBitmap &bitmap, FIO::FileSet &files) const {
+    return write(encode(bitmap), files);
+  }
+  void remove() const;
+};
+
+// Writes journals on a thread of its own so that syncing the files does
+// not stall the stripes on the worker's thread. One save at a time.
+class JournalSaver {
+  std::thread thread;
+  std::atomic<bool> busy = false;
+  std::atomic<bool> failed = false;
+  std::atomic<uint64_t> saved = 0; // Packets in the last saved journal.
+
+public:
+  JournalSaver() = default;
+  ~JournalSaver() { wait(); }
+  JournalSaver(const JournalSaver &) = delete;
+  JournalSaver &operator=(const JournalSaver &) = delete;
+
+  bool is_busy() const noexcept { return busy; }
+  // Of the saves done so far; a failure is reported once.
+  uint64_t get_saved() const noexcept { return saved; }
+  bool take_failure() noexcept { return failed.exchange(false); }
+  // contents holds packets, by Journal::encode, the files are synced.
+  void save(const Journal &journal, std::vector<uint8_t> contents,
+            uint64_t packets, std::shared_ptr<FIO::FileSet> files);
+  void wait();
+  void reset(uint64_t packets) noexcept { saved = packets; } // Once idle.
+};
+} // namespace SRV
\ No newline at end of file
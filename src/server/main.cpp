@@ -1,22 +1,66 @@
+#include "log.hpp"
 #include "server.hpp"
 
+#include <algorithm>
+#include <csignal>
+#include <cstring>
 #include <iostream>
 #include <string>
+#include <thread>
+
+namespace {
+SRV::Server *running_server = nullptr;
+
+void on_signal(int) {
+  if (running_server != nullptr)
+    running_server->stop();
+}
+} // namespace
 
 int main(int argc, char **argv) {
   std::string ip, directory;
   int port_number = 0;
-  if (argc < 4 || argc > 4) {
+  uint32_t workers = std::max(1u, std::thread::hardware_concurrency());
+  SRV::ReportOptions report;
+  if (argc < 4 || argc % 2 != 0) {
     std::cerr << "Invalid argument." << std::endl;
     return EXIT_FAILURE;
   }
   ip = argv[1];
   port_number = std::stoi(argv[2]);
   directory = argv[3];
+  for (int i = 4; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--workers") == 0) {
+      workers = std::stoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--metrics") == 0) {
+      report.metrics_path = argv[i + 1];
+    } else if (std::strcmp(argv[i], "--progress") == 0) {
+      report.progress = std::stoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--log") == 0) {
+      if (!LOG::open(argv[i + 1])) {
+        std::cerr << "Failed to open the log: " << argv[i + 1] << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (std::strcmp(argv[i], "--log-level") == 0) {
+      LOG::LEVEL level = LOG::LEVEL_INFO;
+      if (!LOG::parse_level(argv[i + 1], level)) {
+        std::cerr << "Unknown log level: " << argv[i + 1] << std::endl;
+        return EXIT_FAILURE;
+      }
+      LOG::set_level(level);
+    } else {
+      std::cerr << "Invalid argument." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
   if (ip == "" || directory == " " || !port_number) {
     std::cerr << "Invalid argument." << std::endl;
     return EXIT_FAILURE;
   }
-  SRV::Server server(ip, port_number, directory);
+  SRV::Server server(ip, port_number, directory, workers, report);
+  running_server = &server;
+  std::signal(SIGINT, on_signal);
+  std::signal(SIGTERM, on_signal);
   server.run();
-}
\ No newline at end of file
+  running_server = nullptr;
+}
@@ -1,53 +1,41 @@
 #pragma once
 
-#include "message.hpp"
+#include "reactor.hpp"
 #include "socket.hpp"
+#include "worker_pool.hpp"
 
-#include <atomic>
 #include <cstdint>
 #include <string>
-#include <thread>
 #include <vector>
 
 namespace SRV {
+// Long-running upload daemon. The main thread accepts control
+// connections and hands each one, with a fresh transfer ID, to the least
+// loaded worker. It also answers path MTU probes, over UDP on the TCP
+// port number, so clients can size their chunks before they start.
 class Server {
-  std::vector<uint8_t> file_data;
-  std::vector<MESG::FileMessage> message_files;
   std::string ip;
   std::string directory;
-  std::string filename;
-  std::atomic<uint32_t> tcp_port;
-  std::atomic<uint32_t> udp_port;
-  std::atomic<bool> should_run_tcp = true;
-  std::atomic<bool> should_run_udp = false;
-  std::atomic<uint8_t> received_crc;
-  std::thread listen_tcp_worker;
-  std::thread listen_udp_worker;
-  SCK::Socket client_socket;
-  void save_file();
-  void listen_tcp();
-  void listen_udp();
-  void parse_message(const std::vector<uint8_t> &data);
-  void fill_file_data();
-  void send_confirm_message(uint32_t packet_number);
-  std::unique_ptr<MESG::BaseMessage> create_message(MESG::MESSAGE_TYPE type);
-  void stop();
+  uint32_t tcp_port;
+  uint32_t worker_count;
+  ReportOptions report;
+  SCK::Reactor reactor;
+  SCK::Socket listen_socket;
+  SCK::Socket probe_socket;
+  std::vector<uint8_t> probe_buffer;
+  WorkerPool workers;
+
+  bool listen_tcp();
+  void on_accept();
+  bool open_probe();
+  void on_probe();
 
 public:
-  void run();
-  void init_winsock();
-  Server(std::string new_ip, uint32_t new_tcp_port, std::string new_directory)
-      : ip(new_ip), tcp_port(new_tcp_port), directory(new_directory) {}
+  Server(std::string new_ip, uint32_t new_tcp_port, std::string new_directory,
+         uint32_t new_worker_count, ReportOptions new_report = {});
   Server(const Server &) = delete;
   Server &operator=(const Server &) = delete;
-  Server(Server &&) = default;
-  Server &operator=(Server &&) = default;
-  ~Server() {
-    stop();
-    if (listen_tcp_worker.joinable())
-      listen_tcp_worker.join();
-    if (listen_udp_worker.joinable())
-      listen_udp_worker.join();
-  }
+  void run();  // Serves until stop().
+  void stop(); // Safe from other threads and signal handlers.
 };
 } // namespace SRV
\ No newline at end of file
@@ -0,0 +1,520 @@
+#include "session.hpp"
+#include "crc.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+#include "typedef.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <string_view>
+
+namespace {
+constexpr auto JOURNAL_INTERVAL = std::chrono::seconds(2);
+
+// The server's own files in directory. Compared ignoring case, for file
+// systems that do.
+bool is_reserved(const std::filesystem::path &name) {
+  constexpr std::string_view RESERVED[] = {
+      SRV::JOURNAL_DIRECTORY, SRV::CHUNK_INDEX, SRV::CHUNK_INDEX_TEMPORARY};
+  std::string first = name.begin()->string();
+  for (char &symbol : first)
+    symbol = static_cast<char>(
+        std::tolower(static_cast<unsigned char>(symbol)));
+  return std::find(std::begin(RESERVED), std::end(RESERVED), first) !=
+         std::end(RESERVED);
+}
+
+// Names stay inside directory: relative, no "..", no empty file name, and
+// clear of the server's files.
+bool is_safe_name(const std::filesystem::path &name) {
+  return !name.empty() && name.is_relative() && !name.has_root_name() &&
+         *name.begin() != ".." && !name.filename().empty() &&
+         name.filename() != "." && name.filename() != ".." &&
+         !is_reserved(name);
+}
+} // namespace
+
+namespace SRV {
+
+Session::Session(uint64_t transfer_id, std::string directory,
+                 SCK::Reactor &reactor, SCK::Socket control_socket,
+                 ChunkStore &store, const ReportOptions &report)
+    : transfer_id(transfer_id), directory(std::move(directory)),
+      reactor(reactor), control_socket(std::move(control_socket)),
+      store(store), report(report) {
+  accept.set_transfer_id(transfer_id);
+}
+
+Session::~Session() {
+  if (journal_timer != 0)
+    reactor.cancel_timer(journal_timer);
+  if (progress_timer != 0)
+    reactor.cancel_timer(progress_timer);
+}
+
+void Session::print(const std::string &text, LOG::LEVEL level) const {
+  char id[17];
+  std::snprintf(id, sizeof(id), "%016llx",
+                static_cast<unsigned long long>(transfer_id));
+  LOG::print_at(level, "[{}] {}", id, text);
+}
+
+bool Session::flush_control() {
+  if (!control_writer.flush(control_socket.get_sockfd()))
+    return false;
+  bool unsent = !control_writer.is_empty();
+  if (unsent == write_watched)
+    return true;
+  write_watched = unsent;
+  return reactor.modify(control_socket.get_sockfd(),
+                        unsent ? SCK::EVENT_READ | SCK::EVENT_WRITE
+                               : SCK::EVENT_READ);
+}
+
+bool Session::start(const MESG::StartMessage &message) {
+  if (started || message.get_files().empty())
+    return false;
+  if (message.get_chunk_size() < MIN_CHUNK_SIZE ||
+      message.get_chunk_size() > MAX_CHUNK_SIZE) {
+    print("Invalid chunk size: " + std::to_string(message.get_chunk_size()),
+          LOG::LEVEL_WARNING);
+    return false;
+  }
+  std::vector<uint64_t> sizes;
+  file_paths.clear();
+  for (const MESG::ManifestEntry &entry : message.get_files()) {
+    std::filesystem::path name =
+        std::filesystem::path(entry.name).lexically_normal();
+    if (!is_safe_name(name)) {
+      print("Invalid filename: " + entry.name, LOG::LEVEL_WARNING);
+      return false;
+    }
+    std::filesystem::path path = std::filesystem::path(directory) / name;
+    file_paths.push_back(path.string());
+    sizes.push_back(entry.size);
+  }
+  file_size = message.get_file_size();
+  chunk_size = message.get_chunk_size();
+  packet_count = (file_size + chunk_size - 1) / chunk_size;
+  stripe_request = message.get_stripe_count();
+  journal = Journal(directory, message);
+  // The old version stays in place, and readable, until the new one is
+  // complete and checked: a delta is taken from it, a dedup upload may
+  // find its chunks there.
+  bool is_delta = message.get_flags() & MESG::START_FLAG_DELTA;
+  bool is_dedup = message.get_flags() & MESG::START_FLAG_DEDUP;
+  if (is_delta && is_dedup) {
+    print("Delta and dedup uploads do not mix.", LOG::LEVEL_WARNING);
+    return false;
+  }
+  // Only once the whole manifest checked out.
+  for (const std::string &path : file_paths) {
+    std::error_code error;
+    std::filesystem::create_directories(
+        std::filesystem::path(path).parent_path(), error);
+    if (error) {
+      print("Failed to create a directory for " + path, LOG::LEVEL_ERROR);
+      return false;
+    }
+  }
+  part_paths.clear();
+  for (size_t i = 0; (is_delta || is_dedup) && i < file_paths.size(); ++i)
+    part_paths.push_back(journal.get_part_path(i));
+  bool resumed = resume(sizes);
+  journal_saver.reset(journaled);
+  files = std::make_shared<FIO::FileSet>();
+  if (!files->create(get_write_paths(), sizes, resumed)) {
+    print("Failed to create a file in " + directory, LOG::LEVEL_ERROR);
+    return false;
+  }
+  if (is_delta && !resumed && packet_count > 0) {
+    delta = std::make_unique<DeltaBase>();
+    if (!delta->open(file_paths, chunk_size))
+      delta.reset(); // Nothing to match against.
+  }
+  if (is_dedup)
+    dedup = std::make_unique<DedupBase>(store, chunk_size);
+  started = true;
+  if (file_paths.size() == 1)
+    print("Starting receiving the file:" + message.get_files()[0].name);
+  else
+    print("Starting receiving " + describe() + ".");
+  if (resumed)
+    print("Resuming, " + std::to_string(journaled) + " of " +
+          std::to_string(packet_count) + " packets kept.");
+  if (packet_count > 0)
+    schedule_journal();
+  start_time = std::chrono::steady_clock::now();
+  progress_bytes = 0;
+  if (report.progress != 0 && packet_count > 0)
+    schedule_progress();
+  return true;
+}
+
+// Only with every file still there at its full size; the journal alone
+// does not prove the data survived.
+bool Session::resume(const std::vector<uint64_t> &sizes) {
+  received_packets = std::make_shared<PacketBitmap>(packet_count);
+  journaled = 0;
+  const std::vector<std::string> &paths = get_write_paths();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    std::error_code error;
+    if (std::filesystem::file_size(paths[i], error) != sizes[i] || error)
+      return false;
+  }
+  if (packet_count == 0 || !journal.load(*received_packets)) {
+    received_packets = std::make_shared<PacketBitmap>(packet_count);
+    return false;
+  }
+  for (uint64_t i = 0; i < packet_count; ++i)
+    journaled += received_packets->test(i);
+  return journaled > 0;
+}
+
+// Saved in the background; journaled only moves once a save is done.
+void Session::schedule_journal() {
+  journal_timer =
+      reactor.add_timer(SCK::Reactor::Clock::now() + JOURNAL_INTERVAL, [this] {
+        journal_timer = 0;
+        if (!journal_saver.is_busy()) {
+          if (journal_saver.take_failure())
+            print("Failed to save the resume journal.", LOG::LEVEL_WARNING);
+          journaled = journal_saver.get_saved();
+          uint64_t received = get_received(); // Not more than the bitmap.
+          if (received != journaled)
+            journal_saver.save(journal, journal.encode(*received_packets),
+                               received, files);
+        }
+        schedule_journal();
+      });
+}
+
+void Session::save_journal() {
+  journal_saver.wait();
+  uint64_t received = get_received(); // Not more than the bitmap holds.
+  if (packet_count == 0 || !files)
+    return;
+  if (!journal.save(*received_packets, *files))
+    print("Failed to save the resume journal.", LOG::LEVEL_WARNING);
+  else
+    journaled = received;
+}
+
+const std::vector<std::string> &Session::get_write_paths() const {
+  return part_paths.empty() ? file_paths : part_paths;
+}
+
+void Session::sign_delta(DeltaBase::DoneHandler done) {
+  print("Signing " + std::to_string(delta->size()) + " bytes in blocks of " +
+        std::to_string(delta->get_block_size()) + ".");
+  delta->sign(std::move(done));
+}
+
+// The client reads them as they come.
+void Session::send_signatures() {
+  const std::vector<MESG::BlockSignature> &signatures =
+      delta->get_signatures();
+  for (size_t first = 0; first < signatures.size();) {
+    MESG::SignatureMessage message;
+    message.set_transfer_id(transfer_id);
+    message.set_base_size(delta->size());
+    message.set_block_size(delta->get_block_size());
+    message.set_first_block(first);
+    while (first < signatures.size() && message.add_block(signatures[first]))
+      first++;
+    send_control(message);
+  }
+}
+
+bool Session::add_delta(const MESG::DeltaMessage &message) {
+  return delta->add_copies(message.get_copies(), file_size);
+}
+
+void Session::apply_delta(DeltaBase::DoneHandler done) {
+  delta->apply(files, received_packets, std::move(done));
+}
+
+void Session::end_delta() {
+  if (delta && delta->get_copied() > 0)
+    print("Copied " + std::to_string(delta->get_copied()) + " of " +
+          std::to_string(file_size) + " bytes from the old version.");
+  delta.reset();
+}
+
+bool Session::add_chunks(const MESG::ChunkMessage &message) {
+  return dedup->add_chunks(message.get_chunks(), file_size) &&
+         (!message.is_last() || dedup->is_complete(file_size));
+}
+
+void Session::apply_dedup(DedupBase::DoneHandler done) {
+  dedup->apply(files, received_packets, std::move(done));
+}
+
+void Session::end_dedup() {
+  if (dedup->get_copied() > 0)
+    print("Copied " + std::to_string(dedup->get_copied()) + " of " +
+          std::to_string(file_size) + " bytes from stored chunks.");
+  chunks = dedup->take_chunks();
+  dedup.reset();
+}
+
+// Every packet the server holds, however many messages it takes, then
+// the accept.
+void Session::send_reply() {
+  MESG::ResumeMessage resume;
+  resume.set_transfer_id(transfer_id);
+  for (uint64_t i = 0; i < packet_count;) {
+    if (!received_packets->test(i)) {
+      i++;
+      continue;
+    }
+    uint64_t start = i;
+    while (i < packet_count && received_packets->test(i))
+      i++;
+    if (!resume.add_range(start, i)) {
+      send_control(resume);
+      resume = MESG::ResumeMessage();
+      resume.set_transfer_id(transfer_id);
+      resume.add_range(start, i);
+    }
+  }
+  if (!resume.get_ranges().empty())
+    send_control(resume);
+  send_control(accept);
+}
+
+void Session::add_stripe(const MESG::Stripe &stripe, Worker &worker,
+                         std::shared_ptr<StripeProgress> progress) {
+  accept.add_stripe(stripe);
+  stripes.push_back({stripe.stripe_id, &worker, std::move(progress)});
+}
+
+void Session::schedule_progress() {
+  progress_timer = reactor.add_timer(
+      SCK::Reactor::Clock::now() + std::chrono::seconds(report.progress),
+      [this] {
+        progress_timer = 0;
+        print_progress();
+        schedule_progress();
+      });
+}
+
+// The rate is of the last interval, new packets only.
+void Session::print_progress() {
+  uint64_t bytes = get_new_bytes();
+  char line[96];
+  std::snprintf(line, sizeof(line), "%.1f%% of %llu packets, %.1f Mbit/s.",
+                100.0 * get_received() / packet_count,
+                static_cast<unsigned long long>(packet_count),
+                STAT::get_megabits(bytes - progress_bytes,
+                                   std::chrono::seconds(report.progress)));
+  progress_bytes = bytes;
+  print(line);
+}
+
+uint64_t Session::get_new_bytes() const {
+  uint64_t bytes = 0;
+  for (const SessionStripe &stripe : stripes)
+    bytes += stripe.progress->metrics.new_bytes.get();
+  return bytes;
+}
+
+// Stripes on other workers may still count, the figures are as of now.
+void Session::report_metrics(bool complete) {
+  if (report.metrics_path.empty())
+    return;
+  uint64_t datagrams = 0, duplicates = 0, corrupted = 0, parity = 0,
+           rebuilt = 0, acks = 0;
+  STAT::Summary crc_time, write_time;
+  for (const SessionStripe &stripe : stripes) {
+    const StripeMetrics &metrics = stripe.progress->metrics;
+    datagrams += metrics.packets.get();
+    duplicates += metrics.duplicates.get();
+    corrupted += metrics.corrupted.get();
+    parity += metrics.parity.get();
+    rebuilt += metrics.rebuilt.get();
+    acks += metrics.acks.get();
+    crc_time.add(metrics.crc_time);
+    write_time.add(metrics.write_time);
+  }
+  auto duration = std::chrono::steady_clock::now() - start_time;
+  uint64_t new_bytes = get_new_bytes();
+  double goodput = STAT::get_megabits(new_bytes, duration);
+  char id[17];
+  std::snprintf(id, sizeof(id), "%016llx",
+                static_cast<unsigned long long>(transfer_id));
+  STAT::JsonObject json;
+  json.add_text("side", "server");
+  json.add_text("transfer_id", id);
+  json.add_number("files", file_paths.size());
+  json.add_number("bytes", file_size);
+  json.add_number("chunk_size", chunk_size);
+  json.add_flag("complete", complete);
+  json.add_number("duration_ms",
+                  std::chrono::duration_cast<std::chrono::milliseconds>(
+                      duration)
+                      .count());
+  json.add_real("goodput_mbps", std::round(goodput * 10) / 10);
+  json.add_number("packets_total", packet_count);
+  json.add_number("packets_received", get_received());
+  json.add_number("new_bytes", new_bytes);
+  json.add_number("datagrams", datagrams);
+  json.add_number("duplicates", duplicates);
+  json.add_number("corrupted", corrupted);
+  json.add_number("parity", parity);
+  json.add_number("rebuilt", rebuilt);
+  json.add_number("acks", acks);
+  json.add_summary("crc_ns", crc_time);
+  json.add_summary("write_ns", write_time);
+  if (!STAT::append_line(report.metrics_path, json.finish()))
+    print("Failed to write the metrics to " + report.metrics_path,
+          LOG::LEVEL_WARNING);
+}
+
+bool Session::has_stripe(uint64_t stripe_id) const {
+  for (const SessionStripe &stripe : stripes)
+    if (stripe.stripe_id == stripe_id)
+      return true;
+  return false;
+}
+
+bool Session::stripe_ready() { return ++ready_stripes == stripes.size(); }
+
+uint64_t Session::get_received() const {
+  uint64_t received = 0;
+  for (const SessionStripe &stripe : stripes)
+    received += stripe.progress->received.load(std::memory_order_acquire);
+  return received;
+}
+
+std::string Session::describe() const {
+  if (file_paths.size() == 1)
+    return file_paths[0];
+  return std::to_string(file_paths.size()) + " files";
+}
+
+// Only once checked: the old version stays until the new one is right.
+bool Session::replace_files() {
+  for (size_t i = 0; i < part_paths.size(); ++i) {
+    std::error_code error;
+    std::filesystem::rename(part_paths[i], file_paths[i], error);
+    if (error) {
+      print("Failed to replace " + file_paths[i], LOG::LEVEL_ERROR);
+      return false;
+    }
+  }
+  return true;
+}
+
+void Session::end() {
+  delta.reset();
+  dedup.reset();
+  chunks.clear();
+  files.reset(); // Stripes still holding it have nothing left to write.
+  received_packets.reset();
+  if (journal_timer != 0)
+    reactor.cancel_timer(journal_timer);
+  journal_timer = 0;
+  journal_saver.wait();
+  if (progress_timer != 0)
+    reactor.cancel_timer(progress_timer);
+  progress_timer = 0;
+  journal = Journal();
+  journaled = 0;
+  part_paths.clear();
+  started = false;
+  stripes.clear();
+  ready_stripes = 0;
+  accept = MESG::AcceptMessage();
+  accept.set_transfer_id(transfer_id);
+}
+
+// Combined from the checksums the packets arrived with, in stripe order.
+// Only packets that came another way, resumed or copied by a delta or
+// dedup, are read back: that is what checks them end to end, against the
+// client's files, after a journal or a chunk index said they were here.
+bool Session::get_stream_crc(uint32_t &crc) const {
+  crc = 0;
+  std::vector<uint8_t> buffer(chunk_size);
+  for (const SessionStripe &stripe : stripes) {
+    const StripeProgress &progress = *stripe.progress;
+    for (uint64_t i = 0; i < progress.packet_count; ++i) {
+      uint64_t offset = (progress.first_packet + i) * chunk_size;
+      uint32_t size = static_cast<uint32_t>(
+          std::min<uint64_t>(chunk_size, file_size - offset));
+      if (progress.checksummed[i]) {
+        crc = CRC::combine(crc, progress.checksums[i], size);
+        continue;
+      }
+      if (files->read_at(offset, buffer.data(), size) != size) {
+        print("Failed to read a chunk back.", LOG::LEVEL_ERROR);
+        return false;
+      }
+      crc = CRC::extend(crc, buffer.data(), size);
+    }
+  }
+  return true;
+}
+
+// A complete upload with a wrong CRC starts over next time, an incomplete
+// one resumes. Either way the client is told it failed.
+bool Session::finish(uint32_t received_crc) {
+  if (!started)
+    return false;
+  uint64_t received = get_received();
+  bool success = false;
+  if (received != packet_count) {
+    print("File is incomplete: " + std::to_string(received) + " of " +
+          std::to_string(packet_count) + " packets received.",
+          LOG::LEVEL_WARNING);
+    save_journal();
+  } else {
+    uint32_t crc_result = 0;
+    bool checked = get_stream_crc(crc_result);
+    files.reset();
+    print("File save: " + describe());
+    if (!checked || crc_result != received_crc)
+      print("Something went wrong with file. CRC code isn't correct",
+            LOG::LEVEL_ERROR);
+    else
+      print("File was downloaded successfully!");
+    success = checked && crc_result == received_crc && replace_files();
+    if (success)
+      store.add(file_paths, chunks);
+    // Left by a failed check; files written in place hold no version.
+    for (const std::string &path : part_paths.empty() && !success
+                                       ? file_paths
+                                       : part_paths) {
+      std::error_code error;
+      std::filesystem::remove(path, error);
+    }
+    journal_saver.wait(); // Would bring it back.
+    journal.remove();
+  }
+  MESG::ConfirmMessage verdict;
+  verdict.set_transfer_id(transfer_id);
+  verdict.set_packet_number(received);
+  verdict.set_message_status(success ? MESG::MESSAGE_SUCCESS
+                                     : MESG::MESSAGE_FAILURE);
+  send_control(verdict);
+  report_metrics(success);
+  end();
+  return success;
+}
+
+void Session::abort() {
+  delta.reset(); // Whatever it copied is not journaled.
+  dedup.reset();
+  if (started) {
+    print("Transfer interrupted, " + std::to_string(get_received()) + " of " +
+          std::to_string(packet_count) + " packets received.",
+          LOG::LEVEL_WARNING);
+    save_journal();
+    report_metrics(false);
+  }
+  end();
+}
+} // namespace SRV
\ No newline at end of file
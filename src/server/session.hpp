@@ -0,0 +1,145 @@
+#pragma once
+
+#include "chunk_store.hpp"
+#include "control_stream.hpp"
+#include "dedup_base.hpp"
+#include "delta_base.hpp"
+#include "file_set.hpp"
+#include "journal.hpp"
+#include "log.hpp"
+#include "message.hpp"
+#include "reactor.hpp"
+#include "socket.hpp"
+#include "stripe.hpp"
+#include "worker_pool.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace SRV {
+class Worker;
+
+// A stripe as seen from its session.
+struct SessionStripe {
+  uint64_t stripe_id;
+  Worker *worker; // Owns the Stripe.
+  std::shared_ptr<StripeProgress> progress;
+};
+
+// One control connection and the upload running on it: the files of its
+// manifest, created here and written in place by the stripes, which may
+// live on other workers, and the journal checkpointing them. Uploads
+// follow each other on the connection. Owned by a single worker and only
+// touched from its thread.
+class Session {
+  uint64_t transfer_id;
+  std::string directory;
+  SCK::Reactor &reactor; // The worker's, runs the journal timer.
+  SCK::Socket control_socket;
+  std::vector<std::string> file_paths;
+  std::vector<std::string> part_paths; // Delta uploads write here first.
+  std::shared_ptr<FIO::FileSet> files; // Preallocated, shared with stripes.
+  uint64_t file_size = 0; // Of the whole stream.
+  uint32_t chunk_size = BUFFER_MESSAGE_SIZE; // Per packet, the client's.
+  uint64_t packet_count = 0;
+  std::shared_ptr<PacketBitmap> received_packets; // Shared with stripes.
+  Journal journal;
+  uint64_t journaled = 0;     // Packets in the last saved journal.
+  uint64_t journal_timer = 0; // Reactor timer id, 0 if none.
+  JournalSaver journal_saver; // The periodic saves.
+  ChunkStore &store;
+  const ReportOptions &report;
+  std::chrono::steady_clock::time_point start_time;
+  uint64_t progress_timer = 0; // Reactor timer id, 0 if none.
+  uint64_t progress_bytes = 0; // New bytes at the last progress line.
+  std::unique_ptr<DeltaBase> delta;    // Until its copies are applied.
+  std::unique_ptr<DedupBase> dedup;    // Likewise.
+  std::vector<MESG::ChunkHash> chunks; // Stored once the upload checks out.
+  uint32_t stripe_request = 1;         // Flows the client asked for.
+  MESG::FrameReader control_reader;
+  MESG::FrameWriter control_writer;
+  bool write_watched = false; // Control socket waits to take the rest.
+  bool started = false;
+  std::vector<SessionStripe> stripes;
+  uint32_t ready_stripes = 0;
+  MESG::AcceptMessage accept; // Sent once every stripe is ready.
+  // Tagged with the ID.
+  void print(const std::string &text,
+             LOG::LEVEL level = LOG::LEVEL_INFO) const;
+  uint64_t get_received() const;
+  std::string describe() const; // The file, or how many.
+  const std::vector<std::string> &get_write_paths() const;
+  bool resume(const std::vector<uint64_t> &sizes); // Loads the journal.
+  void schedule_journal();
+  void save_journal(); // Waits for it, when the upload ends.
+  void schedule_progress();
+  void print_progress();
+  uint64_t get_new_bytes() const; // Came over the network, once each.
+  void report_metrics(bool complete); // A JSON line, if asked for.
+  // Of the whole stream, false if a packet cannot be read back.
+  bool get_stream_crc(uint32_t &crc) const;
+  bool replace_files(); // With the parts of a delta upload.
+  void end();           // Ready for the next upload.
+
+public:
+  Session(uint64_t transfer_id, std::string directory, SCK::Reactor &reactor,
+          SCK::Socket control_socket, ChunkStore &store,
+          const ReportOptions &report);
+  ~Session();
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+
+  uint64_t get_transfer_id() const noexcept { return transfer_id; }
+  int get_control_fd() const noexcept { return control_socket.get_sockfd(); }
+  const std::shared_ptr<FIO::FileSet> &get_files() const noexcept {
+    return files;
+  }
+  uint64_t get_file_size() const noexcept { return file_size; }
+  uint32_t get_chunk_size() const noexcept { return chunk_size; }
+  uint64_t get_packet_count() const noexcept { return packet_count; }
+  const std::shared_ptr<PacketBitmap> &get_received_packets() const noexcept {
+    return received_packets;
+  }
+  const std::vector<SessionStripe> &get_stripes() const noexcept {
+    return stripes;
+  }
+  uint32_t get_stripe_request() const noexcept { return stripe_request; }
+  MESG::FrameReader &get_control_reader() noexcept { return control_reader; }
+  // Resume (if packets were kept) and accept.
+  void send_reply();
+  bool is_started() const noexcept { return started; }
+  bool start(const MESG::StartMessage &message); // Creates the files.
+  // A delta upload with an old version to match against, until the
+  // copies are applied.
+  bool has_delta() const noexcept { return delta != nullptr; }
+  void sign_delta(DeltaBase::DoneHandler done);
+  void send_signatures();
+  // False if the copies do not fit the files.
+  bool add_delta(const MESG::DeltaMessage &message);
+  void apply_delta(DeltaBase::DoneHandler done);
+  void end_delta(); // Applied, or given up on for a full upload.
+  // A dedup upload, until its chunks are applied.
+  bool has_dedup() const noexcept { return dedup != nullptr; }
+  // False if the chunks do not fit the stream.
+  bool add_chunks(const MESG::ChunkMessage &message);
+  void apply_dedup(DedupBase::DoneHandler done);
+  void end_dedup();
+  // Control messages queue until flush_control(), which sends them in
+  // one write and leaves the rest to the reactor if the socket is full.
+  template <typename Message> void send_control(const Message &message) {
+    control_writer.add(message);
+  }
+  bool flush_control(); // False on error.
+  void add_stripe(const MESG::Stripe &stripe, Worker &worker,
+                  std::shared_ptr<StripeProgress> progress);
+  bool has_stripe(uint64_t stripe_id) const;
+  bool stripe_ready(); // True once every stripe is.
+  // Ends the upload: closes the files, checks completeness and the CRC,
+  // and queues the verdict for the client. True on success.
+  bool finish(uint32_t received_crc);
+  void abort(); // Upload interrupted, journals what was written.
+};
+} // namespace SRV
\ No newline at end of file
@@ -0,0 +1,336 @@
+#include "stripe.hpp"
+#include "crc.hpp"
+#include "fec.hpp"
+#include "log.hpp"
+#include "lz.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+
+namespace {
+constexpr auto ACK_DELAY = std::chrono::milliseconds(5);
+constexpr uint32_t ACK_EVERY_PACKETS = 32;
+// Incomplete FEC groups kept; the oldest go first, their packets are
+// resent by the client as without FEC.
+constexpr size_t MAX_PARITY_GROUPS = 64;
+} // namespace
+
+namespace SRV {
+
+Stripe::Stripe(const MESG::Stripe &stripe, uint64_t file_size,
+               uint32_t chunk_size, std::shared_ptr<FIO::FileSet> files,
+               std::shared_ptr<StripeProgress> progress,
+               std::shared_ptr<PacketBitmap> received_packets,
+               SCK::Reactor &reactor, int udp_sockfd,
+               SCK::Reactor::Task on_failure)
+    : stripe_id(stripe.stripe_id), first_packet(stripe.first_packet),
+      end_packet(stripe.end_packet), file_size(file_size),
+      chunk_size(chunk_size), files(std::move(files)),
+      progress(std::move(progress)),
+      received_packets(std::move(received_packets)), reactor(reactor),
+      udp_sockfd(udp_sockfd), on_failure(std::move(on_failure)),
+      cumulative_ack(stripe.first_packet) {
+  // A resumed upload starts with what the journal had.
+  for (uint64_t i = first_packet; i < end_packet; ++i)
+    received_count += is_received(i);
+  while (cumulative_ack < end_packet && is_received(cumulative_ack))
+    cumulative_ack++;
+  this->progress->received = received_count;
+}
+
+Stripe::~Stripe() {
+  if (ack_timer != 0)
+    reactor.cancel_timer(ack_timer);
+}
+
+void Stripe::print(const char *text, LOG::LEVEL level) const {
+  char id[17];
+  std::snprintf(id, sizeof(id), "%016llx",
+                static_cast<unsigned long long>(stripe_id));
+  LOG::print_at(level, "[{}] {}", id, text);
+}
+
+// Chunk size of a packet of the stripe, 0 for other packets.
+uint32_t Stripe::get_chunk_size(uint64_t packet_number) const {
+  if (packet_number < first_packet || packet_number >= end_packet)
+    return 0;
+  uint64_t offset = packet_number * chunk_size;
+  return static_cast<uint32_t>(
+      std::min<uint64_t>(chunk_size, file_size - offset));
+}
+
+// True for packets that belong to the stripe. Compressed ones must have
+// been expanded by verify_packet.
+bool Stripe::check_packet(const MESG::FileMessage &message) const {
+  uint32_t expected = get_chunk_size(message.packet_number);
+  return expected != 0 && message.data.size() == expected;
+}
+
+bool Stripe::verify_packet(MESG::FileMessage &message) {
+  StripeMetrics &metrics = progress->metrics;
+  metrics.packets.add();
+  if (message.encoding == MESG::FILE_ENCODING_LZ) {
+    uint32_t size = get_chunk_size(message.packet_number);
+    if (size == 0)
+      return false;
+    expanded.resize(size);
+    if (!LZ::decompress(message.data, expanded)) {
+      metrics.corrupted.add();
+      send_nak_message(message.packet_number); // Damaged on the way.
+      return false;
+    }
+    message.data = expanded;
+  }
+  uint32_t checksum = 0;
+  {
+    STAT::ScopedTimer timer(metrics.crc_time);
+    checksum = CRC::get_crc32c(message.data.data(), message.data.size());
+  }
+  if (checksum == message.checksum)
+    return true;
+  metrics.corrupted.add();
+  send_nak_message(message.packet_number);
+  return false;
+}
+
+// Writes a chunk in place the first time it arrives. Returns false for
+// packets that do not belong to the stripe.
+bool Stripe::write_packet(const MESG::FileMessage &message) {
+  if (!check_packet(message))
+    return false;
+  uint64_t packet_number = message.packet_number;
+  uint64_t offset = packet_number * chunk_size;
+  if (is_received(packet_number))
+    return true; // Duplicate, only needs another ack.
+  STAT::ScopedTimer timer(progress->metrics.write_time);
+  if (!files->write_at(offset, message.data.data(), message.data.size())) {
+    print("Failed to write a chunk.", LOG::LEVEL_ERROR);
+    return false;
+  }
+  return true;
+}
+
+intptr_t Stripe::find_handle(const MESG::FileMessage &message,
+                             uint64_t &file_offset) const {
+  return files->find_handle(message.packet_number * chunk_size,
+                            message.data.size(), file_offset);
+}
+
+void Stripe::on_file_message(const MESG::FileMessage &message) {
+  if (!write_packet(message)) {
+    if (check_packet(message))
+      fail();
+    return;
+  }
+  record_packet(message);
+}
+
+// A short or failed io_uring write is retried synchronously.
+bool Stripe::end_write(const MESG::FileMessage &message, bool success,
+                       std::chrono::steady_clock::duration time) {
+  progress->metrics.write_time.record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+  if (!success && !write_packet(message))
+    return false;
+  record_packet(message);
+  return true;
+}
+
+// The packet's checksum was verified, it counts towards the upload's.
+void Stripe::record_packet(const MESG::FileMessage &message) {
+  uint64_t packet_number = message.packet_number;
+  last_timestamp = message.timestamp;
+  last_arrival = std::chrono::steady_clock::now();
+  if (is_received(packet_number)) {
+    progress->metrics.duplicates.add();
+  } else {
+    progress->metrics.new_bytes.add(message.data.size());
+    progress->checksums[packet_number - first_packet] = message.checksum;
+    progress->checksummed[packet_number - first_packet] = true;
+    mark_received(packet_number);
+    check_group(packet_number);
+  }
+  if (pending_acks++ == 0)
+    first_pending_ack = last_arrival;
+  if (pending_acks >= ACK_EVERY_PACKETS)
+    send_ack_message();
+  else
+    schedule_ack();
+}
+
+void Stripe::mark_received(uint64_t packet_number) {
+  received_packets->set(packet_number);
+  progress->received.store(++received_count, std::memory_order_release);
+  while (cumulative_ack < end_packet && is_received(cumulative_ack))
+    cumulative_ack++;
+}
+
+void Stripe::check_group(uint64_t packet_number) {
+  auto group = parity_groups.upper_bound(packet_number);
+  if (group == parity_groups.begin())
+    return;
+  --group;
+  if (packet_number < group->first + group->second.size)
+    try_rebuild(group);
+}
+
+// Parity that does not check out is dropped like a lost packet.
+void Stripe::on_parity_message(const MESG::ParityMessage &message) {
+  uint64_t group_first = message.first_packet;
+  if (group_first < first_packet || group_first >= end_packet ||
+      message.group_size == 0 || message.group_size > FEC::MAX_GROUP_SIZE ||
+      message.group_size > end_packet - group_first ||
+      message.parity_index >= FEC::MAX_PARITY ||
+      message.data.size() != chunk_size ||
+      CRC::get_crc32c(message.data.data(), message.data.size()) !=
+          message.checksum)
+    return;
+  auto [group, inserted] = parity_groups.try_emplace(group_first);
+  ParityGroup &parity = group->second;
+  if (inserted) {
+    parity.size = message.group_size;
+  } else if (parity.size != message.group_size ||
+             std::find(parity.indices.begin(), parity.indices.end(),
+                       message.parity_index) != parity.indices.end()) {
+    return;
+  }
+  progress->metrics.parity.add();
+  parity.indices.push_back(message.parity_index);
+  parity.chunks.insert(parity.chunks.end(), message.data.begin(),
+                       message.data.end());
+  try_rebuild(group);
+  if (parity_groups.size() > MAX_PARITY_GROUPS)
+    parity_groups.erase(parity_groups.begin());
+}
+
+void Stripe::try_rebuild(std::map<uint64_t, ParityGroup>::iterator group) {
+  uint64_t group_first = group->first;
+  const ParityGroup &parity = group->second;
+  uint32_t missing = 0;
+  for (uint64_t i = group_first; i < group_first + parity.size; ++i)
+    missing += !is_received(i);
+  if (missing > parity.indices.size())
+    return; // Waits for more parity or the data.
+  bool rebuilt = missing == 0 || rebuild(group_first, parity);
+  parity_groups.erase(group);
+  if (missing == 0)
+    return;
+  if (!rebuilt) {
+    fail();
+    return;
+  }
+  recovered_count += missing;
+  progress->metrics.rebuilt.add(missing);
+  LOG::debug("Rebuilt {} packets from packet {}.", missing, group_first);
+  send_ack_message(); // Before the client resends them.
+}
+
+// The packets that arrived are read back, they are on disk. Rebuilt ones
+// carry no checksum, the session reads them for the upload's CRC.
+bool Stripe::rebuild(uint64_t group_first, const ParityGroup &group) {
+  group_buffer.assign(size_t(group.size) * chunk_size, 0);
+  std::vector<uint8_t *> chunks;
+  std::vector<uint32_t> missing;
+  for (uint32_t i = 0; i < group.size; ++i) {
+    uint64_t packet_number = group_first + i;
+    uint8_t *chunk = group_buffer.data() + size_t(i) * chunk_size;
+    chunks.push_back(chunk);
+    uint32_t size = get_chunk_size(packet_number);
+    if (!is_received(packet_number))
+      missing.push_back(i);
+    else if (files->read_at(packet_number * chunk_size, chunk,
+                            size) != size)
+      return false;
+  }
+  std::vector<const uint8_t *> parity;
+  for (size_t k = 0; k < missing.size(); ++k)
+    parity.push_back(group.chunks.data() + k * chunk_size);
+  if (!FEC::decode(chunks, missing,
+                   parity, std::span(group.indices.data(), missing.size()),
+                   chunk_size))
+    return false;
+  for (uint32_t i : missing) {
+    uint64_t packet_number = group_first + i;
+    if (!files->write_at(packet_number * chunk_size, chunks[i],
+                         get_chunk_size(packet_number))) {
+      print("Failed to write a rebuilt chunk.", LOG::LEVEL_ERROR);
+      return false;
+    }
+    mark_received(packet_number);
+  }
+  return true;
+}
+
+// Delayed ack: at most ACK_DELAY after the first unacknowledged packet.
+void Stripe::schedule_ack() {
+  if (ack_timer != 0)
+    return;
+  ack_timer = reactor.add_timer(first_pending_ack + ACK_DELAY, [this] {
+    ack_timer = 0;
+    if (pending_acks > 0)
+      send_ack_message();
+  });
+}
+
+// Packet numbers are file-wide, the client never sees stripe offsets.
+void Stripe::send_ack_message() {
+  MESG::AckMessage ack_msg;
+  ack_msg.set_transfer_id(stripe_id);
+  ack_msg.set_cumulative(cumulative_ack);
+  ack_msg.set_echo_timestamp(last_timestamp);
+  ack_msg.set_recovered(recovered_count);
+  ack_msg.set_ack_delay(static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - last_arrival)
+          .count()));
+  uint64_t i = cumulative_ack;
+  while (i < end_packet) {
+    if (!is_received(i)) {
+      i++;
+      continue;
+    }
+    uint64_t start = i;
+    while (i < end_packet && is_received(i))
+      i++;
+    if (!ack_msg.add_range(start, i))
+      break;
+  }
+  if (ack_timer != 0) {
+    reactor.cancel_timer(ack_timer);
+    ack_timer = 0;
+  }
+  std::array<uint8_t, MESG::MAX_ACK_MESSAGE_SIZE> ack_buffer;
+  uint32_t size = ack_msg.encode(ack_buffer);
+  int sent = sendto(udp_sockfd,
+                    reinterpret_cast<const char *>(ack_buffer.data()), size, 0,
+                    (struct sockaddr *)&client_udp_addr,
+                    sizeof(client_udp_addr));
+  if (sent < 0) {
+    print("Failed to send ack message.", LOG::LEVEL_WARNING);
+    return;
+  }
+  pending_acks = 0;
+  progress->metrics.acks.add();
+}
+
+void Stripe::send_nak_message(uint64_t packet_number) {
+  MESG::NakMessage nak;
+  nak.set_transfer_id(stripe_id);
+  nak.set_packet_number(packet_number);
+  std::array<uint8_t, MESG::NAK_MESSAGE_SIZE> nak_buffer;
+  uint32_t size = nak.encode(nak_buffer);
+  int sent = sendto(udp_sockfd,
+                    reinterpret_cast<const char *>(nak_buffer.data()), size, 0,
+                    (struct sockaddr *)&client_udp_addr,
+                    sizeof(client_udp_addr));
+  if (sent < 0)
+    print("Failed to send nak message.", LOG::LEVEL_WARNING);
+}
+
+void Stripe::fail() {
+  if (on_failure)
+    on_failure();
+  on_failure = nullptr;
+}
+} // namespace SRV
\ No newline at end of file
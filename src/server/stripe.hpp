@@ -0,0 +1,159 @@
+#pragma once
+
+#include "file_set.hpp"
+#include "log.hpp"
+#include "message.hpp"
+#include "metrics.hpp"
+#include "reactor.hpp"
+#include "socket.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace SRV {
+// Packets of an upload on disk, one bit each. Set by the workers of its
+// stripes, read by the session's worker for the resume journal.
+class PacketBitmap {
+  std::vector<std::atomic<uint64_t>> words;
+  uint64_t packet_count;
+
+public:
+  explicit PacketBitmap(uint64_t packet_count)
+      : words((packet_count + 63) / 64), packet_count(packet_count) {}
+  uint64_t size() const noexcept { return packet_count; }
+  bool test(uint64_t packet) const {
+    return words[packet / 64].load(std::memory_order_relaxed) >>
+               (packet % 64) &
+           1;
+  }
+  void set(uint64_t packet) {
+    words[packet / 64].fetch_or(uint64_t(1) << (packet % 64),
+                                std::memory_order_release);
+  }
+  uint64_t get_word(size_t index) const {
+    return words[index].load(std::memory_order_acquire);
+  }
+  void set_word(size_t index, uint64_t word) {
+    words[index].store(word, std::memory_order_relaxed);
+  }
+  size_t get_word_count() const noexcept { return words.size(); }
+};
+
+// What a stripe saw of its packets, written by its worker, reported by
+// the session's.
+struct StripeMetrics {
+  STAT::Counter packets;      // File packets for the stripe.
+  STAT::Counter new_bytes;    // Payload of packets not had before.
+  STAT::Counter duplicates;   // Had already, only acked again.
+  STAT::Counter corrupted;    // Failed the checksum, NAKed.
+  STAT::Counter parity;       // FEC packets that checked out.
+  STAT::Counter rebuilt;      // Packets restored from parity.
+  STAT::Counter acks;
+  STAT::Histogram crc_time;   // Per packet, nanoseconds.
+  STAT::Histogram write_time; // Per packet written, nanoseconds.
+};
+
+// Shared between a stripe and its session, which may run on another
+// worker. The checksums of a packet are set before it is counted in
+// received.
+struct StripeProgress {
+  uint64_t first_packet;
+  uint64_t packet_count;
+  std::atomic<uint64_t> received = 0; // Written in place so far.
+  // CRC-32C of the packets that came over the network, by packet -
+  // first_packet; the others were resumed or copied by a delta.
+  std::vector<uint32_t> checksums;
+  std::vector<bool> checksummed;
+  StripeMetrics metrics;
+
+  StripeProgress(uint64_t first_packet, uint64_t packet_count)
+      : first_packet(first_packet), packet_count(packet_count),
+        checksums(packet_count), checksummed(packet_count) {}
+};
+
+// Parity chunks of a FEC group some of whose data is missing.
+struct ParityGroup {
+  uint32_t size;                 // Data packets.
+  std::vector<uint32_t> indices; // Of the parity chunks, as they came.
+  std::vector<uint8_t> chunks;   // A full chunk each.
+};
+
+// Receive state of one stripe of an upload: its packets are written in
+// place into the shared files and acked back to the client. Packets lost
+// from a FEC group are rebuilt from the others, read back from the files,
+// and its parity. Owned by the worker whose port the stripe was assigned
+// and only touched from its thread.
+class Stripe {
+  uint64_t stripe_id;
+  uint64_t first_packet;
+  uint64_t end_packet;
+  uint64_t file_size;
+  uint32_t chunk_size; // Of every packet but the stream's last.
+  std::shared_ptr<FIO::FileSet> files; // Preallocated by the session.
+  std::shared_ptr<StripeProgress> progress;
+  std::shared_ptr<PacketBitmap> received_packets; // Of the whole upload.
+  SCK::Reactor &reactor; // The worker's, runs the delayed ack.
+  int udp_sockfd;        // The worker's data socket, acks leave through it.
+  SCK::Reactor::Task on_failure; // Tells the session, once.
+  struct sockaddr_in client_udp_addr = {};   // Where acks are sent.
+  uint64_t received_count = 0;
+  uint64_t cumulative_ack = 0;               // First packet not received.
+  uint32_t pending_acks = 0;                 // Packets since the last ack.
+  std::chrono::steady_clock::time_point first_pending_ack;
+  uint64_t ack_timer = 0; // Reactor timer id, 0 if none.
+  uint32_t last_timestamp = 0; // Echoed back for RTT measurement.
+  std::chrono::steady_clock::time_point last_arrival;
+  std::vector<uint8_t> expanded; // The last compressed packet, as sent.
+  std::map<uint64_t, ParityGroup> parity_groups; // By first packet.
+  std::vector<uint8_t> group_buffer;             // A group being rebuilt.
+  uint32_t recovered_count = 0; // Rebuilt packets, wraps.
+  uint32_t get_chunk_size(uint64_t packet_number) const;
+  void mark_received(uint64_t packet_number);
+  void check_group(uint64_t packet_number); // After it arrived.
+  // Rebuilds the group if it has enough parity, drops it once complete.
+  void try_rebuild(std::map<uint64_t, ParityGroup>::iterator group);
+  bool rebuild(uint64_t group_first, const ParityGroup &group);
+  void print(const char *text, LOG::LEVEL level) const; // Tagged with the ID.
+  void schedule_ack();
+
+public:
+  Stripe(const MESG::Stripe &stripe, uint64_t file_size, uint32_t chunk_size,
+         std::shared_ptr<FIO::FileSet> files,
+         std::shared_ptr<StripeProgress> progress,
+         std::shared_ptr<PacketBitmap> received_packets, SCK::Reactor &reactor,
+         int udp_sockfd, SCK::Reactor::Task on_failure);
+  ~Stripe();
+  Stripe(const Stripe &) = delete;
+  Stripe &operator=(const Stripe &) = delete;
+
+  // File and offset for an io_uring write, -1 if the packet spans files.
+  intptr_t find_handle(const MESG::FileMessage &message,
+                       uint64_t &file_offset) const;
+  void set_client_address(const struct sockaddr_in &from) {
+    client_udp_addr = from;
+  }
+  bool check_packet(const MESG::FileMessage &message) const;
+  // False, and the packet is asked for again, if its checksum does not
+  // match. A compressed packet is expanded first, its data then points
+  // into the stripe until the next one.
+  bool verify_packet(MESG::FileMessage &message);
+  bool is_received(uint64_t packet_number) const {
+    return received_packets->test(packet_number);
+  }
+  bool write_packet(const MESG::FileMessage &message);
+  void on_file_message(const MESG::FileMessage &message);
+  // time is from the io_uring submission to its completion.
+  bool end_write(const MESG::FileMessage &message, bool success,
+                 std::chrono::steady_clock::duration time);
+  void record_packet(const MESG::FileMessage &message);
+  void on_parity_message(const MESG::ParityMessage &message);
+  void send_ack_message(); // UDP
+  void send_nak_message(uint64_t packet_number); // UDP
+  void fail(); // The files cannot be written.
+};
+} // namespace SRV
\ No newline at end of file
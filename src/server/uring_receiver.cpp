@@ -0,0 +1,383 @@
+#include "uring_receiver.hpp"
+#include "log.hpp"
+#include "message.hpp"
+#include "typedef.hpp"
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#endif
+
+namespace SRV {
+#ifdef __linux__
+namespace {
+constexpr uint32_t SUBMISSION_ENTRIES = 256;
+constexpr uint32_t COMPLETION_ENTRIES = 4096;
+constexpr uint32_t BUFFER_COUNT = 1024; // Power of two.
+constexpr uint16_t BUFFER_GROUP = 0;
+// Multishot recvmsg puts its header and the source address first.
+constexpr uint32_t BUFFER_HEADER_SIZE =
+    sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in);
+constexpr uint32_t BUFFER_SIZE =
+    BUFFER_HEADER_SIZE + MESG::FILE_HEADER_SIZE + MAX_CHUNK_SIZE;
+// Upper half of user_data is the operation, lower half the buffer id.
+constexpr uint64_t RECEIVE_TAG = 1ULL << 32;
+constexpr uint64_t WRITE_TAG = 2ULL << 32;
+constexpr uint64_t CANCEL_TAG = 3ULL << 32;
+constexpr uint64_t TAG_MASK = ~0xFFFFFFFFULL;
+
+int uring_setup(uint32_t entries, struct io_uring_params *params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                uint32_t flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                  min_complete, flags, nullptr, 0));
+}
+
+int uring_register(int fd, uint32_t opcode, void *arg, uint32_t count) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+// Ring indices are shared with the kernel.
+template <typename T> T load_acquire(T *value) {
+  return std::atomic_ref<T>(*value).load(std::memory_order_acquire);
+}
+
+template <typename T> void store_release(T *value, T new_value) {
+  std::atomic_ref<T>(*value).store(new_value, std::memory_order_release);
+}
+} // namespace
+
+struct UringReceiver::Ring {
+  int fd = -1;
+  void *sq_map = nullptr;
+  size_t sq_map_size = 0;
+  void *cq_map = nullptr;
+  size_t cq_map_size = 0;
+  struct io_uring_sqe *sqes = nullptr;
+  size_t sqes_size = 0;
+  uint32_t *sq_head = nullptr;
+  uint32_t *sq_tail = nullptr;
+  uint32_t sq_mask = 0;
+  uint32_t sq_entries = 0;
+  uint32_t sq_local_tail = 0; // SQEs filled in, published on submit.
+  uint32_t sq_submitted = 0;
+  uint32_t *cq_head = nullptr;
+  uint32_t *cq_tail = nullptr;
+  uint32_t cq_mask = 0;
+  struct io_uring_cqe *cqes = nullptr;
+  struct io_uring_buf_ring *buffer_ring = nullptr;
+  size_t buffer_ring_size = 0;
+  uint16_t buffer_tail = 0;
+  uint32_t free_buffers = 0;       // Owned by the kernel.
+  std::vector<uint8_t> memory;     // BUFFER_COUNT receive buffers.
+  std::vector<uint32_t> write_lengths; // Per buffer, while writing.
+  std::vector<std::chrono::steady_clock::time_point> write_starts;
+  uint32_t writes_in_flight = 0;
+  bool held = false; // The datagram handler started a write.
+  bool receiving = false;
+  bool broken = false;
+  bool stopping = false;
+  int sockfd = -1;
+  struct msghdr message = {};
+  DatagramHandler on_datagram;
+  WriteHandler on_write;
+
+  ~Ring();
+  bool setup();
+  struct io_uring_sqe *get_sqe();
+  void submit(uint32_t min_complete);
+  void reap();
+  void handle(const struct io_uring_cqe &cqe);
+  void arm_receive();
+  uint8_t *buffer(uint16_t id) { return memory.data() + id * BUFFER_SIZE; }
+  void recycle(uint16_t id);
+};
+
+UringReceiver::Ring::~Ring() {
+  if (fd != -1)
+    close(fd);
+  if (cq_map != nullptr && cq_map != sq_map)
+    munmap(cq_map, cq_map_size);
+  if (sq_map != nullptr)
+    munmap(sq_map, sq_map_size);
+  if (sqes != nullptr)
+    munmap(sqes, sqes_size);
+  if (buffer_ring != nullptr)
+    munmap(buffer_ring, buffer_ring_size);
+}
+
+bool UringReceiver::Ring::setup() {
+  struct io_uring_params params = {};
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = COMPLETION_ENTRIES;
+  fd = uring_setup(SUBMISSION_ENTRIES, &params);
+  if (fd < 0)
+    return false;
+  sq_map_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  cq_map_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_map)
+    sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+  sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq_map == MAP_FAILED) {
+    sq_map = nullptr;
+    return false;
+  }
+  cq_map = single_map ? sq_map
+                      : mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  if (cq_map == MAP_FAILED) {
+    cq_map = nullptr;
+    return false;
+  }
+  sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes_map == MAP_FAILED)
+    return false;
+  sqes = static_cast<struct io_uring_sqe *>(sqes_map);
+  uint8_t *sq = static_cast<uint8_t *>(sq_map);
+  uint8_t *cq = static_cast<uint8_t *>(cq_map);
+  sq_head = reinterpret_cast<uint32_t *>(sq + params.sq_off.head);
+  sq_tail = reinterpret_cast<uint32_t *>(sq + params.sq_off.tail);
+  sq_mask = *reinterpret_cast<uint32_t *>(sq + params.sq_off.ring_mask);
+  sq_entries = params.sq_entries;
+  // SQE i always sits in slot i, the index array never changes.
+  uint32_t *sq_array = reinterpret_cast<uint32_t *>(sq + params.sq_off.array);
+  for (uint32_t i = 0; i < sq_entries; ++i)
+    sq_array[i] = i;
+  sq_local_tail = sq_submitted = *sq_tail;
+  cq_head = reinterpret_cast<uint32_t *>(cq + params.cq_off.head);
+  cq_tail = reinterpret_cast<uint32_t *>(cq + params.cq_off.tail);
+  cq_mask = *reinterpret_cast<uint32_t *>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  buffer_ring_size = BUFFER_COUNT * sizeof(struct io_uring_buf);
+  void *ring_map = mmap(nullptr, buffer_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring_map == MAP_FAILED)
+    return false;
+  buffer_ring = static_cast<struct io_uring_buf_ring *>(ring_map);
+  struct io_uring_buf_reg registration = {};
+  registration.ring_addr = reinterpret_cast<uint64_t>(buffer_ring);
+  registration.ring_entries = BUFFER_COUNT;
+  registration.bgid = BUFFER_GROUP;
+  if (uring_register(fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+    return false;
+  memory.resize(static_cast<size_t>(BUFFER_COUNT) * BUFFER_SIZE);
+  write_lengths.resize(BUFFER_COUNT);
+  write_starts.resize(BUFFER_COUNT);
+  for (uint32_t i = 0; i < BUFFER_COUNT; ++i)
+    recycle(static_cast<uint16_t>(i));
+  store_release(&buffer_ring->tail, buffer_tail);
+  return true;
+}
+
+struct io_uring_sqe *UringReceiver::Ring::get_sqe() {
+  if (sq_local_tail - load_acquire(sq_head) >= sq_entries)
+    submit(0); // Full, hand the batch over first.
+  struct io_uring_sqe *sqe = &sqes[sq_local_tail & sq_mask];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_local_tail++;
+  return sqe;
+}
+
+void UringReceiver::Ring::submit(uint32_t min_complete) {
+  store_release(sq_tail, sq_local_tail);
+  uint32_t to_submit = sq_local_tail - sq_submitted;
+  if (to_submit == 0 && min_complete == 0)
+    return;
+  int result = uring_enter(fd, to_submit, min_complete,
+                           min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+  if (result > 0)
+    sq_submitted += result;
+}
+
+void UringReceiver::Ring::arm_receive() {
+  message.msg_namelen = sizeof(struct sockaddr_in);
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = sockfd;
+  sqe->addr = reinterpret_cast<uint64_t>(&message);
+  sqe->len = 1;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->user_data = RECEIVE_TAG;
+  receiving = true;
+}
+
+// The buffer goes back to the kernel with the next published tail.
+void UringReceiver::Ring::recycle(uint16_t id) {
+  // Not through bufs[]: in C++ the flexible array macro adds an empty
+  // member and shifts it. Field by field, the tail overlays entry 0.
+  struct io_uring_buf &entry = reinterpret_cast<struct io_uring_buf *>(
+      buffer_ring)[buffer_tail & (BUFFER_COUNT - 1)];
+  entry.addr = reinterpret_cast<uint64_t>(buffer(id));
+  entry.len = BUFFER_SIZE;
+  entry.bid = id;
+  buffer_tail++;
+  free_buffers++;
+}
+
+void UringReceiver::Ring::reap() {
+  while (true) {
+    uint32_t head = *cq_head;
+    uint32_t tail = load_acquire(cq_tail);
+    if (head == tail)
+      break;
+    for (; head != tail; ++head)
+      handle(cqes[head & cq_mask]);
+    store_release(cq_head, head);
+  }
+  store_release(&buffer_ring->tail, buffer_tail);
+}
+
+void UringReceiver::Ring::handle(const struct io_uring_cqe &cqe) {
+  uint64_t tag = cqe.user_data & TAG_MASK;
+  if (tag == RECEIVE_TAG) {
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+      receiving = false; // Out of buffers, cancelled or failed.
+    if (cqe.res < 0) {
+      if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+        LOG::error("io_uring receive failed: {}", std::strerror(-cqe.res));
+        broken = true;
+      }
+      return;
+    }
+    if (!(cqe.flags & IORING_CQE_F_BUFFER))
+      return;
+    uint16_t id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    free_buffers--;
+    uint8_t *base = buffer(id);
+    const auto *out = reinterpret_cast<struct io_uring_recvmsg_out *>(base);
+    if (out->flags & MSG_TRUNC) {
+      recycle(id); // Not one of ours.
+      return;
+    }
+    struct sockaddr_in from = {};
+    std::memcpy(&from, base + sizeof(*out),
+                std::min<size_t>(out->namelen, sizeof(from)));
+    held = false;
+    on_datagram(std::span<const uint8_t>(base + BUFFER_HEADER_SIZE,
+                                         out->payloadlen),
+                from, id);
+    if (!held)
+      recycle(id);
+  } else if (tag == WRITE_TAG) {
+    uint16_t id = static_cast<uint16_t>(cqe.user_data);
+    writes_in_flight--;
+    const uint8_t *base = buffer(id);
+    const auto *out =
+        reinterpret_cast<const struct io_uring_recvmsg_out *>(base);
+    bool success = cqe.res >= 0 &&
+                   static_cast<uint32_t>(cqe.res) == write_lengths[id];
+    on_write(std::span<const uint8_t>(base + BUFFER_HEADER_SIZE,
+                                      out->payloadlen),
+             success, std::chrono::steady_clock::now() - write_starts[id]);
+    recycle(id);
+  }
+}
+
+UringReceiver::UringReceiver() = default;
+
+UringReceiver::~UringReceiver() = default;
+
+bool UringReceiver::start(int sockfd, DatagramHandler on_datagram,
+                          WriteHandler on_write) {
+  ring = std::make_unique<Ring>();
+  if (!ring->setup()) {
+    ring.reset();
+    return false;
+  }
+  ring->sockfd = sockfd;
+  ring->on_datagram = std::move(on_datagram);
+  ring->on_write = std::move(on_write);
+  ring->arm_receive();
+  ring->submit(0);
+  return true;
+}
+
+int UringReceiver::get_fd() const { return ring ? ring->fd : -1; }
+
+bool UringReceiver::is_receiving() const { return ring && !ring->broken; }
+
+void UringReceiver::process() {
+  if (!ring)
+    return;
+  ring->reap();
+  if (!ring->receiving && !ring->broken && !ring->stopping &&
+      ring->free_buffers > 0)
+    ring->arm_receive(); // Stopped when the buffers ran out.
+  ring->submit(0);       // Writes queued by this batch.
+}
+
+void UringReceiver::write(uint16_t buffer, intptr_t file, uint64_t offset,
+                          std::span<const uint8_t> data) {
+  struct io_uring_sqe *sqe = ring->get_sqe();
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = static_cast<int>(file);
+  sqe->addr = reinterpret_cast<uint64_t>(data.data());
+  sqe->len = static_cast<uint32_t>(data.size());
+  sqe->off = offset;
+  sqe->user_data = WRITE_TAG | buffer;
+  ring->write_lengths[buffer] = static_cast<uint32_t>(data.size());
+  ring->write_starts[buffer] = std::chrono::steady_clock::now();
+  ring->writes_in_flight++;
+  ring->held = true;
+}
+
+void UringReceiver::drain() {
+  if (!ring)
+    return;
+  ring->stopping = true;
+  if (ring->receiving) {
+    struct io_uring_sqe *sqe = ring->get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = RECEIVE_TAG;
+    sqe->user_data = CANCEL_TAG;
+  }
+  ring->reap();
+  while (ring->writes_in_flight > 0 || ring->receiving) {
+    ring->submit(1);
+    ring->reap();
+  }
+}
+#else
+struct UringReceiver::Ring {};
+
+UringReceiver::UringReceiver() = default;
+
+UringReceiver::~UringReceiver() = default;
+
+bool UringReceiver::start(int, DatagramHandler, WriteHandler) {
+  return false;
+}
+
+int UringReceiver::get_fd() const { return -1; }
+
+bool UringReceiver::is_receiving() const { return false; }
+
+void UringReceiver::process() {}
+
+void UringReceiver::write(uint16_t, intptr_t, uint64_t,
+                          std::span<const uint8_t>) {}
+
+void UringReceiver::drain() {}
+#endif
+} // namespace SRV
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "socket.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+
+namespace SRV {
+// io_uring ingest path (Linux only): one multishot recvmsg fills buffers
+// from a kernel-provided buffer ring, and file payloads are written
+// straight from those buffers. A buffer returns to the ring once its
+// datagram was handled or its write completed. Completions are reaped in
+// batches and all follow-up work goes out with one io_uring_enter.
+class UringReceiver {
+public:
+  // buffer identifies the receive buffer holding datagram.
+  using DatagramHandler =
+      std::function<void(std::span<const uint8_t> datagram,
+                         const struct sockaddr_in &from, uint16_t buffer)>;
+  // Called with the datagram whose payload write finished and how long
+  // the write took from its submission.
+  using WriteHandler =
+      std::function<void(std::span<const uint8_t> datagram, bool success,
+                         std::chrono::steady_clock::duration time)>;
+
+  UringReceiver();
+  ~UringReceiver();
+  UringReceiver(const UringReceiver &) = delete;
+  UringReceiver &operator=(const UringReceiver &) = delete;
+
+  // False if io_uring or one of the needed features is unavailable.
+  bool start(int sockfd, DatagramHandler on_datagram, WriteHandler on_write);
+  int get_fd() const; // Readable while completions are pending.
+  bool is_receiving() const; // False after an unrecoverable receive error.
+  void process();             // Handles every pending completion.
+  // Only from the datagram handler; keeps buffer until the write is done.
+  void write(uint16_t buffer, intptr_t file, uint64_t offset,
+             std::span<const uint8_t> data);
+  void drain(); // Cancels receiving, waits for in-flight writes.
+
+private:
+  struct Ring;
+  std::unique_ptr<Ring> ring;
+};
+} // namespace SRV
\ No newline at end of file
@@ -0,0 +1,465 @@
+#include "worker.hpp"
+#include "log.hpp"
+#include "message.hpp"
+#include "typedef.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+constexpr int RECEIVE_BUFFER_BYTES = 8 << 20; // Capped by rmem_max.
+} // namespace
+
+namespace SRV {
+
+Worker::Worker(std::string ip, std::string directory, WorkerPool &pool)
+    : ip(std::move(ip)), directory(std::move(directory)), pool(pool),
+      receive_batch(MESG::FILE_HEADER_SIZE + MAX_CHUNK_SIZE) {}
+
+Worker::~Worker() { stop(); }
+
+bool Worker::start() {
+  if (!reactor.is_valid() || !open_udp())
+    return false;
+  thread = std::thread([this] {
+    reactor.run();
+    uring.drain();
+    for (auto &[transfer_id, session] : sessions)
+      session->abort();
+    sessions.clear();
+    stripes.clear();
+  });
+  return true;
+}
+
+void Worker::stop() {
+  reactor.stop();
+  if (thread.joinable())
+    thread.join();
+}
+
+void Worker::adopt(uint64_t transfer_id, int control_fd) {
+  session_count++;
+  reactor.post([this, transfer_id, control_fd] {
+    open_session(transfer_id, control_fd);
+  });
+}
+
+void Worker::add_stripe(const MESG::Stripe &stripe, uint64_t file_size,
+                        uint32_t chunk_size,
+                        std::shared_ptr<FIO::FileSet> files,
+                        std::shared_ptr<StripeProgress> progress,
+                        std::shared_ptr<PacketBitmap> received_packets,
+                        SCK::Reactor::Task on_ready,
+                        SCK::Reactor::Task on_failure) {
+  stripe_count++;
+  reactor.post([this, stripe, file_size, chunk_size, files, progress,
+                received_packets, on_ready, on_failure] {
+    stripes.emplace(stripe.stripe_id,
+                    std::make_unique<Stripe>(stripe, file_size, chunk_size,
+                                             files, progress, received_packets,
+                                             reactor, udp_socket.get_sockfd(),
+                                             on_failure));
+    on_ready();
+  });
+}
+
+void Worker::remove_stripe(uint64_t stripe_id) {
+  reactor.post([this, stripe_id] {
+    if (stripes.erase(stripe_id) != 0)
+      stripe_count--;
+  });
+}
+
+bool Worker::open_udp() {
+  udp_socket = SCK::Socket(socket(AF_INET, SOCK_DGRAM, 0));
+  if (udp_socket.get_sockfd() < 0) {
+    LOG::error("Failed to create a udp socket. {}", SCK::last_error());
+    return false;
+  }
+  struct sockaddr_in sockaddr = SCK::make_address(ip, 0);
+  SCK::addr_length_t length = sizeof(sockaddr);
+  if (bind(udp_socket.get_sockfd(), (struct sockaddr *)&sockaddr,
+           sizeof(sockaddr)) < 0 ||
+      getsockname(udp_socket.get_sockfd(), (struct sockaddr *)&sockaddr,
+                  &length) < 0 ||
+      !SCK::set_nonblocking(udp_socket.get_sockfd())) {
+    LOG::error("Failed to bind a udp socket. {}", SCK::last_error());
+    return false;
+  }
+  udp_port = ntohs(sockaddr.sin_port);
+  int buffer_bytes = RECEIVE_BUFFER_BYTES;
+  setsockopt(udp_socket.get_sockfd(), SOL_SOCKET, SO_RCVBUF,
+             (const char *)&buffer_bytes, sizeof buffer_bytes);
+  bool uring_started = uring.start(
+      udp_socket.get_sockfd(),
+      [this](std::span<const uint8_t> datagram, const struct sockaddr_in &from,
+             uint16_t buffer) { on_uring_datagram(datagram, from, buffer); },
+      [this](std::span<const uint8_t> datagram, bool success,
+             std::chrono::steady_clock::duration time) {
+        on_uring_write(datagram, success, time);
+      });
+  if (uring_started)
+    return reactor.add(uring.get_fd(), SCK::EVENT_READ,
+                       [this](uint32_t) { on_uring_event(); });
+  return watch_udp();
+}
+
+// Batched recvmmsg path, with GRO where the kernel has it.
+bool Worker::watch_udp() {
+  receive_batch.enable_coalescing(udp_socket.get_sockfd());
+  return reactor.add(udp_socket.get_sockfd(), SCK::EVENT_READ,
+                     [this](uint32_t) { on_udp_event(); });
+}
+
+Session *Worker::find_session(uint64_t transfer_id) {
+  auto session = sessions.find(transfer_id);
+  return session == sessions.end() ? nullptr : session->second.get();
+}
+
+Stripe *Worker::find_stripe(uint64_t stripe_id) {
+  auto stripe = stripes.find(stripe_id);
+  return stripe == stripes.end() ? nullptr : stripe->second.get();
+}
+
+void Worker::open_session(uint64_t transfer_id, int control_fd) {
+  auto session =
+      std::make_unique<Session>(transfer_id, directory, reactor,
+                                SCK::Socket(control_fd), pool.get_chunks(),
+                                pool.get_report());
+  if (!reactor.add(control_fd, SCK::EVENT_READ,
+                   [this, transfer_id](uint32_t events) {
+                     on_control_event(transfer_id, events);
+                   })) {
+    session_count--;
+    return;
+  }
+  sessions.emplace(transfer_id, std::move(session));
+}
+
+// io_uring writes are submitted in the batch their datagram came in, and
+// from then on the kernel holds the file open by itself: closing its fd
+// with the session's files neither fails them nor lets a reused fd take
+// them. So the stripes may go before they complete; their completions
+// find no stripe and are ignored.
+void Worker::end_upload(Session &session, bool complete, uint32_t crc) {
+  for (const SessionStripe &stripe : session.get_stripes())
+    stripe.worker->remove_stripe(stripe.stripe_id);
+  if (complete)
+    session.finish(crc);
+  else
+    session.abort();
+}
+
+void Worker::close_session(Session &session) {
+  uint64_t transfer_id = session.get_transfer_id();
+  reactor.remove(session.get_control_fd());
+  end_upload(session, false);
+  sessions.erase(transfer_id);
+  session_count--;
+}
+
+// Replies to the messages of one read leave together at the end.
+void Worker::on_control_event(uint64_t transfer_id, uint32_t events) {
+  Session *session = find_session(transfer_id);
+  if (session == nullptr)
+    return;
+  if ((events & SCK::EVENT_WRITE) && !session->flush_control()) {
+    close_session(*session);
+    return;
+  }
+  if (events == SCK::EVENT_WRITE)
+    return;
+  MESG::FrameReader &reader = session->get_control_reader();
+  int result = reader.receive(session->get_control_fd());
+  if (result < 0 && SCK::would_block(SCK::last_error()))
+    return;
+  if (result <= 0) {
+    close_session(*session);
+    return;
+  }
+  // A message may end the session.
+  std::span<const uint8_t> message;
+  while (reader.next(message)) {
+    on_control_message(*session, message);
+    session = find_session(transfer_id);
+    if (session == nullptr)
+      return;
+  }
+  if (reader.is_broken()) {
+    LOG::warning("Failed to parse a message.");
+    close_session(*session);
+  } else if (!session->flush_control()) {
+    close_session(*session);
+  }
+}
+
+void Worker::on_control_message(Session &session,
+                                std::span<const uint8_t> data) {
+  bool handled = MESG::dispatch(
+      data, MESG::overloaded{
+                [&](const MESG::StartMessage &message) {
+                  on_start_message(session, message);
+                },
+                [&](const MESG::DeltaMessage &message) {
+                  on_delta_message(session, message);
+                },
+                [&](const MESG::ChunkMessage &message) {
+                  on_chunk_message(session, message);
+                },
+                [&](const MESG::FinalMessage &message) {
+                  end_upload(session, true, message.get_crc_code());
+                },
+            });
+  if (!handled)
+    LOG::warning("Failed to parse a message.");
+}
+
+// A delta upload first signs the old version for the client and copies
+// what it found, a dedup upload waits for the client's chunks and copies
+// those stored; the stripes only carry the rest.
+void Worker::on_start_message(Session &session,
+                              const MESG::StartMessage &message) {
+  if (!session.start(message)) {
+    refuse(session);
+    return;
+  }
+  if (session.has_dedup())
+    return;
+  if (!session.has_delta()) {
+    create_stripes(session);
+    return;
+  }
+  session.sign_delta(
+      [this, transfer_id = session.get_transfer_id()](bool success) {
+        reactor.post([this, transfer_id, success] {
+          on_delta_signed(transfer_id, success);
+        });
+      });
+}
+
+void Worker::on_delta_message(Session &session,
+                              const MESG::DeltaMessage &message) {
+  if (!session.has_delta() || !session.add_delta(message)) {
+    refuse(session);
+    return;
+  }
+  if (!message.is_last())
+    return;
+  session.apply_delta(
+      [this, transfer_id = session.get_transfer_id()](bool success) {
+        reactor.post([this, transfer_id, success] {
+          on_delta_applied(transfer_id, success);
+        });
+      });
+}
+
+// Without signatures the client gets the accept right away and sends
+// everything.
+void Worker::on_delta_signed(uint64_t transfer_id, bool success) {
+  Session *session = find_session(transfer_id);
+  if (session == nullptr || !session->has_delta())
+    return;
+  if (!success) {
+    LOG::warning("Failed to sign the old version, sending it whole.");
+    session->end_delta();
+    create_stripes(*session);
+  } else {
+    session->send_signatures();
+    if (!session->flush_control())
+      close_session(*session);
+  }
+}
+
+void Worker::on_delta_applied(uint64_t transfer_id, bool success) {
+  Session *session = find_session(transfer_id);
+  if (session == nullptr || !session->has_delta())
+    return;
+  if (!success) {
+    LOG::error("Failed to copy from the old version.");
+    refuse(*session);
+    return;
+  }
+  session->end_delta();
+  create_stripes(*session);
+}
+
+void Worker::on_chunk_message(Session &session,
+                              const MESG::ChunkMessage &message) {
+  if (!session.has_dedup() || !session.add_chunks(message)) {
+    refuse(session);
+    return;
+  }
+  if (!message.is_last())
+    return;
+  session.apply_dedup(
+      [this, transfer_id = session.get_transfer_id()](bool success) {
+        reactor.post([this, transfer_id, success] {
+          on_dedup_applied(transfer_id, success);
+        });
+      });
+}
+
+void Worker::on_dedup_applied(uint64_t transfer_id, bool success) {
+  Session *session = find_session(transfer_id);
+  if (session == nullptr || !session->has_dedup())
+    return;
+  if (!success) {
+    LOG::error("Failed to copy stored chunks.");
+    refuse(*session);
+    return;
+  }
+  session->end_dedup();
+  create_stripes(*session);
+}
+
+void Worker::refuse(Session &session) {
+  MESG::AcceptMessage refusal;
+  refusal.set_transfer_id(session.get_transfer_id());
+  refusal.set_message_status(MESG::MESSAGE_FAILURE);
+  session.send_control(refusal);
+  session.flush_control();
+  close_session(session);
+}
+
+// Splits the upload's stream into one stripe per requested flow, each on
+// the least loaded worker, so one large upload scales with the cores. The
+// client hears about the stripes once every worker can take their packets.
+void Worker::create_stripes(Session &session) {
+  uint64_t packet_count = session.get_packet_count();
+  uint64_t stripe_count = std::min<uint64_t>(
+      {session.get_stripe_request(), MESG::MAX_STRIPES, pool.size(),
+       packet_count});
+  stripe_count = std::max<uint64_t>(stripe_count, 1);
+  uint64_t transfer_id = session.get_transfer_id();
+  for (uint64_t i = 0; i < stripe_count; ++i) {
+    Worker &worker = pool.least_loaded();
+    MESG::Stripe stripe = {pool.new_id(), worker.get_udp_port(),
+                           packet_count * i / stripe_count,
+                           packet_count * (i + 1) / stripe_count};
+    auto progress = std::make_shared<StripeProgress>(
+        stripe.first_packet, stripe.end_packet - stripe.first_packet);
+    session.add_stripe(stripe, worker, progress);
+    worker.add_stripe(
+        stripe, session.get_file_size(), session.get_chunk_size(),
+        session.get_files(), progress, session.get_received_packets(),
+        [this, transfer_id, stripe_id = stripe.stripe_id] {
+          reactor.post([this, transfer_id, stripe_id] {
+            on_stripe_ready(transfer_id, stripe_id);
+          });
+        },
+        [this, transfer_id, stripe_id = stripe.stripe_id] {
+          reactor.post([this, transfer_id, stripe_id] {
+            on_stripe_failed(transfer_id, stripe_id);
+          });
+        });
+  }
+}
+
+void Worker::on_stripe_ready(uint64_t transfer_id, uint64_t stripe_id) {
+  Session *session = find_session(transfer_id);
+  if (session == nullptr || !session->has_stripe(stripe_id) ||
+      !session->stripe_ready())
+    return; // Waiting for other stripes.
+  session->send_reply();
+  if (!session->flush_control())
+    close_session(*session);
+}
+
+void Worker::on_stripe_failed(uint64_t transfer_id, uint64_t stripe_id) {
+  Session *session = find_session(transfer_id);
+  if (session != nullptr && session->has_stripe(stripe_id))
+    close_session(*session);
+}
+
+void Worker::on_udp_event() {
+  // Drain the socket, the next readiness report only comes for new data.
+  while (true) {
+    int result = receive_batch.receive(udp_socket.get_sockfd());
+    if (result < 0) {
+      LOG::error("Something went wrong. {}", SCK::last_error());
+      return;
+    }
+    if (result == 0)
+      break;
+    receive_batch.for_each([this](std::span<const uint8_t> datagram,
+                                  const struct sockaddr_in &from) {
+      on_datagram(datagram, from);
+    });
+  }
+}
+
+// File payloads are views into the batch, written out from there.
+void Worker::on_datagram(std::span<const uint8_t> datagram,
+                         const struct sockaddr_in &from) {
+  Stripe *stripe = find_stripe(MESG::peek_transfer_id(datagram));
+  if (stripe == nullptr)
+    return; // Finished or unknown upload.
+  stripe->set_client_address(from);
+  MESG::dispatch(datagram, MESG::overloaded{
+                               [stripe](MESG::FileMessage message) {
+                                 if (stripe->verify_packet(message))
+                                   stripe->on_file_message(message);
+                               },
+                               [stripe](const MESG::ParityMessage &message) {
+                                 stripe->on_parity_message(message);
+                               }});
+}
+
+void Worker::on_uring_event() {
+  uring.process();
+  if (!uring.is_receiving()) {
+    LOG::safe_print("Falling back to recvmmsg.");
+    uring.drain();
+    reactor.remove(uring.get_fd());
+    watch_udp();
+  }
+}
+
+// File payloads are written from the receive buffer; the packet counts as
+// received, and gets acked, once the write completed.
+void Worker::on_uring_datagram(std::span<const uint8_t> datagram,
+                               const struct sockaddr_in &from,
+                               uint16_t buffer) {
+  uint32_t offset = 0;
+  MESG::FileMessage message;
+  if (datagram.size() < sizeof(uint32_t))
+    return;
+  if (MESG::get_uint32(datagram, offset) != MESG::MESSAGE_TYPE_FILE) {
+    on_datagram(datagram, from); // Parity, kept by the stripe.
+    return;
+  }
+  if (!message.decode(datagram))
+    return;
+  Stripe *stripe = find_stripe(message.transfer_id);
+  if (stripe == nullptr)
+    return;
+  stripe->set_client_address(from);
+  if (!stripe->verify_packet(message) || !stripe->check_packet(message))
+    return;
+  if (stripe->is_received(message.packet_number)) {
+    stripe->record_packet(message);
+    return; // Duplicate, only needs another ack.
+  }
+  uint64_t file_offset = 0;
+  intptr_t file = stripe->find_handle(message, file_offset);
+  // Small files are written one by one, expanded packets from the stripe.
+  if (file == -1 || message.encoding != MESG::FILE_ENCODING_RAW) {
+    stripe->on_file_message(message);
+    return;
+  }
+  uring.write(buffer, file, file_offset, message.data);
+}
+
+void Worker::on_uring_write(std::span<const uint8_t> datagram, bool success,
+                            std::chrono::steady_clock::duration time) {
+  MESG::FileMessage message;
+  message.decode(datagram);
+  Stripe *stripe = find_stripe(message.transfer_id);
+  if (stripe == nullptr)
+    return;
+  if (!stripe->end_write(message, success, time))
+    stripe->fail();
+}
+} // namespace SRV
\ No newline at end of file
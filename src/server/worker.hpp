@@ -0,0 +1,93 @@
+#pragma once
+
+#include "datagram_batch.hpp"
+#include "reactor.hpp"
+#include "session.hpp"
+#include "socket.hpp"
+#include "stripe.hpp"
+#include "uring_receiver.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace SRV {
+class WorkerPool;
+
+// A reactor thread with its own UDP port. It serves the control
+// connections of the sessions handed to it and demultiplexes the file
+// packets of the stripes assigned to it by stripe ID. A session spreads
+// its stripes over the least loaded workers of the pool.
+class Worker {
+  std::string ip;
+  std::string directory;
+  WorkerPool &pool;
+  SCK::Reactor reactor;
+  SCK::Socket udp_socket;
+  uint32_t udp_port = 0;
+  UringReceiver uring;         // Linux ingest path, recvmmsg otherwise.
+  SCK::ReceiveBatch receive_batch;
+  std::unordered_map<uint64_t, std::unique_ptr<Session>> sessions;
+  std::unordered_map<uint64_t, std::unique_ptr<Stripe>> stripes;
+  std::atomic<uint32_t> session_count = 0;
+  std::atomic<uint32_t> stripe_count = 0;
+  std::thread thread;
+
+  bool open_udp();
+  bool watch_udp();
+  Session *find_session(uint64_t transfer_id);
+  Stripe *find_stripe(uint64_t stripe_id);
+  void open_session(uint64_t transfer_id, int control_fd);
+  void end_upload(Session &session, bool complete, uint32_t crc = 0);
+  void close_session(Session &session);
+  void on_control_event(uint64_t transfer_id, uint32_t events);
+  void on_control_message(Session &session, std::span<const uint8_t> data);
+  void on_start_message(Session &session, const MESG::StartMessage &message);
+  void on_delta_message(Session &session, const MESG::DeltaMessage &message);
+  // Both ignore uploads that ended meanwhile.
+  void on_delta_signed(uint64_t transfer_id, bool success);
+  void on_delta_applied(uint64_t transfer_id, bool success);
+  void on_chunk_message(Session &session, const MESG::ChunkMessage &message);
+  void on_dedup_applied(uint64_t transfer_id, bool success); // Likewise.
+  void refuse(Session &session); // Closes it.
+  void create_stripes(Session &session);
+  // Both ignore stripes of uploads that ended meanwhile.
+  void on_stripe_ready(uint64_t transfer_id, uint64_t stripe_id);
+  void on_stripe_failed(uint64_t transfer_id, uint64_t stripe_id);
+  void on_udp_event();
+  void on_datagram(std::span<const uint8_t> datagram,
+                   const struct sockaddr_in &from);
+  void on_uring_event();
+  void on_uring_datagram(std::span<const uint8_t> datagram,
+                         const struct sockaddr_in &from, uint16_t buffer);
+  void on_uring_write(std::span<const uint8_t> datagram, bool success,
+                      std::chrono::steady_clock::duration time);
+
+public:
+  Worker(std::string ip, std::string directory, WorkerPool &pool);
+  ~Worker();
+  Worker(const Worker &) = delete;
+  Worker &operator=(const Worker &) = delete;
+
+  bool start(); // Binds the UDP port and starts the thread.
+  void stop();
+  // Any thread. The worker takes ownership of control_fd.
+  void adopt(uint64_t transfer_id, int control_fd);
+  // Any thread. on_ready runs on this worker once packets are accepted,
+  // on_failure if the files cannot be written.
+  void add_stripe(const MESG::Stripe &stripe, uint64_t file_size,
+                  uint32_t chunk_size, std::shared_ptr<FIO::FileSet> files,
+                  std::shared_ptr<StripeProgress> progress,
+                  std::shared_ptr<PacketBitmap> received_packets,
+                  SCK::Reactor::Task on_ready, SCK::Reactor::Task on_failure);
+  void remove_stripe(uint64_t stripe_id); // Any thread.
+  uint32_t get_udp_port() const noexcept { return udp_port; }
+  uint32_t get_load() const noexcept { return session_count + stripe_count; }
+};
+} // namespace SRV
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include "worker_pool.hpp"
+#include "log.hpp"
+#include "worker.hpp"
+
+#include <algorithm>
+
+namespace SRV {
+
+WorkerPool::WorkerPool() : random(std::random_device{}()) {}
+
+WorkerPool::~WorkerPool() { stop(); }
+
+bool WorkerPool::start(uint32_t count, const std::string &ip,
+                       const std::string &directory,
+                       ReportOptions new_report) {
+  chunks.open(directory);
+  report = std::move(new_report);
+  for (uint32_t i = 0; i < count; ++i) {
+    workers.push_back(std::make_unique<Worker>(ip, directory, *this));
+    if (!workers.back()->start()) {
+      LOG::error("Failed to start a worker.");
+      return false;
+    }
+  }
+  return true;
+}
+
+// Workers post to each other while they shut down.
+void WorkerPool::stop() {
+  for (std::unique_ptr<Worker> &worker : workers)
+    worker->stop();
+  workers.clear();
+}
+
+Worker &WorkerPool::least_loaded() {
+  return **std::min_element(
+      workers.begin(), workers.end(), [](const auto &a, const auto &b) {
+        return a->get_load() < b->get_load();
+      });
+}
+
+uint64_t WorkerPool::new_id() {
+  const std::lock_guard<std::mutex> lock(random_mutex);
+  uint64_t id = 0;
+  while (id == 0) // 0 means unassigned.
+    id = random();
+  return id;
+}
+} // namespace SRV
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "chunk_store.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace SRV {
+class Worker;
+
+// How uploads report on themselves.
+struct ReportOptions {
+  std::string metrics_path; // A JSON line per upload, empty for none.
+  uint32_t progress = 0;    // Seconds between progress lines, 0 for none.
+};
+
+// The server's workers. Picks the one for new work, hands out transfer
+// and stripe IDs and holds what the workers share; safe from any thread
+// once started.
+class WorkerPool {
+  ChunkStore chunks;
+  ReportOptions report;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::mutex random_mutex;
+  std::mt19937_64 random; // IDs, hard to guess for other hosts.
+
+public:
+  WorkerPool();
+  ~WorkerPool();
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  bool start(uint32_t count, const std::string &ip,
+             const std::string &directory, ReportOptions new_report);
+  void stop(); // Every worker stops before any is destroyed.
+  uint32_t size() const noexcept { return workers.size(); }
+  Worker &least_loaded();
+  uint64_t new_id(); // Random and never 0.
+  ChunkStore &get_chunks() noexcept { return chunks; }
+  const ReportOptions &get_report() const noexcept { return report; }
+};
+} // namespace SRV
\ No newline at end of file